@@ -0,0 +1,175 @@
+#include "BatchSegmenter.h"
+#include "SegmentServer.h"
+#include "objects/Trace.h"
+#include "objects/MemoryBudget.h"
+#include <thread>
+#include <chrono>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace segment {
+    /*
+     * Constructor for BatchSegmenter
+     * segmenter: segmenter whose options are used for every image, each image is run on a copy of it
+     * maxImages: maximum number of images segmented at the same time
+     * prefetch: number of images read ahead of the ones being segmented
+     * The estimated memory of each running image is reserved from the MemoryBudget
+     */
+    BatchSegmenter::BatchSegmenter(const Segmenter &segmenter, int maxImages, int prefetch) :
+            segmenter(segmenter) {
+        this->maxImages = max(1, maxImages);
+        this->prefetch = max(1, prefetch);
+    }
+
+    /*
+     * run segments every image and returns a summary of the batch
+     * An image that fails is reported and does not stop the others
+     */
+    json BatchSegmenter::run(const vector<boost::filesystem::path> &images) {
+        auto start = chrono::high_resolution_clock::now();
+        this->results = json::object();
+        this->results["images"] = json::array();
+        this->results["failed"] = json::array();
+        this->decoded.clear();
+        this->decodingDone = false;
+
+        thread decoder(&BatchSegmenter::decodeImages, this, cref(images));
+        vector<thread> imageThreads;
+
+        unique_lock<mutex> guard(this->lock);
+        while (true) {
+            this->changed.wait(guard, [this]() {
+                return this->decoded.empty() ? this->decodingDone : canStart(this->decoded.front());
+            });
+            if (this->decoded.empty()) break;
+            // Clumps and tiles of the running images reserve memory too, so it may be gone again
+            if (!MemoryBudget::getInstance().tryReserve(this->decoded.front().memory, this->runningImages == 0)) {
+                continue;
+            }
+
+            DecodedImage image = this->decoded.front();
+            this->decoded.pop_front();
+            this->runningImages++;
+            // The decoder can read the next image
+            this->changed.notify_all();
+            imageThreads.push_back(thread(&BatchSegmenter::runImage, this, image));
+        }
+        guard.unlock();
+
+        decoder.join();
+        for (thread &imageThread : imageThreads) {
+            imageThread.join();
+        }
+
+        double seconds = chrono::duration_cast<chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+        double megapixels = 0, cells = 0;
+        for (json &stats : this->results["images"]) {
+            megapixels += (double) stats["megapixels"];
+            cells += (double) stats["cells"];
+        }
+        int numImages = this->results["images"].size();
+
+        json summary;
+        summary["images"] = numImages;
+        summary["failed"] = this->results["failed"].size();
+        summary["seconds"] = seconds;
+        summary["imagesPerSecond"] = seconds > 0 ? numImages / seconds : 0;
+        summary["megapixelsPerSecond"] = seconds > 0 ? megapixels / seconds : 0;
+        summary["cellsPerSecond"] = seconds > 0 ? cells / seconds : 0;
+        this->results["summary"] = summary;
+
+        printf("BATCH: %d images (%zu failed) in %f s, %f images/s, %f megapixels/s, %f cells/s\n",
+               numImages, this->results["failed"].size(), seconds, (double) summary["imagesPerSecond"],
+               (double) summary["megapixelsPerSecond"], (double) summary["cellsPerSecond"]);
+        return this->results;
+    }
+
+    /*
+     * canStart returns true if an image fits in the remaining MemoryBudget, without reserving it
+     * An image is always allowed to start when nothing else is running so that images
+     * larger than the budget still run. The lock must be held by the caller.
+     */
+    bool BatchSegmenter::canStart(const DecodedImage &image) {
+        if (this->runningImages == 0) return true;
+        if (this->runningImages >= this->maxImages) return false;
+        return MemoryBudget::getInstance().fits(image.memory);
+    }
+
+    /*
+     * decodeImages reads the images in order, staying at most prefetch images ahead of the running ones
+     */
+    void BatchSegmenter::decodeImages(const vector<boost::filesystem::path> &images) {
+        for (const boost::filesystem::path &path : images) {
+            {
+                unique_lock<mutex> guard(this->lock);
+                this->changed.wait(guard, [this]() { return this->decoded.size() < this->prefetch; });
+            }
+
+            DecodedImage image;
+            image.path = path.string();
+            // A corrupt image or running out of memory fails this image, not the whole batch
+            string error;
+            try {
+                TraceSpan span("decodeImage");
+                // Images too large to be read are streamed from their file by the Segmenter
+                cv::Size streamedSize = Image::getStreamedSize(image.path, this->segmenter.page, this->segmenter.region);
+                if (streamedSize.width > 0) {
+                    image.memory = (size_t) streamedSize.width * streamedSize.height * STREAMED_BYTES_PER_PIXEL;
+                } else {
+                    image.mat = Image::readImage(image.path, this->segmenter.page, this->segmenter.region);
+                    if (image.mat.empty()) error = "Could not read image";
+                    image.memory = image.mat.total() * BYTES_PER_PIXEL;
+                }
+            } catch (const exception &ex) {
+                error = ex.what();
+            } catch (...) {
+                error = "Unknown error";
+            }
+
+            lock_guard<mutex> guard(this->lock);
+            if (!error.empty()) {
+                cerr << "Decoding of " << image.path << " failed: " << error << endl;
+                this->results["failed"].push_back({{"image", image.path}, {"error", error}});
+                continue;
+            }
+            this->decoded.push_back(image);
+            this->changed.notify_all();
+        }
+
+        lock_guard<mutex> guard(this->lock);
+        this->decodingDone = true;
+        this->changed.notify_all();
+    }
+
+    /*
+     * runImage segments a decoded image on its own thread and releases its budget when it finishes
+     */
+    void BatchSegmenter::runImage(DecodedImage image) {
+        // Segmenter keeps the state of the image it is running, so each image gets its own
+        Segmenter seg = this->segmenter;
+        string error;
+        try {
+            seg.runSegmentation(image.path, image.mat);
+        } catch (const exception &ex) {
+            error = ex.what();
+        } catch (...) {
+            error = "Unknown error";
+        }
+        image.mat.release();
+
+        lock_guard<mutex> guard(this->lock);
+        if (error.empty()) {
+            json stats = seg.stats;
+            stats["image"] = image.path;
+            this->results["images"].push_back(stats);
+        } else {
+            cerr << "Segmentation of " << image.path << " failed: " << error << endl;
+            this->results["failed"].push_back({{"image", image.path}, {"error", error}});
+        }
+        this->runningImages--;
+        MemoryBudget::getInstance().release(image.memory);
+        this->changed.notify_all();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef BATCHSEGMENTER_H
+#define BATCHSEGMENTER_H
+
+#include "Segmenter.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <boost/filesystem.hpp>
+#include "thirdparty/nlohmann/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace segment {
+    /*
+     * BatchSegmenter segments a list of images, several at a time.
+     * A decoder thread reads the next images while others are segmented, and images are started
+     * in order while fewer than maxImages are running and their estimated memory fits in the MemoryBudget.
+     * All images share the process wide thread pool.
+     */
+    class BatchSegmenter {
+    private:
+        class DecodedImage {
+        public:
+            string path;
+            cv::Mat mat;
+            // Estimated bytes of memory needed to segment the image
+            size_t memory;
+        };
+
+        Segmenter segmenter;
+        int maxImages;
+        int prefetch;
+
+        mutex lock;
+        condition_variable changed;
+        deque<DecodedImage> decoded;
+        bool decodingDone = false;
+        int runningImages = 0;
+        json results;
+
+    public:
+        BatchSegmenter(const Segmenter &segmenter, int maxImages, int prefetch);
+        json run(const vector<boost::filesystem::path> &images);
+
+    private:
+        bool canStart(const DecodedImage &image);
+        void decodeImages(const vector<boost::filesystem::path> &images);
+        void runImage(DecodedImage image);
+    };
+}
+
+#endif //BATCHSEGMENTER_H
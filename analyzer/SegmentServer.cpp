@@ -0,0 +1,290 @@
+#include "SegmentServer.h"
+#include "SegmenterOptions.h"
+#include <thread>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace segment {
+    // Largest request accepted from a client
+    const size_t MAX_REQUEST_SIZE = 1 << 20;
+
+    /*
+     * estimateImageMemory estimates the memory needed to segment an image.
+     * The dimensions are read from the header of PNG files, otherwise they are guessed from the file size.
+     */
+    size_t estimateImageMemory(const string &path) {
+        boost::system::error_code error;
+        size_t fileSize = boost::filesystem::file_size(path, error);
+        if (error) return 0;
+
+        size_t pixels = fileSize;
+        ifstream file(path, ios::binary);
+        unsigned char header[24];
+        if (file.read((char *) header, sizeof(header)) && memcmp(header, "\x89PNG", 4) == 0) {
+            // The IHDR chunk starts with the big endian width and height
+            size_t width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+            size_t height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+            pixels = width * height;
+        }
+        return pixels * BYTES_PER_PIXEL;
+    }
+
+    /*
+     * Constructor for SegmentServer
+     * socketPath: path of the Unix socket to listen on, if empty the server listens on port instead
+     * port: TCP port to listen on, only bound to localhost
+     * maxQueued: maximum number of jobs waiting to be started
+     * cpuBudget: number of cores all running jobs may use together
+     * jobCpus: number of cores a single job is expected to use
+     * The memory of the running jobs is reserved from the MemoryBudget
+     */
+    SegmentServer::SegmentServer(string socketPath, int port, int maxQueued, int cpuBudget, int jobCpus) :
+            queue(maxQueued, cpuBudget, [this](Job *job) { runJob(job); }) {
+        this->socketPath = socketPath;
+        this->port = port;
+        this->jobCpus = jobCpus;
+    }
+
+    SegmentServer::~SegmentServer() {
+        if (this->listenSocket >= 0) {
+            close(this->listenSocket);
+        }
+        if (!this->socketPath.empty()) {
+            unlink(this->socketPath.c_str());
+        }
+    }
+
+    /*
+     * openSocket binds and listens on the Unix socket or TCP port
+     */
+    void SegmentServer::openSocket() {
+        if (!this->socketPath.empty()) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (this->socketPath.size() >= sizeof(address.sun_path)) {
+                throw runtime_error("Socket path is too long: " + this->socketPath);
+            }
+            strcpy(address.sun_path, this->socketPath.c_str());
+            // Remove a socket left behind by a previous server
+            unlink(this->socketPath.c_str());
+
+            this->listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (this->listenSocket < 0 || ::bind(this->listenSocket, (sockaddr *) &address, sizeof(address)) < 0) {
+                throw runtime_error("Could not bind to socket " + this->socketPath + ": " + strerror(errno));
+            }
+        } else {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(this->port);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            this->listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+            int reuse = 1;
+            setsockopt(this->listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (this->listenSocket < 0 || ::bind(this->listenSocket, (sockaddr *) &address, sizeof(address)) < 0) {
+                throw runtime_error("Could not bind to port " + to_string(this->port) + ": " + strerror(errno));
+            }
+        }
+
+        if (listen(this->listenSocket, 64) < 0) {
+            throw runtime_error(string("Could not listen: ") + strerror(errno));
+        }
+    }
+
+    /*
+     * start listens for requests until the process is stopped
+     * Every connection is handled on its own thread
+     */
+    void SegmentServer::start() {
+        openSocket();
+        if (!this->socketPath.empty()) {
+            printf("Listening on %s\n", this->socketPath.c_str());
+        } else {
+            printf("Listening on 127.0.0.1:%d\n", this->port);
+        }
+        fflush(stdout);
+
+        while (true) {
+            int connection = accept(this->listenSocket, nullptr, nullptr);
+            if (connection < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error(string("Could not accept connection: ") + strerror(errno));
+            }
+            thread(&SegmentServer::handleConnection, this, connection).detach();
+        }
+    }
+
+    /*
+     * handleConnection reads a single HTTP request from the connection, answers it with JSON and closes it
+     */
+    void SegmentServer::handleConnection(int connection) {
+        string request;
+        char buffer[4096];
+        size_t headerEnd = string::npos;
+        size_t contentLength = 0;
+
+        // Read the request line and headers
+        while (headerEnd == string::npos && request.size() < MAX_REQUEST_SIZE) {
+            ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                close(connection);
+                return;
+            }
+            request.append(buffer, received);
+            headerEnd = request.find("\r\n\r\n");
+        }
+
+        int status;
+        json response;
+        string method, target;
+        istringstream requestLine(request.substr(0, request.find("\r\n")));
+        requestLine >> method >> target;
+
+        if (headerEnd == string::npos) {
+            status = 413;
+            response["error"] = "Request too large";
+        } else {
+            // Find the length of the body
+            string headers = request.substr(0, headerEnd);
+            for (char &c : headers) c = tolower(c);
+            size_t lengthHeader = headers.find("\ncontent-length:");
+            if (lengthHeader != string::npos) {
+                contentLength = strtoul(headers.c_str() + lengthHeader + 16, nullptr, 10);
+            }
+
+            // Read the rest of the body
+            string body = request.substr(headerEnd + 4);
+            while (body.size() < contentLength && body.size() < MAX_REQUEST_SIZE) {
+                ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+                if (received <= 0) break;
+                body.append(buffer, received);
+            }
+
+            status = handleRequest(method, target, body, response);
+        }
+
+        string reason;
+        switch (status) {
+            case 200: reason = "OK"; break;
+            case 202: reason = "Accepted"; break;
+            case 400: reason = "Bad Request"; break;
+            case 404: reason = "Not Found"; break;
+            case 413: reason = "Payload Too Large"; break;
+            case 503: reason = "Service Unavailable"; break;
+            default: reason = "Error"; break;
+        }
+        string content = response.dump();
+        string reply = "HTTP/1.1 " + to_string(status) + " " + reason + "\r\n" +
+                       "Content-Type: application/json\r\n" +
+                       "Content-Length: " + to_string(content.size()) + "\r\n" +
+                       "Connection: close\r\n\r\n" + content;
+
+        size_t sent = 0;
+        while (sent < reply.size()) {
+            ssize_t written = send(connection, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (written <= 0) break;
+            sent += written;
+        }
+        close(connection);
+    }
+
+    /*
+     * handleRequest routes a request and fills in the JSON response, returns the HTTP status code
+     */
+    int SegmentServer::handleRequest(const string &method, const string &target, const string &body, json &response) {
+        if (method == "POST" && target == "/jobs") {
+            return submitJob(body, response);
+        }
+
+        if (method == "GET" && target == "/jobs") {
+            response["queue"] = this->queue.getStatus();
+            response["jobs"] = this->queue.getJobs();
+            return 200;
+        }
+
+        if (method == "GET" && target.compare(0, 6, "/jobs/") == 0) {
+            Job job;
+            int id = atoi(target.c_str() + 6);
+            if (!this->queue.getJob(id, job)) {
+                response["error"] = "No job " + target.substr(6);
+                return 404;
+            }
+            response = job.toJSON();
+            return 200;
+        }
+
+        response["error"] = "Unknown request " + method + " " + target;
+        return 404;
+    }
+
+    /*
+     * submitJob validates the options of a job and adds it to the queue
+     */
+    int SegmentServer::submitJob(const string &body, json &response) {
+        json request = json::parse(body, nullptr, false);
+        if (!request.is_object()) {
+            response["error"] = "Job must be a JSON object";
+            return 400;
+        }
+
+        int priority = 0;
+        size_t memory = 0;
+        vector<string> args;
+        for (auto &option : request.items()) {
+            string value = option.value().is_string() ? option.value().get<string>() : option.value().dump();
+            if (option.key() == "priority") {
+                priority = atoi(value.c_str());
+            } else if (option.key() == "memory") {
+                memory = strtoull(value.c_str(), nullptr, 10) << 20;
+            } else {
+                args.push_back("--" + option.key() + "=" + value);
+            }
+        }
+
+        // Reject jobs with invalid options now instead of when they start
+        vector<boost::filesystem::path> images;
+        try {
+            boost::program_options::variables_map vm = parseSegmenterOptions(args);
+            createSegmenter(vm);
+            images = getImagePaths(vm);
+        } catch (const exception &ex) {
+            response["error"] = ex.what();
+            return 400;
+        }
+
+        if (memory == 0) {
+            for (boost::filesystem::path &image : images) {
+                memory = max(memory, estimateImageMemory(image.string()));
+            }
+        }
+
+        int id = this->queue.submit(args, priority, this->jobCpus, memory);
+        if (id < 0) {
+            response["error"] = "Job queue is full";
+            return 503;
+        }
+        response["id"] = id;
+        response["status"] = getJobStatusName(JOB_QUEUED);
+        return 202;
+    }
+
+    /*
+     * runJob runs the segmentation of a job, called by the job queue on the job's thread
+     */
+    void SegmentServer::runJob(Job *job) {
+        boost::program_options::variables_map vm = parseSegmenterOptions(job->args);
+        Segmenter seg = createSegmenter(vm);
+        for (boost::filesystem::path const &image : getImagePaths(vm)) {
+            seg.runSegmentation(image.string());
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef SEGMENTSERVER_H
+#define SEGMENTSERVER_H
+
+#include "objects/JobQueue.h"
+
+using namespace std;
+
+namespace segment {
+    /*
+     * SegmentServer is a long running segmentation process that accepts jobs over HTTP
+     * on a local Unix socket or TCP port, so uploads don't each start their own process.
+     *
+     * POST /jobs      queues a job, the body is a JSON object of the same options segment accepts,
+     *                 plus an optional "priority" and "memory" (estimated MB the job needs)
+     * GET  /jobs/<id> returns the status of a job
+     * GET  /jobs      returns the status of the queue and all known jobs
+     */
+    class SegmentServer {
+    private:
+        string socketPath;
+        int port;
+        int listenSocket = -1;
+        // Number of cores a single job is expected to use
+        int jobCpus;
+        JobQueue queue;
+
+    public:
+        SegmentServer(string socketPath, int port, int maxQueued, int cpuBudget, int jobCpus);
+        ~SegmentServer();
+        void start();
+
+    private:
+        void openSocket();
+        void handleConnection(int connection);
+        int handleRequest(const string &method, const string &target, const string &body, json &response);
+        int submitJob(const string &body, json &response);
+        void runJob(Job *job);
+    };
+
+    // Approximate peak memory used per pixel of an image over the whole pipeline
+    const size_t BYTES_PER_PIXEL = 100;
+    // Approximate peak memory used per pixel of a streamed image, only its masks are kept in memory
+    const size_t STREAMED_BYTES_PER_PIXEL = 8;
+
+    size_t estimateImageMemory(const string &path);
+}
+
+#endif //SEGMENTSERVER_H
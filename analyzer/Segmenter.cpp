@@ -9,6 +9,11 @@
 #include "functions/OverlappingCellSegmentation.h"
 #include "functions/Preprocessing.h"
 #include "functions/Export.h"
+#include "objects/ClumpsPipeline.h"
+#include "objects/Trace.h"
+#include "objects/CacheKey.h"
+#include "objects/ArtifactWriter.h"
+#include "objects/Logger.h"
 
 extern "C" {
 #include "vl/quickshift.h"
@@ -48,14 +53,302 @@ namespace segment {
     }
 
 
-    void Segmenter::runSegmentation(string fileName) {
+    /*
+     * runClumpStages runs nuclei detection, initial cell segmentation and overlapping cell segmentation
+     * one after another, each stage finishes for all clumps before the next one starts
+     */
+    void Segmenter::runClumpStages(Image *image) {
+        double end;
+        cv::Mat outimg;
+
+        auto start = chrono::high_resolution_clock::now();
+        TraceSpan nucleiDetectionSpan("runNucleiDetection");
+        if (debug) image->log("Beginning MSER nuclei detection...\n");
+
+        // Find nuclei in each clump
+        runNucleiDetection(image, delta, minArea, maxArea, maxVariation, minDiversity, minCircularity, debug);
+
+        // Display and save nuclei to an image, the deep zoom overlay replaces the full resolution renders
+        if (image->hasWriteDirectory() && !deepZoom) {
+            outimg = image->getNucleiBoundaries();
+            image->writeImage("nucleiBoundaries.png", outimg);
+            outimg.release();
+        }
+
+        end = std::chrono::duration_cast<std::chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+        if (debug) image->log("Finished MSER nuclei detection, time: %f\n", end);
+        stats["nucleiDetection"] = end;
+        nucleiDetectionSpan.end();
+
+        start = chrono::high_resolution_clock::now();
+        TraceSpan initialCellSegmentationSpan("runInitialCellSegmentation");
+        if (debug) image->log("Beginning initial cell segmentation...\n");
+
+        // Takes the nuclei and creates a new Cell object for each since each cell has a nuclei
+        // Estimates the initial cell boundaries of the cell by associating each point inside the
+        // clump with the nearest nucleus. Then overlapping region is extrapolated with an ellipse.
+        outimg = runInitialCellSegmentation(image, threshold1, threshold2, debug);
+
+        // Display and save initial cell boundaries to png file
+        if (!deepZoom) image->writeImage("initial_cell_boundaries.png", outimg);
+        outimg.release();
+
+        end = std::chrono::duration_cast<std::chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+        if (debug) image->log("Finished initial cell segmentation, time: %f\n", end);
+        stats["initialCellSegmentation"] = end;
+        initialCellSegmentationSpan.end();
+
+        start = chrono::high_resolution_clock::now();
+        TraceSpan overlappingSegmentationSpan("runOverlappingSegmentation");
+        if (debug) image->log("Beginning segmentation by level set functions...\n");
+
+        // Use level sets to find the actual cell boundaries by shrinking the initial cell
+        // boundaries' overlapping extrapolated contour (the ellipse) until the level set converges.
+        runOverlappingSegmentation(image, dt, epsilon, mu, kappa, chi);
+
+        end = std::chrono::duration_cast<std::chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+        if (debug) image->log("Finished level set cell segmentation, time: %f\n", end);
+        stats["overlappingCellSegmentation"] = end;
+    }
+
+    /*
+     * runClumpPipeline runs the same stages as runClumpStages, but each clump moves on to the next
+     * stage as soon as it is done instead of waiting for the slowest clump of the stage.
+     * The checkpoints are saved in the same format so either mode can resume the other.
+     */
+    void Segmenter::runClumpPipeline(Image *image) {
+        vector<Clump> *clumps = &image->clumps;
+        cv::Mat outimg;
+
+        auto start = chrono::high_resolution_clock::now();
+        TraceSpan span("runClumpPipeline");
+        if (debug) image->log("Beginning clump pipeline: nuclei detection, initial and level set cell segmentation...\n");
+
+        // Threads load clumps from the records of a previous run while the done functions append new ones
+        CheckpointStore nucleiBoundaries(image->getCheckpointPath("nucleiBoundaries"), image->useCache);
+        CheckpointStore initialCellBoundaries(image->getCheckpointPath("initialCellBoundaries"), image->useCache);
+        CheckpointStore finalCellBoundaries(image->getCheckpointPath("finalCellBoundaries"), image->useCache);
+        loadNucleiBoundaries(nucleiBoundaries, image, clumps);
+
+        ClumpsPipeline clumpsPipeline(clumps);
+
+        clumpsPipeline.addStage(
+            NUCLEI_DETECTION,
+            [this, image](Clump *clump, int clumpIdx) {
+                startNucleiDetectionThread(clump, clumpIdx, image, delta, minArea, maxArea, maxVariation,
+                                           minDiversity, minCircularity, debug);
+            },
+            [&nucleiBoundaries](Clump *clump, int clumpIdx) {
+                if (!clump->nucleiBoundariesLoaded) {
+                    saveNucleiBoundaries(nucleiBoundaries, clump, clumpIdx);
+                }
+            });
+
+        clumpsPipeline.addStage(
+            INITIAL_CELL_SEGMENTATION,
+            [this, image, &initialCellBoundaries](Clump *clump, int clumpIdx) {
+                startInitialCellSegmentation(image, clump, clumpIdx, initialCellBoundaries, debug);
+            },
+            [&initialCellBoundaries](Clump *clump, int clumpIdx) {
+                saveInitialCellSegmentation(initialCellBoundaries, clump, clumpIdx);
+            });
+
+        clumpsPipeline.addStage(
+            OVERLAPPING_CELL_SEGMENTATION,
+            [this, image, &finalCellBoundaries](Clump *clump, int clumpIdx) {
+                startOverlappingCellSegmentation(image, clump, clumpIdx, finalCellBoundaries,
+                                                 dt, epsilon, mu, kappa, chi);
+            },
+            [&finalCellBoundaries](Clump *clump, int clumpIdx) {
+                saveOverlappingCellSegmentation(finalCellBoundaries, clump, clumpIdx);
+            });
+
+        clumpsPipeline.start();
+
+        nucleiBoundaries.flush();
+        initialCellBoundaries.flush();
+        finalCellBoundaries.flush();
+
+        if (image->hasWriteDirectory() && !deepZoom) {
+            outimg = image->getNucleiBoundaries();
+            image->writeImage("nucleiBoundaries.png", outimg);
+            outimg.release();
+
+            outimg = image->getInitialCellBoundaries();
+            image->writeImage("initial_cell_boundaries.png", outimg);
+            outimg.release();
+        }
+
+        double end = std::chrono::duration_cast<std::chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+        if (debug) image->log("Finished clump pipeline, time: %f\n", end);
+        stats["clumpPipeline"] = end;
+    }
+
+    /*
+     * runSegmentation segments an image and writes the results to its write directory
+     * fileName: path of the image
+     * mat: the image if it was already read, read from fileName if empty
+     */
+    void Segmenter::runSegmentation(string fileName, cv::Mat mat) {
+        Image image = Image(fileName, mat, this->page, this->region);
+        segmentImage(&image);
+    }
+
+    /*
+     * segment segments an image in memory and returns the clumps, nuclei and cells found
+     * mat: BGR image, it is not copied or modified
+     * writeDirectory: directory the results and checkpoints are also written to, nothing is written to disk if empty
+     */
+    SegmentationResult Segmenter::segment(const cv::Mat &mat, string writeDirectory) {
+        Image image = Image(mat, writeDirectory);
+        segmentImage(&image);
+        return getSegmentationResult(&image);
+    }
+
+    /*
+     * segment segments a BGR image in a buffer owned by the caller, the buffer is not copied or modified
+     * bgr: rows of 8 bit blue, green and red pixels
+     * step: bytes per row, 0 if the rows are not padded
+     */
+    SegmentationResult Segmenter::segment(const unsigned char *bgr, int width, int height, size_t step,
+                                          string writeDirectory) {
+        cv::Mat mat(height, width, CV_8UC3, const_cast<unsigned char *>(bgr), step > 0 ? step : cv::Mat::AUTO_STEP);
+        return segment(mat, writeDirectory);
+    }
+
+    /*
+     * getSegmentationResult copies the clumps and cells of a segmented image, contours are in image coordinates
+     */
+    SegmentationResult Segmenter::getSegmentationResult(Image *image) {
+        SegmentationResult result;
+        result.stats = stats;
+        for (Clump &clump : image->clumps) {
+            ClumpResult clumpResult;
+            clumpResult.boundary = clump.contour;
+            clumpResult.boundingRect = clump.boundingRect;
+            for (Cell &cell : clump.cells) {
+                CellResult cellResult;
+                cellResult.nucleusBoundary = clump.undoBoundingRect(cell.nucleusBoundary);
+                cellResult.initialBoundary = clump.undoBoundingRect(cell.cytoBoundary);
+                cellResult.boundary = clump.undoBoundingRect(cell.finalContour);
+                cellResult.nucleusArea = cell.nucleusArea;
+                cellResult.area = cell.phiArea;
+                clumpResult.cells.push_back(cellResult);
+            }
+            result.clumps.push_back(clumpResult);
+        }
+        return result;
+    }
+
+    /*
+     * getTileSize returns the largest size of the preprocessing tiles, see tileSize
+     * Streamed images are always tiled so only the running tiles are decoded
+     */
+    int Segmenter::getTileSize(Image *image) {
+        if (tileSize == 0 && image->isStreamed()) return STREAMED_TILE_SIZE;
+        return tileSize;
+    }
+
+    /*
+     * getTiles returns the number of horizontal and vertical tiles the image is preprocessed in
+     */
+    cv::Size Segmenter::getTiles(Image *image) {
+        return getPreprocessingTiles(image->getSize(), tilesX, tilesY, getTileSize(image));
+    }
+
+    /*
+     * setCacheKeys keys the cache entry of each stage by the image's pixels and the parameters of that stage
+     * and every stage before it, so changing a parameter only reruns the stages that depend on it
+     * Nothing is keyed if the image has no write directory or the cache is disabled, so the pixels aren't hashed
+     * for nothing. The stages are then saved to the write directory, see Image::getCachePath.
+     */
+    void Segmenter::setCacheKeys(Image *image) {
+        if (!image->hasWriteDirectory() || !useCache) return;
+        CacheKey preprocessing = CacheKey().add(image->getContentHash())
+                .add(kernelsize).add(maxdist).add(threshold1).add(threshold2).add(maxGmmIterations).add(gmm);
+        // The full resolution mask also depends on the tiles it was preprocessed in
+        cv::Size tiles = getTiles(image);
+        CacheKey tiledPreprocessing = CacheKey().add(preprocessing).add(tiles.width).add(tiles.height);
+        // The coarse to fine mask also depends on the clumps found on the pyramid level
+        CacheKey coarsePreprocessing = CacheKey().add(preprocessing).add(pyramidLevel).add(minAreaThreshold).add(getTileSize(image));
+        CacheKey clumps = CacheKey().add(pyramidLevel > 0 ? coarsePreprocessing : tiledPreprocessing).add(minAreaThreshold);
+        CacheKey nuclei = CacheKey().add(clumps)
+                .add(delta).add(minArea).add(maxArea).add(maxVariation).add(minDiversity).add(minCircularity);
+        // Initial cell segmentation has no parameters of its own
+        CacheKey initialCells = CacheKey().add(nuclei).add(string("initialCellBoundaries"));
+        CacheKey finalCells = CacheKey().add(initialCells).add(dt).add(epsilon).add(mu).add(kappa).add(chi);
+
+        image->cacheKeys["gmmPredictions"] = tiledPreprocessing.str();
+        image->cacheKeys["gmmPredictions_full"] = tiledPreprocessing.str();
+        image->cacheKeys["gmmPredictions_level" + to_string(pyramidLevel)] = coarsePreprocessing.str();
+        image->cacheKeys["nucleiBoundaries"] = nuclei.str();
+        image->cacheKeys["initialCellBoundaries"] = initialCells.str();
+        image->cacheKeys["finalCellBoundaries"] = finalCells.str();
+    }
+
+    /*
+     * compareToFullResolution runs preprocessing at full resolution and compares its clumps to the clumps
+     * of the coarse to fine mask, the dice coefficient of the clumps and the number of clumps of both
+     * are logged and added to stats
+     */
+    void Segmenter::compareToFullResolution(Image *image, cv::Mat gmmPredictions) {
+        auto start = chrono::high_resolution_clock::now();
+        TraceSpan span("compareToFullResolution");
+
+        // Saved under its own name so the comparison never replaces the artifacts of the run
+        cv::Mat fullPredictions = image->loadMask("gmmPredictions_full");
+        if (fullPredictions.empty()) {
+            fullPredictions = runPreprocessing(image, getTiles(image), kernelsize, maxdist, quickshift, threshold1, threshold2, maxGmmIterations, gmm);
+            image->writeMask("gmmPredictions_full", fullPredictions);
+        }
+        double fullTime = std::chrono::duration_cast<std::chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+
+        vector<vector<cv::Point>> clumps = findFinalClumpBoundaries(gmmPredictions.clone(), minAreaThreshold);
+        vector<vector<cv::Point>> fullClumps = findFinalClumpBoundaries(fullPredictions, minAreaThreshold);
+
+        cv::Mat clumpsMask = cv::Mat::zeros(image->getSize(), CV_8UC1);
+        cv::Mat fullClumpsMask = cv::Mat::zeros(image->getSize(), CV_8UC1);
+        cv::drawContours(clumpsMask, clumps, -1, 255, -1);
+        cv::drawContours(fullClumpsMask, fullClumps, -1, 255, -1);
+        double dice = calcDice(clumpsMask, fullClumpsMask);
+
+        image->log("Pyramid level %i compared to full resolution: clump dice %f, clumps %zu, full resolution clumps %zu, full resolution preprocessing time: %f\n",
+                   pyramidLevel, dice, clumps.size(), fullClumps.size(), fullTime);
+        stats["fullResolution"] = {
+                {"dice", dice},
+                {"clumps", clumps.size()},
+                {"fullResolutionClumps", fullClumps.size()},
+                {"preprocessing", fullTime}
+        };
+    }
+
+    /*
+     * segmentImage runs every stage of the segmentation on an image
+     */
+    void Segmenter::segmentImage(Image *image) {
         debug = true;
+        // Tracing is turned on by the first segmentation that asks for it, not when options are parsed
+        if (trace) Trace::enable();
         auto total = chrono::high_resolution_clock::now();
+        // Spans of the segmentation are kept until it has written them
+        TraceSession traceSession;
+        TraceSpan segmentationSpan("runSegmentation");
 
         double end;
 
-        Image image = Image(fileName);
-
+        image->useCache = useCache;
+        image->migrateCache = migrateCache;
+        setCacheKeys(image);
+        // Other images may be written at the same time, the stats count every image written while this one runs
+        ArtifactWriter &writer = ArtifactWriter::getInstance();
+        ArtifactWriterStats artifactsStart = writer.getStats();
+        stats = json::object();
+        stats["megapixels"] = (double) image->getSize().width * image->getSize().height / 1000000.0;
 
         cv::Mat outimg;
 
@@ -64,136 +357,169 @@ namespace segment {
         auto start = chrono::high_resolution_clock::now();
 
         start = chrono::high_resolution_clock::now();
-        if (debug) image.log("Beginning Preprocessing...\n");
+        TraceSpan preprocessingSpan("runPreprocessing");
+        if (debug) image->log("Beginning Preprocessing...\n");
 
-        // Check for a gmmPredictions matrix save file, if it doesn't exist
+        // Check for a gmmPredictions mask file, if it doesn't exist
         // run preprocessing
-        cv::Mat gmmPredictions = image.loadMatrix("gmmPredictions.yml");
+        // Masks found on a pyramid level are saved separately so they don't replace the full resolution mask
+        string gmmPredictionsFile = pyramidLevel > 0 ? "gmmPredictions_level" + to_string(pyramidLevel)
+                                                     : "gmmPredictions";
+        cv::Mat gmmPredictions = image->loadMask(gmmPredictionsFile);
         if (gmmPredictions.empty()) {
             // GMM predictions is a black and white photo of the input images
             // Where black is the background and white are the clumps
-            gmmPredictions = runPreprocessing(&image, kernelsize, maxdist, threshold1, threshold2, maxGmmIterations);
-            image.writeMatrix("gmmPredictions.yml", gmmPredictions);
+            if (pyramidLevel > 0) {
+                gmmPredictions = runCoarsePreprocessing(image, pyramidLevel, minAreaThreshold, getTileSize(image), kernelsize, maxdist,
+                                                        quickshift, threshold1, threshold2, maxGmmIterations, gmm);
+            } else {
+                gmmPredictions = runPreprocessing(image, getTiles(image), kernelsize, maxdist, quickshift, threshold1, threshold2, maxGmmIterations, gmm);
+            }
+            image->writeMask(gmmPredictionsFile, gmmPredictions);
 
             // Saving the matrix to png requires a threshold
-            cv::threshold(gmmPredictions, outimg, 0, 256, CV_THRESH_BINARY);
-            image.writeImage("gmmPredictions.png", outimg);
-            outimg.release();
+            if (image->hasWriteDirectory()) {
+                cv::threshold(gmmPredictions, outimg, 0, 256, CV_THRESH_BINARY);
+                image->writeImage("gmmPredictions.png", outimg);
+                outimg.release();
+            }
         }
-        image.gmmPredictions = gmmPredictions;
+        image->gmmPredictions = gmmPredictions;
 
         end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
-        if (debug) image.log("Finished with preprocessing, time: %f\n", end);
+        if (debug) image->log("Finished with preprocessing, time: %f\n", end);
+        stats["preprocessing"] = end;
+        preprocessingSpan.end();
+
+        if (pyramidLevel > 0 && compareFullResolution) {
+            compareToFullResolution(image, gmmPredictions);
+        }
 
         start = chrono::high_resolution_clock::now();
-        if (debug) image.log("Beginning GMM Output post processing...\n");
+        TraceSpan clumpFindingSpan("findFinalClumpBoundaries");
+        if (debug) image->log("Beginning GMM Output post processing...\n");
 
         // Finds the clump boundaries using the gmmPredictions mask
         vector <vector<cv::Point>> clumpBoundaries = findFinalClumpBoundaries(gmmPredictions, minAreaThreshold);
 
-        printf("CLUMPS: %zu\n", clumpBoundaries.size());
+        image->log("CLUMPS: %zu\n", clumpBoundaries.size());
 
 
         // Color the clumps different colors and then write to png file
-        outimg = drawColoredContours(image.mat, &clumpBoundaries);
-        image.writeImage("clump_boundaries.png", outimg);
-        if (debug) {
-            //cv::imshow("Clump Segmentation", outimg);
-            //cv::waitKey(0);
+        if (image->hasWriteDirectory() && !image->isStreamed()) {
+            outimg = drawColoredContours(image->mat, &clumpBoundaries);
+            image->writeImage("clump_boundaries.png", outimg);
+            if (debug) {
+                //cv::imshow("Clump Segmentation", outimg);
+                //cv::waitKey(0);
+            }
+            outimg.release();
         }
-        outimg.release();
 
         // Create a Clump object for each clump boundary
-        image.createClumps(clumpBoundaries);
+        image->createClumps(clumpBoundaries);
 
         end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
         unsigned int numClumps = clumpBoundaries.size();
-        if (debug) image.log("Finished GMM post processing, clumps found:%i, time: %f\n", numClumps, end);
+        if (debug) image->log("Finished GMM post processing, clumps found:%i, time: %f\n", numClumps, end);
+        stats["clumpFinding"] = end;
+        clumpFindingSpan.end();
 
         double endClumpSeg = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - startClumpSeg).count() / 1000000.0;
-        if (debug) image.log("Finished clump segmentation, time: %f\n", endClumpSeg);
+        if (debug) image->log("Finished clump segmentation, time: %f\n", endClumpSeg);
 
-        start = chrono::high_resolution_clock::now();
-        if (debug) image.log("Beginning MSER nuclei detection...\n");
+        if (pipeline) {
+            runClumpPipeline(image);
+        } else {
+            runClumpStages(image);
+        }
+        image->gmmPredictions.release();
 
-        // Find nuclei in each clump
-        runNucleiDetection(&image, delta, minArea, maxArea, maxVariation, minDiversity, minCircularity, debug);
+        // Clumps without nuclei are kept until every stage is finished so clump indexes don't change
+        removeClumpsWithoutNuclei(&image->clumps);
+        //displayResults(&image->clumps);
 
-        // Display and save nuclei to an image
-        outimg = image.getNucleiBoundaries();
-        image.writeImage("nucleiBoundaries.png", outimg);
-        outimg.release();
+        int numCells = 0;
+        for (Clump &clump : image->clumps) {
+            numCells += clump.cells.size();
+        }
+        stats["clumps"] = image->clumps.size();
+        stats["cells"] = numCells;
 
+
+        // clean up
         end = std::chrono::duration_cast<std::chrono::microseconds>(
-                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
-        if (debug) image.log("Finished MSER nuclei detection, time: %f\n", end);
+                chrono::high_resolution_clock::now() - total).count() / 1000000.0;
 
-        start = chrono::high_resolution_clock::now();
-        if (debug) image.log("Beginning initial cell segmentation...\n");
+        if (debug || totalTimed) image->log("Segmentation finished, total time: %f\n", end);
 
-        // Takes the nuclei and creates a new Cell object for each since each cell has a nuclei
-        // Estimates the initial cell boundaries of the cell by associating each point inside the
-        // clump with the nearest nucleus. Then overlapping region is extrapolated with an ellipse.
-        outimg = runInitialCellSegmentation(&image, threshold1, threshold2, debug);
-        image.gmmPredictions.release();
+        start = chrono::high_resolution_clock::now();
+        TraceSpan exportSpan("exportResults");
 
-        // Display and save initial cell boundaries to png file
-        image.writeImage("initial_cell_boundaries.png", outimg);
-        if (debug) {
-            //cv::imshow("Initial Cell Segmentation", outimg);
-            //cv::waitKey(0);
+        if (deepZoom) {
+            exportDeepZoom(image);
+        } else if (image->hasWriteDirectory()) {
+            outimg = image->getFinalResult();
+            image->writeImage("cell_boundaries.png", outimg);
+            outimg.release();
         }
-        outimg.release();
 
-        end = std::chrono::duration_cast<std::chrono::microseconds>(
-                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
-        if (debug) image.log("Finished initial cell segmentation, time: %f\n", end);
 
-        start = chrono::high_resolution_clock::now();
-        if (debug) image.log("Beginning segmentation by level set functions...\n");
+        exportResults(image, this->thumbnails);
 
-        // Use level sets to find the actual cell boundaries by shrinking the initial cell
-        // boundaries' overlapping extrapolated contour (the ellipse) until the level set converges.
-        runOverlappingSegmentation(&image, dt, epsilon, mu, kappa, chi);
-
-        end = std::chrono::duration_cast<std::chrono::microseconds>(
+        stats["export"] = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
-        if (debug) image.log("Finished level set cell segmentation, time: %f\n", end);
-        //displayResults(&image.clumps);
+        exportSpan.end();
 
-
-        // clean up
-        end = std::chrono::duration_cast<std::chrono::microseconds>(
+        // Wait for the images still being encoded in the background
+        start = chrono::high_resolution_clock::now();
+        TraceSpan flushSpan("flushArtifacts");
+        writer.flush();
+        ArtifactWriterStats artifacts = writer.getStats();
+        stats["artifactFlush"] = std::chrono::duration_cast<std::chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+        stats["artifacts"] = {
+                {"written", artifacts.written - artifactsStart.written},
+                {"encode", artifacts.encodeSeconds - artifactsStart.encodeSeconds},
+                {"queueWait", artifacts.waitSeconds - artifactsStart.waitSeconds},
+                {"maxBacklog", artifacts.maxBacklog}
+        };
+        image->log("Images written: %zu, encode time: %f, queue wait: %f, max backlog: %zu, flush time: %f\n",
+                   artifacts.written - artifactsStart.written, artifacts.encodeSeconds - artifactsStart.encodeSeconds,
+                   artifacts.waitSeconds - artifactsStart.waitSeconds, artifacts.maxBacklog,
+                   stats["artifactFlush"].get<double>());
+        flushSpan.end();
+
+        stats["total"] = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - total).count() / 1000000.0;
+        segmentationSpan.end();
 
-        if (debug || totalTimed) image.log("Segmentation finished, total time: %f\n", end);
-
-        outimg = image.getFinalResult();
-        image.writeImage("cell_boundaries.png", outimg);
-        outimg.release();
-
+        if (trace && image->hasWriteDirectory()) {
+            Trace::write(image->getWritePath("trace", ".json").string(), traceSession.start);
+        }
 
-        exportResults(&image);
+        // log.txt is read by the portal once the segmentation is finished
+        Logger::getInstance().flush();
 
         /*
         start = chrono::high_resolution_clock::now();
-        if (debug) image.log("Beginning segmentation evaluation...\n");
+        if (debug) image->log("Beginning segmentation evaluation...\n");
         // If ground truths exist, use them to find the dice coefficient of the segmentation.
-        double dice = evaluateSegmentation(&image);
-        image.log("Dice coefficient: %f\n", dice);
+        double dice = evaluateSegmentation(image);
+        image->log("Dice coefficient: %f\n", dice);
 
         ofstream diceFile;
-        boost::filesystem::path writePath = image.getWritePath("dice", ".txt");
+        boost::filesystem::path writePath = image->getWritePath("dice", ".txt");
         diceFile.open(writePath.string());
         diceFile << dice;
         diceFile.close();
 
         end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
-        if (debug) image.log("Finished segmentation evaluation, time: %f\n", end);
+        if (debug) image->log("Finished segmentation evaluation, time: %f\n", end);
         */
 
         if (debug) {
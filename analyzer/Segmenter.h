@@ -2,21 +2,30 @@
 #define SEGMENTER_H
 
 #include "objects/Clump.h"
+#include "objects/SegmentationResult.h"
 
 using namespace std;
 
 namespace segment {
+    // Largest side in pixels of the preprocessing tiles of streamed images if no tileSize is given
+    const int STREAMED_TILE_SIZE = 2048;
+
     class Segmenter {
 
     public:
         // Quickshift params
         int kernelsize;
         int maxdist;
+        // Quickshift implementation: "native" on the interleaved image, or "vlfeat"
+        string quickshift = "native";
         // Canny params
         int threshold1;
         int threshold2;
         // GMM params
         int maxGmmIterations;
+        // GMM the clumps are found with: "em" trained on every pixel, "histogram" trained on the histogram
+        // of the image, or "superpixels" trained on the quickshift superpixels weighted by their size
+        string gmm = "em";
         // GMM post processing params
         double minAreaThreshold;
         // MSER params
@@ -29,6 +38,39 @@ namespace segment {
         double mu;
         double kappa;
         double chi;
+        // Stream each clump through nuclei detection, initial and overlapping segmentation
+        // instead of finishing each stage for every clump before starting the next
+        bool pipeline = true;
+        // Load the gmmPredictions mask and the checkpoints of a previous run instead of recomputing them
+        bool useCache = true;
+        // Load a gmmPredictions.yml written by an older version when there is no mask in the cache and save it
+        // as the mask of the current parameters. The yml doesn't record its parameters, so they aren't checked
+        bool migrateCache = false;
+        // Write the spans recorded during the segmentation to trace.json, Trace must be enabled
+        bool trace = false;
+        // Find clumps on the image downsampled 2^pyramidLevel times and refine them at full resolution,
+        // 0 to run preprocessing on the whole image at full resolution
+        int pyramidLevel = 0;
+        // Number of horizontal and vertical tiles the image is preprocessed in
+        int tilesX = 1;
+        int tilesY = 1;
+        // If more than 0, the image and the regions refined on a pyramid level are preprocessed in tiles
+        // of at most tileSize pixels a side instead of tilesX by tilesY tiles. Streamed images are tiled
+        // with STREAMED_TILE_SIZE if it is 0
+        int tileSize = 0;
+        // Also run preprocessing at full resolution and report how much the clumps found differ
+        bool compareFullResolution = false;
+        // Write a deep zoom tile pyramid of the image and a tiled GeoJSON overlay of the cells
+        // instead of full resolution renders of the boundaries
+        bool deepZoom = false;
+        // How thumbnails are exported: "pack" into a single thumbnails.pack, or "files" for one file per cell
+        string thumbnails = "pack";
+        // Page of TIFF images to segment, -1 for the largest page
+        int page = -1;
+        // Region of the image files to segment, the whole image if empty
+        cv::Rect region;
+        // Time in seconds of each stage of the last segmentation and the size of its output
+        json stats;
 
     private:
         // internal attributes
@@ -45,7 +87,20 @@ namespace segment {
 
         void setCommonValues();
 
-        void runSegmentation(string fileName);
+        void runSegmentation(string fileName, cv::Mat mat = cv::Mat());
+        SegmentationResult segment(const cv::Mat &mat, string writeDirectory = "");
+        SegmentationResult segment(const unsigned char *bgr, int width, int height, size_t step = 0,
+                                   string writeDirectory = "");
+
+    private:
+        void segmentImage(Image *image);
+        SegmentationResult getSegmentationResult(Image *image);
+        int getTileSize(Image *image);
+        cv::Size getTiles(Image *image);
+        void compareToFullResolution(Image *image, cv::Mat gmmPredictions);
+        void setCacheKeys(Image *image);
+        void runClumpStages(Image *image);
+        void runClumpPipeline(Image *image);
     };
 }
 
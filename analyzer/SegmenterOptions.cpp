@@ -0,0 +1,200 @@
+#include "SegmenterOptions.h"
+#include <boost/foreach.hpp>
+#include "objects/TiffReader.h"
+
+using namespace std;
+using namespace boost::program_options;
+
+namespace segment {
+
+    options_description getSegmenterOptions() {
+        // Default parameters
+        // Quickshift params
+        int kernelsize = 2;
+        int maxdist = 4;
+        // Canny params
+        int threshold1 = 20;
+        int threshold2 = 40;
+        // GMM params
+        int maxGmmIterations = 10;
+        // GMM post processing params
+        double minAreaThreshold = 1000.0;
+        // MSER params
+        double nucleiSize = 35; // Average nuclei size in um
+        double nucleiSizeError = 10; // Nuclei size +/- error
+        int delta = 3, minArea = -1, maxArea = -1;
+        double maxVariation = 0.2, minDiversity = 0.3;
+        double minCircularity = 0.5;
+        // Cell segmentation params
+        double dt = 5; //Time step
+        double epsilon = 1.5; //Pixel spacing
+        double mu = 0.04; //Contour length weighting parameter
+        double kappa = 13;
+        double chi = 3;
+
+        options_description desc{"Options"};
+        desc.add_options()
+          ("dt", value<float>()->default_value(dt), "Timestep")
+          ("epsilon", value<float>()->default_value(epsilon), "Pixel spacing")
+          ("mu", value<float>()->default_value(mu), "Contour length weight")
+          ("kappa", value<float>()->default_value(kappa), "Unary term weight")
+          ("chi", value<float>()->default_value(chi), "Binary term weight")
+          ("maxVariation", value<float>()->default_value(maxVariation), "Max variation")
+          ("minDiversity", value<float>()->default_value(minDiversity), "Min diversity")
+          ("minCircularity", value<float>()->default_value(minCircularity), "Min circularity")
+          ("minAreaThreshold", value<float>()->default_value(minAreaThreshold), "Min area threshold")
+          ("kernelsize", value<int>()->default_value(kernelsize), "Kernel size")
+          ("maxdist", value<int>()->default_value(maxdist), "Max distance")
+          ("quickshift", value<std::string>()->default_value("native"), "Quickshift implementation, native or vlfeat")
+          ("threshold1", value<int>()->default_value(threshold1), "Threshold1")
+          ("threshold2", value<int>()->default_value(threshold2), "Threshold2")
+          ("maxGmmIterations", value<int>()->default_value(maxGmmIterations), "Max GMM iterations")
+          ("gmm", value<std::string>()->default_value("em"), "GMM trained on every pixel (em), on the intensity histogram (histogram) or on the quickshift superpixels (superpixels)")
+          ("nucleiSize", value<float>()->default_value(nucleiSize), "Nuclei size")
+          ("nucleiSizeError", value<float>()->default_value(nucleiSizeError), "Nuclei size error")
+          ("delta", value<int>()->default_value(delta), "Delta")
+          ("minArea", value<int>()->default_value(minArea), "Min area")
+          ("maxArea", value<int>()->default_value(maxArea), "Max area")
+          ("pipeline", value<bool>()->default_value(true), "Stream clumps through the segmentation stages instead of running each stage on every clump first")
+          ("useCache", value<bool>()->default_value(true), "Load preprocessing results and checkpoints of a previous run")
+          ("migrateCache", bool_switch()->default_value(false), "Convert a gmmPredictions.yml of an older version to the mask of the current parameters, without checking the parameters it was made with")
+          ("pyramidLevel", value<int>()->default_value(0), "Find clumps on the image downsampled 2^level times and refine them at full resolution, 0 to preprocess at full resolution")
+          ("tilesX", value<int>()->default_value(1), "Number of horizontal tiles the image is preprocessed in")
+          ("tilesY", value<int>()->default_value(1), "Number of vertical tiles the image is preprocessed in")
+          ("tileSize", value<int>()->default_value(0), "Preprocess in tiles of at most this many pixels a side instead of --tilesX by --tilesY tiles, 0 to not choose the tiles from the image size")
+          ("compareFullResolution", bool_switch()->default_value(false), "Also preprocess at full resolution and report how much the clumps differ from --pyramidLevel")
+          ("trace", bool_switch()->default_value(false), "Write a trace.json of each segmentation that can be opened in Perfetto")
+          ("deepZoom", bool_switch()->default_value(false), "Write a deep zoom (DZI) tile pyramid and GeoJSON overlay tiles instead of full resolution boundary images")
+          ("thumbnails", value<std::string>()->default_value("pack"), "Write the thumbnails into a single indexed thumbnails.pack (pack) or one file per cell (files)")
+          ("page", value<int>()->default_value(-1), "Page of TIFF images to segment, the largest page by default")
+          ("region", value<std::string>()->default_value(""), "Region x,y,width,height of the images to segment, the whole image by default")
+          ("image,i", value<std::string>()->default_value(""), "Input image")
+          ("imageResolution", value<float>(), "Image resolution pixels/μm (required)")
+          ("directory,d", value<std::string>()->default_value(""), "Input directory");
+        return desc;
+    }
+
+    variables_map parseSegmenterOptions(const vector<string> &args) {
+        variables_map vm;
+        store(command_line_parser(args).options(getSegmenterOptions()).run(), vm);
+        notify(vm);
+        return vm;
+    }
+
+    Segmenter createSegmenter(const variables_map &vm) {
+        // imageResolution is checked here instead of being marked as required so that
+        // options like --help and --serve can be used without it
+        if (!vm.count("imageResolution")) {
+            throw required_option("imageResolution");
+        }
+
+        int minArea, maxArea;
+
+        if (vm["minArea"].as<int>() == -1) {
+            minArea = (vm["nucleiSize"].as<float>() - vm["nucleiSizeError"].as<float>())
+                    * vm["imageResolution"].as<float>();
+        } else {
+            minArea = vm["minArea"].as<int>();
+        }
+
+        if (vm["maxArea"].as<int>() == -1) {
+            maxArea = (vm["nucleiSize"].as<float>() + vm["nucleiSizeError"].as<float>())
+                      * vm["imageResolution"].as<float>();
+        } else {
+            maxArea = vm["maxArea"].as<int>();
+        }
+
+        Segmenter seg(
+            vm["kernelsize"].as<int>(),
+            vm["maxdist"].as<int>(),
+            vm["threshold1"].as<int>(),
+            vm["threshold2"].as<int>(),
+            vm["maxGmmIterations"].as<int>(),
+            vm["minAreaThreshold"].as<float>(),
+            vm["delta"].as<int>(),
+            minArea,
+            maxArea,
+            vm["maxVariation"].as<float>(),
+            vm["minDiversity"].as<float>(),
+            vm["minCircularity"].as<float>(),
+            vm["dt"].as<float>(),
+            vm["epsilon"].as<float>(),
+            vm["mu"].as<float>(),
+            vm["kappa"].as<float>(),
+            vm["chi"].as<float>()
+        );
+        seg.quickshift = vm["quickshift"].as<std::string>();
+        if (seg.quickshift != "native" && seg.quickshift != "vlfeat") {
+            throw invalid_option_value(seg.quickshift);
+        }
+        seg.gmm = vm["gmm"].as<std::string>();
+        if (seg.gmm != "histogram" && seg.gmm != "em" && seg.gmm != "superpixels") {
+            throw invalid_option_value(seg.gmm);
+        }
+        seg.pipeline = vm["pipeline"].as<bool>();
+        seg.useCache = vm["useCache"].as<bool>();
+        seg.migrateCache = vm["migrateCache"].as<bool>();
+        seg.pyramidLevel = vm["pyramidLevel"].as<int>();
+        seg.tilesX = vm["tilesX"].as<int>();
+        seg.tilesY = vm["tilesY"].as<int>();
+        seg.tileSize = vm["tileSize"].as<int>();
+        if (seg.tilesX < 1) throw invalid_option_value(to_string(seg.tilesX));
+        if (seg.tilesY < 1) throw invalid_option_value(to_string(seg.tilesY));
+        if (seg.tileSize < 0) throw invalid_option_value(to_string(seg.tileSize));
+        seg.compareFullResolution = vm["compareFullResolution"].as<bool>();
+        seg.trace = vm["trace"].as<bool>();
+        seg.deepZoom = vm["deepZoom"].as<bool>();
+        seg.thumbnails = vm["thumbnails"].as<std::string>();
+        if (seg.thumbnails != "pack" && seg.thumbnails != "files") {
+            throw invalid_option_value(seg.thumbnails);
+        }
+        seg.page = vm["page"].as<int>();
+        string region = vm["region"].as<std::string>();
+        if (!region.empty()) {
+            int x, y, width, height;
+            if (sscanf(region.c_str(), "%d,%d,%d,%d", &x, &y, &width, &height) != 4 || width <= 0 || height <= 0) {
+                throw invalid_option_value(region);
+            }
+            seg.region = cv::Rect(x, y, width, height);
+        }
+        return seg;
+    }
+
+    vector<boost::filesystem::path> getImagePaths(const variables_map &vm) {
+        vector<boost::filesystem::path> images;
+
+        string directory = vm["directory"].as<std::string>();
+        string image = vm["image"].as<std::string>();
+
+        if (directory.empty() && image.empty()) {
+            image = "./images/EDF/EDF000.png";
+        }
+
+        if (!directory.empty()) {
+
+            boost::filesystem::path path(directory);
+            if (boost::filesystem::is_directory(directory)) {
+                boost::filesystem::directory_iterator iter(path), eod;
+                BOOST_FOREACH(boost::filesystem::path const& file, make_pair(iter, eod)){
+                    if (is_regular_file(file)) {
+                        if (file.has_extension()) {
+                            if (file.extension().string() == ".png" || isTiff(file.string())) {
+                                images.push_back(file);
+                            }
+                        }
+                    }
+                }
+            } else {
+                printf("Not a directory: %s\n", directory.c_str());
+            }
+
+        }
+
+        if (!image.empty()) {
+            images.push_back(image);
+        }
+
+        sort(images.begin(), images.end());
+        return images;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef SEGMENTEROPTIONS_H
+#define SEGMENTEROPTIONS_H
+
+#include "Segmenter.h"
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * getSegmenterOptions returns the command line options that configure a segmentation run.
+     * These are shared by the command line and the segmentation server's jobs.
+     */
+    boost::program_options::options_description getSegmenterOptions();
+
+    /*
+     * parseSegmenterOptions parses a list of "--name=value" arguments against getSegmenterOptions
+     */
+    boost::program_options::variables_map parseSegmenterOptions(const vector<string> &args);
+
+    /*
+     * createSegmenter creates a Segmenter from parsed options
+     * Throws a boost::program_options::required_option if imageResolution is missing
+     * It has no side effects, so it can be used to validate options
+     */
+    Segmenter createSegmenter(const boost::program_options::variables_map &vm);
+
+    /*
+     * getImagePaths returns the sorted list of images selected by the image and directory options
+     */
+    vector<boost::filesystem::path> getImagePaths(const boost::program_options::variables_map &vm);
+}
+
+#endif //SEGMENTEROPTIONS_H
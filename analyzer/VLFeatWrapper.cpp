@@ -41,7 +41,8 @@ namespace segment {
         }
 
         // applies a quick shift algorithm to the image, and returns the # of superpixels found
-        int quickshift(double *image, int kernelsize, int maxdist) {
+        // the root of each pixel is written to roots if it isn't null
+        int quickshift(double *image, int kernelsize, int maxdist, int *roots = nullptr) {
             VlQS *quickshift = vl_quickshift_new(image, width, height, channels);
             if (debug) VL_PRINT("Created vl quickshift object\n");
             vl_quickshift_set_kernel_size(quickshift, kernelsize);
@@ -71,6 +72,7 @@ namespace segment {
                             break;
                         parentIndex = parents[parentIndex];
                     }
+                    if (roots) roots[partialLinearIndex] = parentIndex;
 
                     for (int c = 0; c < channels; c++) {
                         int linearIndex = c * width * height + partialLinearIndex;
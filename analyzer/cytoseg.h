@@ -0,0 +1,32 @@
+// cytoseg.h
+// Public header of libcytoseg, the segmentation pipeline as a library for other programs to link against.
+// Build it with `make lib`, which creates libcytoseg.a and libcytoseg.so.
+//
+// Images are segmented in memory, the caller keeps ownership of the pixels and nothing is written to disk
+// unless a write directory is given:
+//
+//     segment::Segmenter seg = segment::createSegmenter(segment::parseSegmenterOptions({"--imageResolution=1"}));
+//     segment::SegmentationResult result = seg.segment(mat);
+//     for (segment::ClumpResult &clump : result.clumps) {
+//         for (segment::CellResult &cell : clump.cells) {
+//             // cell.nucleusBoundary, cell.boundary, ...
+//         }
+//     }
+//
+// A raw BGR buffer can be segmented with seg.segment(pixels, width, height, bytesPerRow).
+// ThreadPool::setNumThreads and MemoryBudget::setLimit bound the threads and memory the library uses,
+// they apply to every Segmenter of the process. Result images written to a write directory are encoded
+// by the ArtifactWriter, whose format is set with ArtifactWriter::getInstance().setFormat.
+
+#ifndef CYTOSEG_H
+#define CYTOSEG_H
+
+#include "Segmenter.h"
+#include "SegmenterOptions.h"
+#include "objects/SegmentationResult.h"
+#include "objects/ThreadPool.h"
+#include "objects/MemoryBudget.h"
+#include "objects/ArtifactWriter.h"
+#include "objects/Logger.h"
+
+#endif //CYTOSEG_H
@@ -3,6 +3,8 @@
 #include "../VLFeatWrapper.cpp"
 #include "DRLSE.h"
 #include "SegmenterTools.h"
+#include "Quickshift.h"
+#include "Gmm.h"
 
 using namespace std;
 
@@ -36,16 +38,190 @@ namespace segment {
         return phi;
     }
 
+    // Farthest a pixel read by one iteration of drlse_denoise is from the pixel it updates, the one-sided
+    // differences of del2 at the edges of the image reach 3 pixels
+    const int DRLSE_STENCIL_RADIUS = 3;
+
     /*
-     * runQuickshift takes an image and params and runs Quickshift on it, using the VL_Feat implementation
-     * Returns:
-     * cv::Mat = image after quickshift is applied
-     * Params:
-     *  cv::Mat mat = the image
-     *  int kernelsize = the kernel or window size of the quickshift applied
-     *  int maxdist = the largest distance a pixel can be from it's root
+     * gradientAt is calcGradient of mat at a single pixel
+     */
+    static inline void gradientAt(const cv::Mat &mat, int i, int j, float &dx, float &dy) {
+        const float *row = mat.ptr<float>(i);
+        if (j == 0) {
+            dx = row[j + 1] - row[j];
+        } else if (j == mat.cols - 1) {
+            dx = row[j] - row[j - 1];
+        } else {
+            dx = 0.5 * (row[j + 1] - row[j - 1]);
+        }
+
+        if (i == 0) {
+            dy = mat.ptr<float>(i + 1)[j] - row[j];
+        } else if (i == mat.rows - 1) {
+            dy = row[j] - mat.ptr<float>(i - 1)[j];
+        } else {
+            dy = 0.5 * (mat.ptr<float>(i + 1)[j] - mat.ptr<float>(i - 1)[j]);
+        }
+    }
+
+    /*
+     * regularizerFieldAt is the field drlse::calcSignedDistanceReg takes the divergence of, at a single pixel
+     */
+    static inline void regularizerFieldAt(const cv::Mat &phi, int i, int j, float &fx, float &fy) {
+        float gradientX, gradientY;
+        gradientAt(phi, i, j, gradientX, gradientY);
+        float gradientMag = sqrt(gradientX * gradientX + gradientY * gradientY);
+        float potential;
+        if (gradientMag >= 0 && gradientMag <= 1) {
+            potential = sin(2 * M_PI * gradientMag) / (2 * M_PI);
+        } else if (gradientMag > 1) {
+            potential = gradientMag - 1;
+        } else {
+            potential = 0;
+        }
+        float dps = ((potential != 0) ? potential : 1) / ((gradientMag != 0) ? gradientMag : 1);
+        fx = dps * gradientX - gradientX;
+        fy = dps * gradientY - gradientY;
+    }
+
+    /*
+     * normalAt is drlse::calcCurvatureXY at a single pixel
+     */
+    static inline void normalAt(const cv::Mat &phi, int i, int j, float &nx, float &ny) {
+        //Small number is used to avoid division by 0
+        float smallNumber = 1e-10;
+        float gradientX, gradientY;
+        gradientAt(phi, i, j, gradientX, gradientY);
+        float gradientMagnitude = sqrt(gradientX * gradientX + gradientY * gradientY);
+        nx = gradientX / (gradientMagnitude + smallNumber);
+        ny = gradientY / (gradientMagnitude + smallNumber);
+    }
+
+    /*
+     * divergenceAt is calcDivergence at a single pixel of the field computed by fieldAt
+     */
+    template<typename Field>
+    static inline float divergenceAt(const cv::Mat &phi, int i, int j, Field fieldAt) {
+        float fx0, fy0, fx1, fy1;
+        float dxx, dyy;
+        if (j == 0) {
+            fieldAt(phi, i, j + 1, fx1, fy1);
+            fieldAt(phi, i, j, fx0, fy0);
+            dxx = fx1 - fx0;
+        } else if (j == phi.cols - 1) {
+            fieldAt(phi, i, j, fx1, fy1);
+            fieldAt(phi, i, j - 1, fx0, fy0);
+            dxx = fx1 - fx0;
+        } else {
+            fieldAt(phi, i, j + 1, fx1, fy1);
+            fieldAt(phi, i, j - 1, fx0, fy0);
+            dxx = 0.5 * (fx1 - fx0);
+        }
+
+        if (i == 0) {
+            fieldAt(phi, i + 1, j, fx1, fy1);
+            fieldAt(phi, i, j, fx0, fy0);
+            dyy = fy1 - fy0;
+        } else if (i == phi.rows - 1) {
+            fieldAt(phi, i, j, fx1, fy1);
+            fieldAt(phi, i - 1, j, fx0, fy0);
+            dyy = fy1 - fy0;
+        } else {
+            fieldAt(phi, i + 1, j, fx1, fy1);
+            fieldAt(phi, i - 1, j, fx0, fy0);
+            dyy = 0.5 * (fy1 - fy0);
+        }
+        return dxx + dyy;
+    }
+
+    /*
+     * del2At is drlse::del2 at a single pixel, x is the row and y the column
      */
-    cv::Mat runQuickshift(cv::Mat *mat, int kernelsize, int maxdist, bool debug) {
+    static inline float del2At(const cv::Mat &mat, int x, int y) {
+        int rows = mat.rows;
+        int cols = mat.cols;
+        auto m = [&mat](int x, int y) { return mat.ptr<float>(x)[y]; };
+        if (x > 0 && y > 0 && x < rows - 1 && y < cols - 1) {
+            return ((m(x - 1, y) + m(x + 1, y) + m(x, y - 1) + m(x, y + 1)) - 4 * m(x, y)) / 4;
+        }
+        if (x == 0 && y == 0) {
+            return (-5 * m(x, y + 1) + 4 * m(x, y + 2) - m(x, y + 3) + 2 * m(x, y) -
+                    5 * m(x + 1, y) + 4 * m(x + 2, y) - m(x + 3, y) + 2 * m(x, y)) / 4;
+        } else if (x == rows - 1 && y == cols - 1) {
+            return (-5 * m(x, y - 1) + 4 * m(x, y - 2) - m(x, y - 3) + 2 * m(x, y) -
+                    5 * m(x - 1, y) + 4 * m(x - 2, y) - m(x - 3, y) + 2 * m(x, y)) / 4;
+        } else if (x == 0 && y == cols - 1) {
+            return (-5 * m(x, y - 1) + 4 * m(x, y - 2) - m(x, y - 3) + 2 * m(x, y) -
+                    5 * m(x + 1, y) + 4 * m(x + 2, y) - m(x + 3, y) + 2 * m(x, y)) / 4;
+        } else if (x == rows - 1 && y == 0) {
+            return (-5 * m(x, y + 1) + 4 * m(x, y + 2) - m(x, y + 3) + 2 * m(x, y) -
+                    5 * m(x - 1, y) + 4 * m(x - 2, y) - m(x - 3, y) + 2 * m(x, y)) / 4;
+        } else if (y == 0) {
+            return (-5 * m(x, y + 1) + 4 * m(x, y + 2) - m(x, y + 3) + 2 * m(x, y) +
+                    m(x + 1, y) + m(x - 1, y) - 2 * m(x, y)) / 4;
+        } else if (x == 0) {
+            return (-5 * m(x + 1, y) + 4 * m(x + 2, y) - m(x + 3, y) + 2 * m(x, y) +
+                    m(x, y + 1) + m(x, y - 1) - 2 * m(x, y)) / 4;
+        } else if (y == cols - 1) {
+            return (-5 * m(x, y - 1) + 4 * m(x, y - 2) - m(x, y - 3) + 2 * m(x, y) +
+                    m(x + 1, y) + m(x - 1, y) - 2 * m(x, y)) / 4;
+        } else {
+            return (-5 * m(x - 1, y) + 4 * m(x - 2, y) - m(x - 3, y) + 2 * m(x, y) +
+                    m(x, y + 1) + m(x, y - 1) - 2 * m(x, y)) / 4;
+        }
+    }
+
+    /*
+     * drlse_denoise_narrowband runs iterations of drlse_denoise, but only on the pixels of band
+     * Every term of drlse_denoise is 0 where phi is flat, so a pixel whose neighborhood of DRLSE_STENCIL_RADIUS
+     * pixels is flat keeps its value. The band must contain every pixel within DRLSE_STENCIL_RADIUS of a pixel
+     * that has changed or isn't flat, then the pixels outside it are never changed.
+     * The terms are computed per pixel in the same order and precision as drlse_denoise, no image sized
+     * matrices are allocated besides phi.
+     * phi: the level set, updated in place
+     * band: the pixels that are updated
+     * g: the edge enforcer
+     * iterations: number of iterations, drlse_denoise runs 2
+     */
+    void drlse_denoise_narrowband(cv::Mat &phi, const vector<cv::Point> &band, cv::Mat g, float lambda, float mu,
+                                  float alpha, float epsilon, float timestep, int iterations) {
+        double sigma = epsilon;
+        vector<float> updated(band.size());
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            for (size_t k = 0; k < band.size(); k++) {
+                int i = band[k].y;
+                int j = band[k].x;
+                float value = phi.ptr<float>(i)[j];
+
+                float regularizer = divergenceAt(phi, i, j, regularizerFieldAt) + 4 * del2At(phi, i, j);
+                float dirac = 0;
+                if (value <= sigma && value >= -sigma) {
+                    dirac = (1.0 / 2.0 / sigma) * (1 + cos(M_PI * value / sigma));
+                }
+                float edgeTerm = 0;
+                float areaTerm = 0;
+                if (dirac != 0) {
+                    float vx, vy, nx, ny;
+                    gradientAt(g, i, j, vx, vy);
+                    normalAt(phi, i, j, nx, ny);
+                    float curvature = divergenceAt(phi, i, j, normalAt);
+                    float edge = g.ptr<float>(i)[j];
+                    areaTerm = dirac * edge;
+                    edgeTerm = dirac * (vx * nx + vy * ny) + dirac * edge * curvature;
+                }
+                updated[k] = value + timestep * (mu * regularizer + lambda * edgeTerm + alpha * areaTerm);
+            }
+            for (size_t k = 0; k < band.size(); k++) {
+                phi.ptr<float>(band[k].y)[band[k].x] = updated[k];
+            }
+        }
+    }
+
+    /*
+     * runVLFeatQuickshift runs the VL_Feat implementation of Quickshift on the image
+     * The image is converted to doubles and transposed to VL_Feat's planar layout and back
+     */
+    static cv::Mat runVLFeatQuickshift(cv::Mat *mat, int kernelsize, int maxdist, cv::Mat *roots, bool debug) {
         int channels = mat->channels();
         int width = mat->cols;
         int height = mat->rows;
@@ -63,7 +239,12 @@ namespace segment {
 
         // apply quickshift from VLFeat
         vlf_wrapper.convertOPENCV_VLFEAT(cvmat, vlmat);
-        int superpixelcount = vlf_wrapper.quickshift(vlmat, kernelsize, maxdist);
+        int *rootIdx = nullptr;
+        if (roots) {
+            *roots = cv::Mat(height, width, CV_32SC1);
+            rootIdx = (int *) roots->data;
+        }
+        int superpixelcount = vlf_wrapper.quickshift(vlmat, kernelsize, maxdist, rootIdx);
         vlf_wrapper.convertVLFEAT_OPENCV(vlmat, cvmat);
 
         cv::Mat postQuickShift = cv::Mat(height, width, CV_64FC3, cvmat);
@@ -76,6 +257,46 @@ namespace segment {
         return outmat;
     }
 
+    /*
+     * runQuickshift takes an image and params and runs Quickshift on it
+     * Returns:
+     * cv::Mat = image after quickshift is applied, each pixel has the color of the root of its tree
+     * Params:
+     *  cv::Mat mat = the image
+     *  int kernelsize = the kernel or window size of the quickshift applied
+     *  int maxdist = the largest distance a pixel can be from it's root
+     *  string implementation = "native" to run on the interleaved image in place, or "vlfeat" for the VL_Feat implementation
+     *  cv::Mat *roots = set to the row-major index of the root of each pixel's tree if not null, see Superpixels
+     */
+    cv::Mat runQuickshift(cv::Mat *mat, int kernelsize, int maxdist, string implementation, cv::Mat *roots, bool debug) {
+        if (implementation == "vlfeat") {
+            return runVLFeatQuickshift(mat, kernelsize, maxdist, roots, debug);
+        }
+
+        int superpixelcount = 0;
+        cv::Mat treeRoots = quickshiftRoots(*mat, kernelsize, maxdist, &superpixelcount);
+        if (roots) *roots = treeRoots;
+
+        // The colors are rounded to 8 bits like the VL_Feat output
+        cv::Mat colors = *mat;
+        if (colors.depth() != CV_8U) {
+            mat->convertTo(colors, CV_8U);
+        }
+        int channels = colors.channels();
+        cv::Mat outmat(mat->size(), CV_8UC(channels));
+        for (int row = 0; row < outmat.rows; row++) {
+            const int *rowRoots = treeRoots.ptr<int>(row);
+            uchar *out = outmat.ptr<uchar>(row);
+            for (int col = 0; col < outmat.cols; col++) {
+                const uchar *root = colors.ptr<uchar>(rowRoots[col] / mat->cols) + (rowRoots[col] % mat->cols) * channels;
+                memcpy(out + col * channels, root, channels);
+            }
+        }
+
+        //if (debug) image->log("Super pixels found via quickshift: %i\n", superpixelcount);
+        return outmat;
+    }
+
     /*
      * runCanny runs canny edge detection on an image, and dilates and erodes it to close holes
      * Returns:
@@ -123,7 +344,10 @@ namespace segment {
      *  vector<vector<cv::Point>> hulls = convex hulls to provide initial labeling
      *  int maxGmmIterations = maximum number of iterations to allow the gmm to train
     */
-    cv::Mat runGmm(cv::Mat *mat, vector<vector<cv::Point>> hulls, int maxGmmIterations) {
+    /*
+     * getGmmFeatures returns the grayscale image with slightly increased contrast the gmm is trained on, CV_8UC1
+     */
+    static cv::Mat getGmmFeatures(cv::Mat *mat) {
         cv::Mat grayscaleMat;
         mat->convertTo(grayscaleMat, CV_8UC3);
         cv::cvtColor(grayscaleMat, grayscaleMat, CV_BGR2GRAY);
@@ -131,7 +355,11 @@ namespace segment {
         //Increase contrast of image slightly
         cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(2);
         clahe->apply(grayscaleMat, grayscaleMat);
+        return grayscaleMat;
+    }
 
+    cv::Mat runGmm(cv::Mat *mat, vector<vector<cv::Point>> hulls, int maxGmmIterations) {
+        cv::Mat grayscaleMat = getGmmFeatures(mat);
         grayscaleMat.convertTo(grayscaleMat, CV_64FC1);
         grayscaleMat = grayscaleMat.reshape(0, grayscaleMat.rows * grayscaleMat.cols);
 
@@ -170,6 +398,115 @@ namespace segment {
         return outmat;
     }
 
+    // Initial probability of a pixel inside the convex hulls being a cell pixel. runGmm starts the cell cluster
+    // from cv::bitwise_not of the background cluster, which cv::ml::EM trains like a start of one half inside
+    // the hulls and zero outside of them, so the gmms trained with fitGmm start the same way
+    const double GMM_INITIAL_CELL_PROBABILITY = 0.5;
+
+    /*
+     * runHistogramGmm labels the image like runGmm, but the gmm is trained on the histogram of the image.
+     * Every pixel of an intensity has the same likelihoods, so training on the 256 intensities weighted by
+     * their number of pixels gives the same gaussians as training on every pixel. An intensity is initially
+     * in the cell cluster by the fraction of its pixels inside the convex hulls times GMM_INITIAL_CELL_PROBABILITY,
+     * so it finds the same labels as runGmm. The image is labeled
+     * with a lookup table of the cluster of each intensity.
+     * Returns:
+     *  cv::Mat = labels found per pixel
+     * Params:
+     *  cv::Mat mat = image to process
+     *  vector<vector<cv::Point>> hulls = convex hulls to provide initial labeling
+     *  int maxGmmIterations = maximum number of iterations to allow the gmm to train
+     */
+    cv::Mat runHistogramGmm(cv::Mat *mat, vector<vector<cv::Point>> hulls, int maxGmmIterations) {
+        cv::Mat grayscaleMat = getGmmFeatures(mat);
+
+        cv::Mat hullMask = cv::Mat::zeros(mat->rows, mat->cols, CV_8UC1);
+        cv::drawContours(hullMask, hulls, -1, (1), -1);
+
+        vector<double> counts(256, 0);
+        vector<double> insideHulls(256, 0);
+        for (int row = 0; row < grayscaleMat.rows; row++) {
+            const uchar *intensity = grayscaleMat.ptr<uchar>(row);
+            const uchar *inside = hullMask.ptr<uchar>(row);
+            for (int col = 0; col < grayscaleMat.cols; col++) {
+                counts[intensity[col]]++;
+                insideHulls[intensity[col]] += inside[col];
+            }
+        }
+        hullMask.release();
+
+        // Only the intensities found in the image are samples
+        vector<int> intensities;
+        vector<double> samples;
+        vector<double> weights;
+        vector<double> responsibilities;
+        for (int i = 0; i < 256; i++) {
+            if (counts[i] == 0) continue;
+            intensities.push_back(i);
+            samples.push_back(i);
+            weights.push_back(counts[i]);
+            responsibilities.push_back(GMM_INITIAL_CELL_PROBABILITY * insideHulls[i] / counts[i]);
+        }
+        vector<unsigned char> components = fitGmm(samples, weights, responsibilities, maxGmmIterations);
+
+        cv::Mat lut = cv::Mat::zeros(1, 256, CV_8UC1);
+        for (unsigned int i = 0; i < intensities.size(); i++) {
+            lut.at<uchar>(0, intensities[i]) = components[i] ? 255 : 0;
+        }
+        cv::Mat outmat;
+        cv::LUT(grayscaleMat, lut, outmat);
+
+        outmat = runGmmCleanup(mat, outmat);
+
+        return outmat;
+    }
+
+    /*
+     * runSuperpixelGmm labels the image like runGmm, but the gmm is trained on the superpixels found by quickshift
+     * instead of on every pixel. Each superpixel is a sample of its mean intensity weighted by its size,
+     * initially in the cell cluster like the intensities of runHistogramGmm.
+     * The label of each superpixel is given to its pixels.
+     * Returns:
+     *  cv::Mat = labels found per pixel
+     * Params:
+     *  cv::Mat mat = image to process
+     *  cv::Mat roots = the root of each pixel's quickshift tree, see runQuickshift
+     *  vector<vector<cv::Point>> hulls = convex hulls to provide initial labeling
+     *  int maxGmmIterations = maximum number of iterations to allow the gmm to train
+     */
+    cv::Mat runSuperpixelGmm(cv::Mat *mat, cv::Mat roots, vector<vector<cv::Point>> hulls, int maxGmmIterations) {
+        Superpixels superpixels(roots);
+        cv::Mat intensities = superpixels.mean(getGmmFeatures(mat));
+
+        cv::Mat hullMask = cv::Mat::zeros(mat->rows, mat->cols, CV_8UC1);
+        cv::drawContours(hullMask, hulls, -1, (1), -1);
+        cv::Mat insideHulls = superpixels.mean(hullMask);
+        hullMask.release();
+
+        vector<double> samples(superpixels.count);
+        vector<double> weights(superpixels.count);
+        vector<double> responsibilities(superpixels.count);
+        for (int i = 0; i < superpixels.count; i++) {
+            samples[i] = intensities.at<double>(i, 0);
+            weights[i] = superpixels.sizes[i];
+            responsibilities[i] = GMM_INITIAL_CELL_PROBABILITY * insideHulls.at<double>(i, 0);
+        }
+        vector<unsigned char> components = fitGmm(samples, weights, responsibilities, maxGmmIterations);
+
+        cv::Mat outmat(mat->rows, mat->cols, CV_8UC1);
+        for (int row = 0; row < outmat.rows; row++) {
+            const int *label = superpixels.labels.ptr<int>(row);
+            uchar *out = outmat.ptr<uchar>(row);
+            for (int col = 0; col < outmat.cols; col++) {
+                out[col] = components[label[col]] ? 255 : 0;
+            }
+        }
+
+        outmat = runGmmCleanup(mat, outmat);
+
+        return outmat;
+    }
+
     /*
      * runGmmCleanup cleans up small specks from a gmm mask using a level set method
      */
@@ -192,14 +529,41 @@ namespace segment {
         }
         cv::Mat phi = initialPhi;
         int iter_out = 3;
+        int iter_in = 2;
         float alpha = -2.5;
         float lambda = 5;
 
+        // Only pixels near the edges of the mask can change, each iteration reaches DRLSE_STENCIL_RADIUS further
+        // from the pixels that aren't flat. The band is every pixel that can change in any of the iterations.
+        cv::Mat edges = cv::Mat::zeros(phi.rows, phi.cols, CV_8UC1);
+        for (int i = 0; i < phi.rows; i++) {
+            const float *row = phi.ptr<float>(i);
+            uchar *edgeRow = edges.ptr<uchar>(i);
+            for (int j = 0; j < phi.cols; j++) {
+                if ((j > 0 && row[j - 1] != row[j]) || (j < phi.cols - 1 && row[j + 1] != row[j]) ||
+                    (i > 0 && phi.ptr<float>(i - 1)[j] != row[j]) ||
+                    (i < phi.rows - 1 && phi.ptr<float>(i + 1)[j] != row[j])) {
+                    edgeRow[j] = 255;
+                }
+            }
+        }
+        int bandRadius = DRLSE_STENCIL_RADIUS * ((iter_out + 1) * iter_in + 1);
+        cv::dilate(edges, edges, cv::getStructuringElement(cv::MORPH_RECT,
+                                                           cv::Size(2 * bandRadius + 1, 2 * bandRadius + 1)));
+        vector<cv::Point> band;
+        for (int i = 0; i < edges.rows; i++) {
+            const uchar *edgeRow = edges.ptr<uchar>(i);
+            for (int j = 0; j < edges.cols; j++) {
+                if (edgeRow[j]) band.push_back(cv::Point(j, i));
+            }
+        }
+        edges.release();
+
         for (int i = 0; i < iter_out; i++) {
-            phi = drlse_denoise(phi, edgeEnforcer, lambda, mu, alpha, epsilon, timestep);
+            drlse_denoise_narrowband(phi, band, edgeEnforcer, lambda, mu, alpha, epsilon, timestep, iter_in);
         }
         alpha = 0;
-        phi = drlse_denoise(phi, edgeEnforcer, lambda, mu, alpha, epsilon, timestep);
+        drlse_denoise_narrowband(phi, band, edgeEnforcer, lambda, mu, alpha, epsilon, timestep, iter_in);
 
         cv::bitwise_not(phi, phi);
 
@@ -9,7 +9,10 @@ using namespace std;
 namespace segment {
     cv::Mat drlse_denoise(cv::Mat phi, cv::Mat g, float lambda, float mu, float alpha, float epsilon, float timestep);
 
-    cv::Mat runQuickshift(cv::Mat *mat, int kernelsize, int maxdist, bool debug = false);
+    void drlse_denoise_narrowband(cv::Mat &phi, const vector<cv::Point> &band, cv::Mat g, float lambda, float mu,
+                                  float alpha, float epsilon, float timestep, int iterations);
+
+    cv::Mat runQuickshift(cv::Mat *mat, int kernelsize, int maxdist, string implementation = "native", cv::Mat *roots = nullptr, bool debug = false);
 
     /*
       runCanny runs canny edge detection on an image, and dilates and erodes it to close holes
@@ -36,6 +39,10 @@ namespace segment {
     */
     cv::Mat runGmm(cv::Mat *mat, vector<vector<cv::Point>> hulls, int maxGmmIterations);
 
+    cv::Mat runHistogramGmm(cv::Mat *mat, vector<vector<cv::Point>> hulls, int maxGmmIterations);
+
+    cv::Mat runSuperpixelGmm(cv::Mat *mat, cv::Mat roots, vector<vector<cv::Point>> hulls, int maxGmmIterations);
+
     cv::Mat runGmmCleanup(cv::Mat *mat, cv::Mat gmmPredictions);
 
     /*
@@ -2,6 +2,7 @@
 #include "../objects/Clump.h"
 #include "../functions/SegmenterTools.h"
 #include "DRLSE.h"
+#include "../objects/Trace.h"
 #include <ctime>
 using namespace std;
 
@@ -12,6 +13,7 @@ namespace segment {
          * updatePhi evolves the level set front, phi, using the modified DRLSE algorithm
          */
         void updatePhi(Cell *cellI, Clump *clump, double dt, double epsilon, double mu, double kappa, double chi) {
+            TraceSpan span("drlse::updatePhi");
             //getPhi returns phi that is cropped to a bounding box of phi and its neighbors + padding
             cv::Mat phi = cellI->getPhi();
 
@@ -22,12 +24,11 @@ namespace segment {
             boundingBoxWithNeighbors.height = phi.rows;
 
             //Crop edge enforcer to a bounding box of phi and its neighbors + padding
-            cv::Mat edgeEnforcer = clump->edgeEnforcer.clone();
-            edgeEnforcer = edgeEnforcer(boundingBoxWithNeighbors);
+            //The crops are views, the terms below only read them element-wise
+            cv::Mat edgeEnforcer = clump->edgeEnforcer(boundingBoxWithNeighbors);
 
             //Crop clump prior to a bounding box of phi and its neighbors + padding
-            cv::Mat clumpPrior = clump->clumpPrior.clone();
-            clumpPrior = clumpPrior(boundingBoxWithNeighbors);
+            cv::Mat clumpPrior = clump->clumpPrior(boundingBoxWithNeighbors);
 
             //Perform the modified DRLSE algorithm
             vector <cv::Mat> gradient = calcGradient(phi);
@@ -120,9 +121,10 @@ namespace segment {
          * of the gaussian convolution of the matrix
          */
         cv::Mat calcEdgeEnforcer(cv::Mat mat) {
-            mat = mat.clone();
-            cv::cvtColor(mat, mat, cv::COLOR_BGR2GRAY);
-            mat.convertTo(mat, CV_32FC1);
+            // Color matrices are converted to grayscale, the matrix passed in is never modified
+            cv::Mat gray = mat;
+            if (mat.channels() != 1) cv::cvtColor(mat, gray, cv::COLOR_BGR2GRAY);
+            gray.convertTo(mat, CV_32FC1);
 
             //Find the gaussian kernel of kernel size 15 and sigma 1.5
             cv::Mat gaussianKernel = cv::getGaussianKernel(15, 1.5, CV_32FC1);
@@ -1,4 +1,6 @@
 #include "Export.h"
+#include "../objects/ArtifactWriter.h"
+#include "../objects/ThumbnailPack.h"
 
 
 using json = nlohmann::json;
@@ -26,21 +28,33 @@ namespace segment {
         return converted;
     }
 
-    void exportResults(Image *image) {
+    /*
+     * exportResults writes a thumbnail of every segmented cell and export.json, which the portal reads
+     * thumbnailMode: "pack" to write the thumbnails into thumbnails.pack, listed in export.json by offset and length,
+     * or "files" to write each thumbnail to its own file in the thumbnails directory
+     */
+    void exportResults(Image *image, string thumbnailMode) {
+        // The thumbnails and export.json are only written to disk
+        if (!image->hasWriteDirectory()) return;
         json results;
+        bool packed = thumbnailMode == "pack";
 
+        // Only the thumbnails of the current mode are kept
+        boost::filesystem::remove(image->getWriteDirectory() / "thumbnails.pack");
         boost::filesystem::remove_all(image->getWriteDirectory() / "thumbnails");
+        unique_ptr<ThumbnailPack> pack;
+        if (packed) pack.reset(new ThumbnailPack(image->getWriteDirectory() / "thumbnails.pack"));
 
         //json nucleiBoundaries;
         //json finalCellBoundaries;
         json nucleiCytoRatios;
         json thumbnails;
+        string extension = ArtifactWriter::getInstance().getExtension();
 
         int i = 0;
         for (int clumpIdx = 0; clumpIdx < image->clumps.size(); clumpIdx++) {
             Clump *clump = &image->clumps[clumpIdx];
-            cv::Mat clumpMat = image->mat.clone();
-            clumpMat = clumpMat(clump->boundingRect);
+            cv::Mat clumpMat = image->readRegion(clump->boundingRect);
             for (int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) {
                 Cell *cell = &clump->cells[cellIdx];
                 cv::Mat thumbnail = clumpMat.clone();
@@ -51,17 +65,22 @@ namespace segment {
                 cv::drawContours(thumbnail, vector<vector<cv::Point>>{cell->finalContour}, 0, cv::Scalar(255, 0, 0), 2);
                 cv::drawContours(thumbnail, vector<vector<cv::Point>>{cell->nucleusBoundary}, 0, cv::Scalar(0, 0, 255), 2);
 
-                thumbnail = thumbnail(cell->boundingBoxWithNeighbors);
+                // Copied so the queued thumbnail doesn't keep the whole clump in memory until it is written
+                thumbnail = thumbnail(cell->boundingBoxWithNeighbors).clone();
                 string fileName = to_string(i);
                 fileName += "_" + to_string((int) round(cell->phiArea));
                 fileName += "_" + to_string((int) round(cell->nucleusArea));
 
-                image->writeImage("thumbnails/" + fileName + ".png", thumbnail);
+                if (packed) {
+                    pack->add(move(thumbnail));
+                } else {
+                    image->writeImage("thumbnails/" + fileName + extension, thumbnail);
+                    thumbnails.push_back(fileName + extension);
+                }
 
                 //nucleiBoundaries.push_back(contourToJson(cell->nucleusBoundary));
                 //finalCellBoundaries.push_back(contourToJson(cell->finalContour));
                 nucleiCytoRatios.push_back(cell->nucleusArea / cell->phiArea);
-                thumbnails.push_back(fileName + ".png");
                 i++;
 
             }
@@ -75,6 +94,15 @@ namespace segment {
         });
 
 
+        if (packed) {
+            // The offsets are only known once every thumbnail is encoded
+            if (pack->finish()) results["thumbnailPack"] = "thumbnails.pack";
+            results["thumbnailFormat"] = extension.substr(1);
+            for (auto &entry : pack->getEntries()) {
+                thumbnails.push_back({entry.first, entry.second});
+            }
+        }
+
         results["nucleiCytoRatios"] = nucleiCytoRatios;
         results["thumbnails"] = thumbnails;
         results["sorted"] = sorted;
@@ -83,4 +111,175 @@ namespace segment {
 
         image->writeJSON("export.json", results);
     }
-}
\ No newline at end of file
+
+    /*
+     * polygonToJson converts a contour to the coordinates of a GeoJSON polygon, the ring is closed
+     */
+    static json polygonToJson(const vector<cv::Point> &contour) {
+        json ring = contourToJson(contour);
+        ring.push_back({contour[0].x, contour[0].y});
+        return json::array({ring});
+    }
+
+    /*
+     * writeDeepZoomTiles writes the image as a Deep Zoom (DZI) tile pyramid, image.dzi and image_files/<level>/<col>_<row>
+     * Level 0 is a single pixel and the last level is the full resolution image, each level is half the size of the next.
+     * The tiles are encoded in the background by the ArtifactWriter.
+     * Levels of streamed images that are too large to be in memory are downsampled a tile at a time with
+     * Image::readPyramidRegion, the first level that fits is read with Image::readPyramidLevel.
+     */
+    static void writeDeepZoomTiles(Image *image, int tileSize, int overlap, string format) {
+        boost::filesystem::path tilesDirectory = image->getWriteDirectory() / "image_files";
+        boost::filesystem::remove_all(tilesDirectory);
+        ArtifactWriter &writer = ArtifactWriter::getInstance();
+        string extension = writer.getExtension();
+
+        cv::Size size = image->getSize();
+        int maxLevel = (int) ceil(log2(max(size.width, size.height)));
+        cv::Mat level;
+        cv::Size levelSize = size;
+        for (int levelIdx = maxLevel; levelIdx >= 0; levelIdx--) {
+            int downsampling = maxLevel - levelIdx;
+            if (levelIdx < maxLevel) {
+                levelSize = cv::Size((levelSize.width + 1) / 2, (levelSize.height + 1) / 2);
+            }
+            bool tiled = image->isStreamed() && (int64_t) levelSize.width * levelSize.height > STREAMED_IMAGE_PIXELS;
+            if (!tiled && level.empty()) {
+                level = image->readPyramidLevel(downsampling);
+            } else if (!tiled) {
+                cv::Mat smaller;
+                cv::resize(level, smaller, levelSize, 0, 0, cv::INTER_AREA);
+                level = smaller;
+            }
+            boost::filesystem::path levelDirectory = tilesDirectory / to_string(levelIdx);
+            boost::filesystem::create_directories(levelDirectory);
+            for (int row = 0; row * tileSize < levelSize.height; row++) {
+                for (int col = 0; col * tileSize < levelSize.width; col++) {
+                    cv::Point tl(max(0, col * tileSize - overlap), max(0, row * tileSize - overlap));
+                    cv::Point br(min(levelSize.width, (col + 1) * tileSize + overlap), min(levelSize.height, (row + 1) * tileSize + overlap));
+                    // The tile is read for itself or is a view of the level, which is not modified after its tiles are queued
+                    cv::Mat tile = tiled ? image->readPyramidRegion(downsampling, cv::Rect(tl, br)) : level(cv::Rect(tl, br));
+                    string name = to_string(col) + "_" + to_string(row) + extension;
+                    writer.write((levelDirectory / name).string(), move(tile));
+                }
+            }
+        }
+
+        ofstream dzi((image->getWriteDirectory() / "image.dzi").string());
+        dzi << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << endl;
+        dzi << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"" << tileSize
+            << "\" Overlap=\"" << overlap << "\" Format=\"" << format << "\">" << endl;
+        dzi << "    <Size Width=\"" << size.width << "\" Height=\"" << size.height << "\"/>" << endl;
+        dzi << "</Image>" << endl;
+    }
+
+    /*
+     * writeOverlayTiles writes the cell and nucleus contours as one GeoJSON FeatureCollection per overlay tile,
+     * overlay/<col>_<row>.geojson in full resolution pixel coordinates. A cell is in every tile its bounding box
+     * overlaps, its cell property is its index in export.json. Tiles without cells are not written.
+     * Returns the columns and rows of the tiles that were written
+     */
+    static json writeOverlayTiles(Image *image, int overlayTileSize) {
+        boost::filesystem::path overlayDirectory = image->getWriteDirectory() / "overlay";
+        boost::filesystem::remove_all(overlayDirectory);
+        boost::filesystem::create_directories(overlayDirectory);
+
+        cv::Size size = image->getSize();
+        int columns = (size.width + overlayTileSize - 1) / overlayTileSize;
+        int rows = (size.height + overlayTileSize - 1) / overlayTileSize;
+        vector<json> tiles(columns * rows);
+
+        // Cells are numbered like the thumbnails of exportResults
+        int i = 0;
+        for (int clumpIdx = 0; clumpIdx < image->clumps.size(); clumpIdx++) {
+            Clump *clump = &image->clumps[clumpIdx];
+            for (int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) {
+                Cell *cell = &clump->cells[cellIdx];
+                if (cell->finalContour.empty() || cell->nucleusBoundary.empty()) {
+                    continue;
+                }
+                vector<cv::Point> cytoplasm = clump->undoBoundingRect(cell->finalContour);
+                vector<cv::Point> nucleus = clump->undoBoundingRect(cell->nucleusBoundary);
+                json properties = {{"cell", i}, {"clump", clumpIdx}, {"nucleiCytoRatio", cell->nucleusArea / cell->phiArea}};
+                json cytoplasmFeature = {{"type", "Feature"},
+                                         {"geometry", {{"type", "Polygon"}, {"coordinates", polygonToJson(cytoplasm)}}},
+                                         {"properties", properties}};
+                cytoplasmFeature["properties"]["type"] = "cytoplasm";
+                json nucleusFeature = {{"type", "Feature"},
+                                       {"geometry", {{"type", "Polygon"}, {"coordinates", polygonToJson(nucleus)}}},
+                                       {"properties", properties}};
+                nucleusFeature["properties"]["type"] = "nucleus";
+
+                cv::Rect bounds = (cv::boundingRect(cytoplasm) | cv::boundingRect(nucleus)) &
+                                  cv::Rect(cv::Point(), size);
+                int lastRow = bounds.area() > 0 ? (bounds.br().y - 1) / overlayTileSize : -1;
+                int lastCol = (bounds.br().x - 1) / overlayTileSize;
+                for (int row = bounds.y / overlayTileSize; row <= lastRow; row++) {
+                    for (int col = bounds.x / overlayTileSize; col <= lastCol; col++) {
+                        json &tile = tiles[row * columns + col];
+                        tile.push_back(cytoplasmFeature);
+                        tile.push_back(nucleusFeature);
+                    }
+                }
+                i++;
+            }
+        }
+
+        json written = json::array();
+        for (int row = 0; row < rows; row++) {
+            for (int col = 0; col < columns; col++) {
+                json &features = tiles[row * columns + col];
+                if (features.is_null()) continue;
+                json collection = {{"type", "FeatureCollection"}, {"features", move(features)}};
+                ofstream ofs((overlayDirectory / (to_string(col) + "_" + to_string(row) + ".geojson")).string());
+                ofs << collection << endl;
+                written.push_back({col, row});
+            }
+        }
+        return written;
+    }
+
+    /*
+     * exportDeepZoom writes the image as a Deep Zoom tile pyramid and the segmentation as tiled GeoJSON, so a viewer
+     * only loads the visible part of a slide instead of full resolution renders of the boundaries.
+     * deepzoom.json describes both. The pyramid only depends on the image and is kept if a previous run wrote it with
+     * the same tiling and format, only the overlay is rewritten.
+     * tileSize, overlap: size and overlap in pixels of the tiles of the pyramid
+     * overlayTileSize: size in full resolution pixels of the overlay tiles
+     */
+    void exportDeepZoom(Image *image, int tileSize, int overlap, int overlayTileSize) {
+        if (!image->hasWriteDirectory() || image->getSize().width == 0) return;
+        string format = ArtifactWriter::getInstance().getExtension().substr(1);
+
+        json previous = image->loadJSON("deepzoom.json");
+        json manifest;
+        manifest["dzi"] = "image.dzi";
+        manifest["width"] = image->getSize().width;
+        manifest["height"] = image->getSize().height;
+        manifest["tileSize"] = tileSize;
+        manifest["overlap"] = overlap;
+        manifest["format"] = format;
+        manifest["contentHash"] = image->getContentHash();
+
+        bool pyramidWritten = !previous.is_null() && boost::filesystem::exists(image->getWriteDirectory() / "image.dzi");
+        for (const char *key : {"width", "height", "tileSize", "overlap", "format", "contentHash"}) {
+            pyramidWritten = pyramidWritten && previous.contains(key) && previous[key] == manifest[key];
+        }
+        if (pyramidWritten) {
+            image->log("Deep zoom pyramid is up to date, only writing the overlay\n");
+        } else {
+            // The old manifest must not describe a pyramid that is being replaced
+            boost::filesystem::remove(image->getWriteDirectory() / "deepzoom.json");
+            writeDeepZoomTiles(image, tileSize, overlap, format);
+        }
+
+        manifest["overlay"] = {
+                {"directory", "overlay"},
+                {"tileSize", overlayTileSize},
+                {"tiles", writeOverlayTiles(image, overlayTileSize)}
+        };
+        // The manifest is only written once every tile is on disk, a run that is interrupted rewrites the pyramid
+        if (!pyramidWritten) ArtifactWriter::getInstance().flush();
+        image->writeJSON("deepzoom.json", manifest);
+    }
+}
@@ -6,7 +6,8 @@
 #include "../objects/Image.h"
 
 namespace segment {
-    void exportResults(Image *image);
+    void exportResults(Image *image, string thumbnailMode = "pack");
+    void exportDeepZoom(Image *image, int tileSize = 254, int overlap = 1, int overlayTileSize = 1024);
 }
 
 #endif //EXPORT_H
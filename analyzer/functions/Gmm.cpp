@@ -0,0 +1,62 @@
+#include "Gmm.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace segment {
+    // Smallest variance of a component, keeps a component fit to a single value from collapsing
+    static const double GMM_MIN_VARIANCE = 1e-4;
+
+    vector<unsigned char> fitGmm(const vector<double> &samples, const vector<double> &weights,
+                                 const vector<double> &responsibilities, int maxIterations) {
+        size_t n = samples.size();
+        // Probability of each sample belonging to component 1
+        vector<double> r(responsibilities);
+        double mean[2], variance[2], weight[2];
+
+        // Like cv::ml::EM::trainM, start with the M step from the initial probabilities
+        for (int iteration = 0; iteration < maxIterations; iteration++) {
+            for (int k = 0; k < 2; k++) {
+                double total = 0;
+                double sum = 0;
+                for (size_t i = 0; i < n; i++) {
+                    double w = weights[i] * (k ? r[i] : 1 - r[i]);
+                    total += w;
+                    sum += w * samples[i];
+                }
+                mean[k] = total > 0 ? sum / total : 0;
+                double squares = 0;
+                for (size_t i = 0; i < n; i++) {
+                    double w = weights[i] * (k ? r[i] : 1 - r[i]);
+                    double d = samples[i] - mean[k];
+                    squares += w * d * d;
+                }
+                variance[k] = max(total > 0 ? squares / total : 0, GMM_MIN_VARIANCE);
+                weight[k] = total;
+            }
+            double total = weight[0] + weight[1];
+            if (total <= 0) break;
+
+            // E step, the log likelihood of each component
+            double logNorm[2];
+            for (int k = 0; k < 2; k++) {
+                logNorm[k] = log(weight[k] / total) - 0.5 * log(2 * M_PI * variance[k]);
+            }
+            for (size_t i = 0; i < n; i++) {
+                double d0 = samples[i] - mean[0];
+                double d1 = samples[i] - mean[1];
+                double log0 = logNorm[0] - d0 * d0 / (2 * variance[0]);
+                double log1 = logNorm[1] - d1 * d1 / (2 * variance[1]);
+                if (std::isinf(log0) && std::isinf(log1)) continue;
+                r[i] = 1 / (1 + exp(log0 - log1));
+            }
+        }
+
+        vector<unsigned char> components(n);
+        for (size_t i = 0; i < n; i++) {
+            components[i] = r[i] > 0.5;
+        }
+        return components;
+    }
+}
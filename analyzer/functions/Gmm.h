@@ -0,0 +1,23 @@
+#ifndef GMM_H
+#define GMM_H
+
+#include <vector>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * fitGmm fits a mixture of two 1-D gaussians to weighted samples with expectation maximization
+     * Returns:
+     *  vector<unsigned char> = the component, 0 or 1, each sample most likely belongs to
+     * Params:
+     *  vector<double> samples = the values of the samples
+     *  vector<double> weights = the weight of each sample, like the number of pixels it stands for
+     *  vector<double> responsibilities = initial probability of each sample belonging to component 1
+     *  int maxIterations = number of iterations to train the gmm
+     */
+    vector<unsigned char> fitGmm(const vector<double> &samples, const vector<double> &weights,
+                                 const vector<double> &responsibilities, int maxIterations);
+}
+
+#endif //GMM_H
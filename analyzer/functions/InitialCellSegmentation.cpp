@@ -2,6 +2,7 @@
 #include "InitialCellSegmentation.h"
 #include "SegmenterTools.h"
 #include "../objects/ClumpsThread.h"
+#include "../objects/Trace.h"
 
 using namespace std;
 
@@ -619,19 +620,23 @@ namespace segment {
      *    the overlapping cell segmentation will shrink to fit the actual boundaries.
      */
     void startInitialCellSegmentationThread(Image *image, Clump *clump, int clumpIdx, bool debug) {
-        image->log("Beginning initial cell segmentation for clump %d, width: %d, height: %d\n", clumpIdx, clump->boundingRect.width, clump->boundingRect.height);
+        image->log(LOG_DEBUG, "Beginning initial cell segmentation for clump %d, width: %d, height: %d\n", clumpIdx, clump->boundingRect.width, clump->boundingRect.height);
 
+        TraceSpan span("startInitialCellSegmentationThread", clumpIdx);
         auto start = chrono::high_resolution_clock::now();
+        TraceSpan associateSpan("associateClumpBoundariesWithCell");
         associateClumpBoundariesWithCell2(image, clump, clumpIdx, debug);
+        associateSpan.end();
         //associateClumpBoundariesWithCell(image, clump, clumpIdx, debug);
 
         auto end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
-        image->log("Clump %d, done associate clump boundaries with cells, time: %f\n", clumpIdx, end);
+        image->log(LOG_DEBUG, "Clump %d, done associate clump boundaries with cells, time: %f\n", clumpIdx, end);
         //associationsToBoundaries(clump);
         //findNeighbors(clump);
 
         //Interpolation of overlapping neighbors
+        TraceSpan interpolateSpan("interpolateOverlappingArea");
         for (unsigned int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) {
             Cell *cell = &clump->cells[cellIdx];
             for (unsigned int compIdx = 0; compIdx < cell->neighbors.size(); compIdx++) {
@@ -641,16 +646,17 @@ namespace segment {
                 interpolateOverlappingArea(clump, cell, neighborCell);
             }
         }
+        interpolateSpan.end();
         end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
-        image->log("Finishing initial cell segmentation for clump %d, time: %f\n", clumpIdx, end);
+        image->log(LOG_DEBUG, "Finishing initial cell segmentation for clump %d, time: %f\n", clumpIdx, end);
     }
 
     /*
-     * saveCellNeighbors saves each cell's neighbors in the form of cell indexes for all clumps
-     * to a JSON file
+     * saveInitialCellBoundaries appends each cell's initial boundary and its neighbors, in the form of
+     * cell indexes, to the initial cell checkpoint
      */
-    void saveCellNeighbors(json &cellNeighbors, Image *image, Clump *clump, int clumpIdx) {
+    void saveInitialCellBoundaries(CheckpointStore &initialCellBoundaries, Clump *clump, int clumpIdx) {
         map<Cell *, int> cellToIdx;
 
         //Find indexes for each cell
@@ -659,102 +665,85 @@ namespace segment {
             cellToIdx[cell] = cellIdx;
         }
 
-        //Save neighbor information to JSON object in memory
+        CheckpointRecord record;
         for (int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) {
             Cell *cell = &(clump->cells[cellIdx]);
-            json neighbors;
+            vector<int> neighbors;
             for (Cell *neighbor : cell->neighbors) {
-                int neighborIdx = cellToIdx[neighbor];
-                neighbors.push_back(neighborIdx);
+                neighbors.push_back(cellToIdx[neighbor]);
             }
-            cellNeighbors[clumpIdx][cellIdx] = neighbors;
-        }
-
-        //Write to JSON file every 100 clumps or when the clump is big
-        if (clumpIdx % 100 == 0 || clump->cells.size() > 5000) {
-            image->writeJSON("cellNeighbors", cellNeighbors);
+            record.contours.push_back(cell->cytoBoundary);
+            record.neighbors.push_back(neighbors);
         }
+        initialCellBoundaries.append(clumpIdx, record);
     }
 
     /*
-     * loadCellNeighbors loads cell neighbors from a JSON file into memory
+     * loadInitialCellBoundaries loads a clump's initial cell boundaries and cell neighbors from the checkpoint
+     * into memory
      */
-    void loadCellNeighbors(json &cellNeighbors, Image *image, vector<Clump> *clumps) {
-        cellNeighbors = image->loadJSON("cellNeighbors");
-        for (int clumpIdx = 0; clumpIdx < cellNeighbors.size(); clumpIdx++) {
-            Clump *clump = &(*clumps)[clumpIdx];
-            json jsonClumpCellNeighbors = cellNeighbors[clumpIdx];
-            if (jsonClumpCellNeighbors == nullptr) continue;
-            int jsonNumberCells = cellNeighbors[clumpIdx].size();
-            for (int cellIdx = 0; cellIdx < jsonNumberCells; cellIdx++) {
-                Cell *cell = &clump->cells[cellIdx];
-                json jsonCellNeighbors = cellNeighbors[clumpIdx][cellIdx];
-                if (jsonCellNeighbors == nullptr) break;
-                for (int neighborIdx : jsonCellNeighbors) {
-                    Cell *neighbor = &clump->cells[neighborIdx];
-                    cell->neighbors.push_back(neighbor);
-                }
+    void loadInitialCellBoundaries(const CheckpointStore &initialCellBoundaries, Clump *clump, int clumpIdx) {
+        CheckpointRecord record;
+        if (!initialCellBoundaries.load(clumpIdx, record)) return;
+        // The checkpoint does not belong to this clump
+        if (record.contours.size() > clump->cells.size() || record.neighbors.size() != record.contours.size()) return;
+        for (int cellIdx = 0; cellIdx < record.contours.size(); cellIdx++) {
+            Cell *cell = &clump->cells[cellIdx];
+            cell->cytoBoundary = record.contours[cellIdx];
+            for (int neighborIdx : record.neighbors[cellIdx]) {
+                if (neighborIdx >= clump->cells.size()) continue;
+                Cell *neighbor = &clump->cells[neighborIdx];
+                cell->neighbors.push_back(neighbor);
             }
-
         }
+        clump->initCytoBoundariesLoaded = true;
     }
 
     /*
-     * saveInitialCellBoundaries saves each cell's initial boundaries as contours to a JSON file
+     * startInitialCellSegmentation finds the initial cell boundaries of a single clump
+     * The cells are created from the clump's nuclei and loaded from the checkpoints if they were saved before.
+     * Cells left without a boundary are removed. Clumps without nuclei are skipped.
      */
-    void saveInitialCellBoundaries(json &initialCellBoundaries, Image *image, Clump *clump, int clumpIdx) {
-        for (int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) {
-            Cell *cell = &(clump->cells[cellIdx]);
-            json initialCellBoundary;
-            for (cv::Point &point : cell->cytoBoundary) {
-                initialCellBoundary.push_back({point.x, point.y});
-            }
-            initialCellBoundaries[clumpIdx][cellIdx] = initialCellBoundary;
+    void startInitialCellSegmentation(Image *image, Clump *clump, int clumpIdx,
+                                      const CheckpointStore &initialCellBoundaries, bool debug) {
+        if (clump->nucleiBoundaries.empty()) return;
+
+        // run a find contour on the nucleiBoundaries to get them as contours, not regions
+        clump->createCells();
+        loadInitialCellBoundaries(initialCellBoundaries, clump, clumpIdx);
+
+        if (clump->initCytoBoundariesLoaded) {
+            image->log(LOG_DEBUG, "Loaded clump %u initial cell boundaries from file\n", clumpIdx);
+        } else {
+            startInitialCellSegmentationThread(image, clump, clumpIdx, debug);
         }
+        for (unsigned int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) {
+            Cell *cell = &clump->cells[cellIdx];
+
+            cell->originalCytoBoundary.clear();
+            cell->originalCytoBoundary.shrink_to_fit();
 
-        //Write to JSON file every 100 clumps or when the clump is big
-        if (clumpIdx % 100 == 0 || clump->cells.size() > 5000) {
-            image->writeJSON("initialCellBoundaries", initialCellBoundaries);
+            if (cell->cytoBoundary.size() == 0) {
+                // Delete cell if there are no more boundaries
+                for (unsigned int neighborIdx = 0; neighborIdx < cell->neighbors.size(); neighborIdx++) {
+                    Cell *neighborCell = cell->neighbors[neighborIdx];
+                    //Remove cell from its neighbors
+                    std::remove(neighborCell->neighbors.begin(), neighborCell->neighbors.end(), cell);
+                }
+                // Remove cell from the cell list
+                clump->cells.erase(clump->cells.begin() + cellIdx);
+                cellIdx--;
+            }
         }
     }
 
     /*
-     * loadInitialCellBoundaries loads initial cell boundaries from a JSON file into memory
+     * saveInitialCellSegmentation saves a clump's initial cell boundaries and neighbors
+     * if they weren't loaded from the checkpoint
      */
-    void loadInitialCellBoundaries(json &initialCellBoundaries, Image *image, vector<Clump> *clumps) {
-        initialCellBoundaries = image->loadJSON("initialCellBoundaries");
-        for (int clumpIdx = 0; clumpIdx < initialCellBoundaries.size(); clumpIdx++) {
-            Clump *clump = &(*clumps)[clumpIdx];
-            json jsonClumpContours = initialCellBoundaries[clumpIdx];
-            if (jsonClumpContours == nullptr) continue;
-            int jsonNumberCells = initialCellBoundaries[clumpIdx].size();
-            for (int cellIdx = 0; cellIdx < jsonNumberCells; cellIdx++) {
-                json jsonCellContour = initialCellBoundaries[clumpIdx][cellIdx];
-                // Will not load incomplete clumps
-                if (jsonCellContour == nullptr) break;
-                bool validContour = true;
-                vector<cv::Point> contour;
-                for (json &jsonPoint : jsonCellContour) {
-                    if (jsonPoint.size() != 2) {
-                        validContour = false;
-                        break;
-                    }
-                    int x = jsonPoint[0];
-                    int y = jsonPoint[1];
-                    cv::Point point = cv::Point(x, y);
-                    contour.push_back(point);
-                }
-                if (!validContour) {
-                    break;
-                }
-                Cell *cell = &clump->cells[cellIdx];
-                cell->cytoBoundary = contour;
-                // Clump cyto boundaries are fully loaded
-                if (cellIdx == jsonNumberCells - 1) {
-                    clump->initCytoBoundariesLoaded = true;
-                }
-            }
-
+    void saveInitialCellSegmentation(CheckpointStore &initialCellBoundaries, Clump *clump, int clumpIdx) {
+        if (!clump->initCytoBoundariesLoaded) {
+            saveInitialCellBoundaries(initialCellBoundaries, clump, clumpIdx);
         }
     }
 
@@ -764,69 +753,25 @@ namespace segment {
      */
     cv::Mat runInitialCellSegmentation(Image *image, int threshold1, int threshold2, bool debug) {
         vector<Clump> *clumps = &image->clumps;
-        // run a find contour on the nucleiBoundaries to get them as contours, not regions
-        for (unsigned int c = 0; c < clumps->size(); c++) {
-            Clump *clump = &(*clumps)[c];
-            clump->createCells();
-        }
-
-        cv::Mat outimg = image->mat.clone();
-        cv::RNG rng(12345);
 
-        json initialCellBoundaries;
-        json cellNeighbors;
-
-        loadInitialCellBoundaries(initialCellBoundaries, image, clumps);
-        loadCellNeighbors(cellNeighbors, image, clumps);
+        // The threads load clumps from the records of a previous run while the done function appends new ones
+        CheckpointStore initialCellBoundaries(image->getCheckpointPath("initialCellBoundaries"), image->useCache);
 
         //Function called when thread is started
-        function<void(Clump *, int)> threadFunction = [&image, &debug, &rng, &outimg](Clump *clump, int clumpIdx) {
-
-            if (clump->initCytoBoundariesLoaded) {
-                image->log("Loaded clump %u initial cell boundaries from file\n", clumpIdx);
-            } else {
-                startInitialCellSegmentationThread(image, clump, clumpIdx, debug);
-            }
-            for (unsigned int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) {
-                Cell *cell = &clump->cells[cellIdx];
-
-                cell->originalCytoBoundary.clear();
-                cell->originalCytoBoundary.shrink_to_fit();
-
-                vector<cv::Point> contour = clump->undoBoundingRect(cell->cytoBoundary);
-                if (contour.size() == 0) {
-                    // Delete cell if there are no more boundaries
-                    for (unsigned int neighborIdx = 0; neighborIdx < cell->neighbors.size(); neighborIdx++) {
-                        Cell *neighborCell = cell->neighbors[neighborIdx];
-                        //Remove cell from its neighbors
-                        std::remove(neighborCell->neighbors.begin(), neighborCell->neighbors.end(), cell);
-                    }
-                    // Remove cell from the cell list
-                    clump->cells.erase(clump->cells.begin() + cellIdx);
-                    cellIdx--;
-                    continue;
-                }
-                cv::Scalar color = cv::Scalar(rng.uniform(0,255), rng.uniform(0, 255), rng.uniform(0, 255));
-                cv::drawContours(outimg, vector<vector<cv::Point>>{contour}, 0, color, 3);
-            }
+        function<void(Clump *, int)> threadFunction = [&image, &debug, &initialCellBoundaries](Clump *clump, int clumpIdx) {
+            startInitialCellSegmentation(image, clump, clumpIdx, initialCellBoundaries, debug);
         };
 
         //Function called when thread finishes
-        function<void(Clump *, int)> threadDoneFunction = [&initialCellBoundaries, &cellNeighbors, &image](Clump *clump, int clumpIdx) {
-            //Save cell boundaries and neighbors to file if it wasn't loaded from the JSON file
-            if (!clump->initCytoBoundariesLoaded) {
-                saveInitialCellBoundaries(initialCellBoundaries, image, clump, clumpIdx);
-                saveCellNeighbors(cellNeighbors, image, clump, clumpIdx);
-            }
+        function<void(Clump *, int)> threadDoneFunction = [&initialCellBoundaries](Clump *clump, int clumpIdx) {
+            //Save cell boundaries and neighbors to file if they weren't loaded from the checkpoint
+            saveInitialCellSegmentation(initialCellBoundaries, clump, clumpIdx);
         };
 
-        int maxThreads = 16;
-        ClumpsThread(maxThreads, clumps, threadFunction, threadDoneFunction);
+        ClumpsThread(clumps, INITIAL_CELL_SEGMENTATION, threadFunction, threadDoneFunction);
 
-        //Save all remaining cell boundaries and neighbors to JSON file
-        image->writeJSON("initialCellBoundaries", initialCellBoundaries);
-        image->writeJSON("cellNeighbors", cellNeighbors);
+        initialCellBoundaries.flush();
 
-        return outimg;
+        return image->getInitialCellBoundaries();
     }
-}
\ No newline at end of file
+}
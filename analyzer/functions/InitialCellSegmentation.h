@@ -3,10 +3,16 @@
 
 #include "opencv2/opencv.hpp"
 #include "../objects/Clump.h"
+#include "../objects/CheckpointStore.h"
 
 namespace segment {
     bool testLineViability(cv::Point pixel, Clump *clump, Cell *cell);
 
+    void startInitialCellSegmentation(Image *image, Clump *clump, int clumpIdx,
+                                      const CheckpointStore &initialCellBoundaries, bool debug = false);
+
+    void saveInitialCellSegmentation(CheckpointStore &initialCellBoundaries, Clump *clump, int clumpIdx);
+
     cv::Mat runInitialCellSegmentation(Image *image, int threshold1, int threshold2, bool debug = false);
 }
 
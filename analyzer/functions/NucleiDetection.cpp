@@ -1,9 +1,9 @@
 #include "NucleiDetection.h"
 #include "../objects/ClumpsThread.h"
+#include "../objects/Trace.h"
 #include <future>
 #include <thread>
 
-using json = nlohmann::json;
 
 namespace segment {
 
@@ -43,14 +43,15 @@ namespace segment {
     vector<vector<cv::Point>> runMser(cv::Mat *img, vector<cv::Point> contour, int delta,
                                       int minArea, int maxArea, double maxVariation,
                                       double minDiversity, bool debug) {
+        TraceSpan span("runMser");
         //Create a MSER instance
         cv::Ptr<cv::MSER> mser = cv::MSER::create(delta, minArea, maxArea,
                                                   maxVariation, minDiversity);
 
-        //Convert the src image to grayscale
+        //Convert the src image to grayscale, unless it already is
         cv::Mat tmp;
         img->convertTo(tmp, CV_8U);
-        cv::cvtColor(tmp, tmp, CV_BGR2GRAY); //TODO - Read the image in as gray, remove this step
+        if (tmp.channels() != 1) cv::cvtColor(tmp, tmp, CV_BGR2GRAY);
 
         //Return variables
         vector<vector<cv::Point> > regions;
@@ -78,7 +79,7 @@ namespace segment {
 
         //TODO - "Regions found" is currently a redundant print
         /*if (debug) {
-      image->log("Regions found: %lu\n", regions.size());
+      image->log(LOG_DEBUG, "Regions found: %lu\n", regions.size());
 
       for (unsigned int i = 0; i < regions.size(); i++) {
         //Display region
@@ -96,97 +97,83 @@ namespace segment {
     }
 
     /*
-     * saveNucleiBoundaries saves each cell's nuclei boundaries as contours to a JSON file
+     * startNucleiDetectionThread finds the nuclei boundaries of a single clump
+     * Clumps whose nuclei were loaded from file are skipped
      */
-    void saveNucleiBoundaries(json &nucleiBoundaries, Image *image, Clump *clump, int clumpIdx) {
-        nucleiBoundaries[clumpIdx] = json::array();
-        for (vector<cv::Point> &contour : clump->nucleiBoundaries) {
-            json nucleiBoundary;
-            for (cv::Point &point : contour) {
-                nucleiBoundary.push_back({point.x, point.y});
-            }
-            nucleiBoundaries[clumpIdx].push_back(nucleiBoundary);
+    void startNucleiDetectionThread(Clump *clump, int i, Image *image, int delta, int minArea, int maxArea,
+                                    double maxVariation, double minDiversity, double minCircularity, bool debug) {
+        if (clump->nucleiBoundariesLoaded) {
+            //image->log("Loaded clump %u nuclei from file\n", i);
+            return;
         }
-
-        //Write to JSON file every 100 clumps
-        if (clumpIdx % 100 == 0) {
-            image->writeJSON("nucleiBoundaries", nucleiBoundaries);
+        cv::Mat clumpMat = clump->extract(image->readPlaneRegion(PLANE_GRAY, clump->boundingRect));
+
+        //MSER algorithm returns a mask of nuclei as a list of points
+        vector<vector<cv::Point>> nuclei = runMser(&clumpMat, clump->offsetContour,
+                                                   delta, minArea, maxArea, maxVariation,
+                                                   minDiversity, debug);
+        if (!nuclei.empty()) {
+            nuclei = clump->convertNucleiBoundariesToContours(nuclei);
+            nuclei = clump->filterNuclei(nuclei, minCircularity);
         }
+
+        clump->nucleiBoundaries = nuclei;
+
+
+        image->log(LOG_DEBUG, "Clump %u, nuclei found: %lu\n", i, clump->nucleiBoundaries.size());
     }
 
     /*
-     * loadInitialCellBoundaries loads nuclei boundaries from a JSON file into memory
+     * saveNucleiBoundaries appends a clump's nuclei boundaries to the nuclei checkpoint
      */
-    void loadNucleiBoundaries(json &nucleiBoundaries, Image *image, vector<Clump> *clumps) {
-        nucleiBoundaries = image->loadJSON("nucleiBoundaries");
-        for (int clumpIdx = 0; clumpIdx < nucleiBoundaries.size(); clumpIdx++) {
-            json jsonContours = nucleiBoundaries[clumpIdx];
-            if (jsonContours == nullptr) continue;
-            vector<vector<cv::Point>> contours;
-            for (json &jsonContour : jsonContours) {
-                vector<cv::Point> contour;
-                for (json &jsonPoint : jsonContour) {
-                    int x = jsonPoint[0];
-                    int y = jsonPoint[1];
-                    cv::Point point = cv::Point(x, y);
-                    contour.push_back(point);
-                }
-                contours.push_back(contour);
-            }
+    void saveNucleiBoundaries(CheckpointStore &nucleiBoundaries, Clump *clump, int clumpIdx) {
+        CheckpointRecord record;
+        record.contours = clump->nucleiBoundaries;
+        nucleiBoundaries.append(clumpIdx, record);
+    }
+
+    /*
+     * loadNucleiBoundaries loads the nuclei boundaries of every clump in the nuclei checkpoint into memory
+     */
+    void loadNucleiBoundaries(const CheckpointStore &nucleiBoundaries, Image *image, vector<Clump> *clumps) {
+        CheckpointRecord record;
+        for (int clumpIdx = 0; clumpIdx < clumps->size(); clumpIdx++) {
+            if (!nucleiBoundaries.load(clumpIdx, record)) continue;
             Clump *clump = &(*clumps)[clumpIdx];
-            clump->nucleiBoundaries = contours;
+            clump->nucleiBoundaries = record.contours;
             clump->nucleiBoundariesLoaded = true;
         }
-
     }
 
 
     /*
      * runNucleiDetection is the main function that finds the nuclei boundaries for the image
      * This function spawns multiple threads for each clump that finds the nuclei boundaries.
+     * Clumps without nuclei are kept so that clump indexes stay the same in every stage,
+     * they are removed with removeClumpsWithoutNuclei once the segmentation is finished.
      */
     void runNucleiDetection(Image *image, int delta, int minArea, int maxArea, double maxVariation, double minDiversity,
                             double minCircularity, bool debug) {
         vector<Clump> *clumps = &image->clumps;
 
-        json nucleiBoundaries;
+        CheckpointStore nucleiBoundaries(image->getCheckpointPath("nucleiBoundaries"), image->useCache);
 
         loadNucleiBoundaries(nucleiBoundaries, image, clumps);
 
         //Function called when thread is started
         function<void(Clump *, int)> threadFunction = [&image, &delta, &minArea, &maxArea, &maxVariation, &minDiversity, &minCircularity, &debug](Clump *clump, int i) {
-            if (clump->nucleiBoundariesLoaded) {
-                //image->log("Loaded clump %u nuclei from file\n", i);
-                return;
-            }
-            cv::Mat clumpMat = clump->extract();
-            int contourArea = (int) cv::contourArea(clump->offsetContour);
-
-
-            //MSER algorithm returns a mask of nuclei as a list of points
-            vector<vector<cv::Point>> nuclei = runMser(&clumpMat, clump->offsetContour,
-                                                       delta, minArea, maxArea, maxVariation,
-                                                       minDiversity, debug);
-            if (!nuclei.empty()) {
-                nuclei = clump->convertNucleiBoundariesToContours(nuclei);
-                nuclei = clump->filterNuclei(nuclei, minCircularity);
-            }
-
-            clump->nucleiBoundaries = nuclei;
-
-
-            image->log("Clump %u, nuclei found: %lu\n", i, clump->nucleiBoundaries.size());
+            startNucleiDetectionThread(clump, i, image, delta, minArea, maxArea, maxVariation, minDiversity,
+                                       minCircularity, debug);
         };
 
         //Function called when thread finishes
-        function<void(Clump *, int)> threadDoneFunction = [&nucleiBoundaries, &image](Clump *clump, int clumpIdx) {
+        function<void(Clump *, int)> threadDoneFunction = [&nucleiBoundaries](Clump *clump, int clumpIdx) {
             if (!clump->nucleiBoundariesLoaded) {
-                saveNucleiBoundaries(nucleiBoundaries, image, clump, clumpIdx);
+                saveNucleiBoundaries(nucleiBoundaries, clump, clumpIdx);
             }
         };
 
-        int maxThreads = 16;
-        ClumpsThread(maxThreads, clumps, threadFunction, threadDoneFunction);
+        ClumpsThread(clumps, NUCLEI_DETECTION, threadFunction, threadDoneFunction);
 
         //DEBUG: Print the first and second clumps with the most nuclei
         int maxCell = 0;
@@ -200,10 +187,7 @@ namespace segment {
         }
         cout << "MAX "<< maxCell << endl;
         cout << "MAX2 "<< secondCell << endl;
-        image->writeJSON("nucleiBoundaries", nucleiBoundaries);
-
-        removeClumpsWithoutNuclei(clumps);
-
+        nucleiBoundaries.flush();
     }
 
 
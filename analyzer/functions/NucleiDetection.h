@@ -3,13 +3,15 @@
 
 #include "opencv2/opencv.hpp"
 #include "../objects/Clump.h"
-#include "../thirdparty/nlohmann/json.hpp"
+#include "../objects/CheckpointStore.h"
 
 using namespace std;
 
 namespace segment {
     void generateNucleiMasks(Clump *clump);
 
+    void removeClumpsWithoutNuclei(vector<Clump> *clumps);
+
     /*
       runMser takes an image and params and runs MSER algorithm on it, for nuclei detection
       Return:
@@ -29,9 +31,9 @@ namespace segment {
     void startNucleiDetectionThread(Clump *clump, int i, Image *image, int delta, int minArea, int maxArea, double maxVariation, double minDiversity,
                                     double minCircularity, bool debug);
 
-    void saveNucleiBoundaries(json &nucleiBoundaries, Image *image, Clump *clump, int clumpIdx);
+    void saveNucleiBoundaries(CheckpointStore &nucleiBoundaries, Clump *clump, int clumpIdx);
 
-    void loadNucleiBoundaries(json &nucleiBoundaries, Image *image, vector<Clump> *clumps);
+    void loadNucleiBoundaries(const CheckpointStore &nucleiBoundaries, Image *image, vector<Clump> *clumps);
 
     void runNucleiDetection(Image *image, int delta, int minArea, int maxArea, double maxVariation, double minDiversity, double minCircularity, bool debug);
 }
@@ -1,8 +1,15 @@
 #include "OverlappingCellSegmentation.h"
 #include "../objects/ClumpsThread.h"
 #include "DRLSE.h"
+#include "../objects/ThreadPool.h"
+#include "../objects/Trace.h"
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
 
 namespace segment {
+    // Number of cells a clump needs before its cells are updated in parallel
+    const int parallelCellThreshold = 64;
 
     /*
      * isConverged returns true if a cell's phi has converged and false otherwise
@@ -42,39 +49,118 @@ namespace segment {
         return paddedMatrix;
     }
 
+    /*
+     * colorCells colors the graph of cell neighbors so that no two neighboring cells have the same color
+     * Returns the indexes of the cells of each color. Cells are colored greedily from the most neighbors
+     * to the least, neighbors are treated as mutual even if only one of the cells lists the other.
+     */
+    vector<vector<int>> colorCells(Clump *clump) {
+        int numCells = clump->cells.size();
+        unordered_map<Cell *, int> cellToIdx;
+        for (int cellIdx = 0; cellIdx < numCells; cellIdx++) {
+            cellToIdx[&clump->cells[cellIdx]] = cellIdx;
+        }
+
+        vector<vector<int>> adjacent(numCells);
+        for (int cellIdx = 0; cellIdx < numCells; cellIdx++) {
+            for (Cell *neighbor : clump->cells[cellIdx].neighbors) {
+                auto it = cellToIdx.find(neighbor);
+                if (it == cellToIdx.end() || it->second == cellIdx) continue;
+                adjacent[cellIdx].push_back(it->second);
+                adjacent[it->second].push_back(cellIdx);
+            }
+        }
+
+        vector<int> order(numCells);
+        for (int cellIdx = 0; cellIdx < numCells; cellIdx++) order[cellIdx] = cellIdx;
+        stable_sort(order.begin(), order.end(), [&adjacent](int a, int b) {
+            return adjacent[a].size() > adjacent[b].size();
+        });
+
+        vector<int> cellColors(numCells, -1);
+        vector<vector<int>> colors;
+        for (int cellIdx : order) {
+            vector<bool> used(colors.size() + 1, false);
+            for (int neighborIdx : adjacent[cellIdx]) {
+                if (cellColors[neighborIdx] >= 0) used[cellColors[neighborIdx]] = true;
+            }
+            int color = find(used.begin(), used.end(), false) - used.begin();
+            if (color == colors.size()) colors.push_back(vector<int>());
+            cellColors[cellIdx] = color;
+            colors[color].push_back(cellIdx);
+        }
+
+        // Keep the original cell order within a color
+        for (vector<int> &color : colors) {
+            sort(color.begin(), color.end());
+        }
+        return colors;
+    }
+
     /*
      * startOverlappingCellSegmentationThread is the main function that finds the final cell boundaries on a clump
      * We run the Distance Regulated Level Set Evolution (DRLSE) Algortithm.
      * We check every 50 loops or iterations for convergence
+     * Clumps with at least parallelCellThreshold cells update their cells in parallel. Cells are grouped by
+     * colorCells and the cells of one color are updated at the same time, since updatePhi only reads the phi
+     * of neighboring cells. The colors are updated one after another like the cells are in sequential mode.
      */
     void startOverlappingCellSegmentationThread(Image *image, Clump *clump, int clumpIdx,
                                                 double dt, double epsilon, double mu, double kappa, double chi) {
-        int cellsConverged = 0;
+        atomic<int> cellsConverged(0);
 
         // Mark as converged if clump only has one cell
         if (clumpHasSingleCell(clump)) cellsConverged = clump->cells.size();
 
+        bool parallel = clump->cells.size() >= parallelCellThreshold && ThreadPool::getInstance().getNumThreads() > 1;
+        vector<vector<int>> colors;
+        if (parallel) {
+            colors = colorCells(clump);
+            image->log(LOG_DEBUG, "Clump %d, updating %zu cells in parallel with %zu colors\n", clumpIdx, clump->cells.size(), colors.size());
+        } else {
+            colors.push_back(vector<int>());
+            for (int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) colors[0].push_back(cellIdx);
+        }
+
         int i = 0;
-        while (cellsConverged < clump->cells.size()) {
-            for (unsigned int cellIdxI = 0; cellIdxI < clump->cells.size(); cellIdxI++) {
-                Cell *cellI = &clump->cells[cellIdxI];
+        auto updateCell = [image, &clump, clumpIdx, &i, &cellsConverged, dt, epsilon, mu, kappa, chi](int cellIdxI) {
+            Cell *cellI = &clump->cells[cellIdxI];
 
-                if (cellI->phiConverged) {
-                    continue;
-                }
+            if (cellI->phiConverged) {
+                return;
+            }
+
+            // Update phi per DRLSE
+            drlse::updatePhi(cellI, clump, dt, epsilon, mu, kappa, chi);
 
-                // Update phi per DRLSE
-                drlse::updatePhi(cellI, clump, dt, epsilon, mu, kappa, chi);
+            //cout << "LSF Iteration " << i << ": Clump " << clumpIdx << ", Cell " << cellIdxI << endl;
 
-                //cout << "LSF Iteration " << i << ": Clump " << clumpIdx << ", Cell " << cellIdxI << endl;
+            // Check every 50 iterations if the cell has converged
+            if (i != 0 && i % 50 == 0) {
+                // Clump has converged or iterations have exceeded 1000
+                if (isConverged(cellI) || i >= 1000) {
+                    cellsConverged++;
+                    cellI->finalContour = cellI->getPhiContour();
+                    image->log(LOG_DEBUG, "Clump %d, cell %d converged\n", clumpIdx, cellIdxI);
+                }
+            }
+        };
 
-                // Check every 50 iterations if the cell has converged
-                if (i != 0 && i % 50 == 0) {
-                    // Clump has converged or iterations have exceeded 1000
-                    if (isConverged(cellI) || i >= 1000) {
-                        cellsConverged++;
-                        cellI->finalContour = cellI->getPhiContour();
-                        cout << "converged" << endl;
+        while (cellsConverged < clump->cells.size()) {
+            for (vector<int> &color : colors) {
+                if (parallel) {
+                    TaskGroup tasks;
+                    for (int cellIdxI : color) {
+                        tasks.run([&updateCell, cellIdxI, clumpIdx]() {
+                            // The task may run on a thread waiting on another clump, keep this clump on its spans
+                            TraceSpan span("updateCell", clumpIdx);
+                            updateCell(cellIdxI);
+                        });
+                    }
+                    tasks.wait();
+                } else {
+                    for (int cellIdxI : color) {
+                        updateCell(cellIdxI);
                     }
                 }
             }
@@ -87,60 +173,72 @@ namespace segment {
 
 
     /*
-     * saveFinalCellBoundaries saves each cell's final boundaries as contours to a JSON file
+     * saveFinalCellBoundaries appends each cell's final boundary and nuclei to cytoplasm ratio
+     * to the final cell checkpoint
      */
-    void saveFinalCellBoundaries(json &finalCellBoundaries, json &nucleiCytoRatios, Image *image, Clump *clump, int clumpIdx) {
+    void saveFinalCellBoundaries(CheckpointStore &finalCellBoundaries, Clump *clump, int clumpIdx) {
+        CheckpointRecord record;
         for (int cellIdx = 0; cellIdx < clump->cells.size(); cellIdx++) {
             Cell *cell = &(clump->cells[cellIdx]);
-            json finalCellBoundary;
-            for (cv::Point &point : cell->finalContour) {
-                finalCellBoundary.push_back({point.x, point.y});
-            }
-            finalCellBoundaries[clumpIdx][cellIdx] = finalCellBoundary;
-            nucleiCytoRatios[clumpIdx][cellIdx] = cell->nucleusArea / cell->phiArea;
+            record.contours.push_back(cell->finalContour);
+            record.values.push_back(cell->nucleusArea / cell->phiArea);
         }
+        finalCellBoundaries.append(clumpIdx, record);
+    }
 
-        //Write to JSON file every 100 clumps or when the clump is big
-        if (clumpIdx % 100 == 0 || clump->cells.size() > 3000) {
-            image->writeJSON("finalCellBoundaries", finalCellBoundaries);
-            image->writeJSON("nucleiCytoRatios", nucleiCytoRatios);
+    /*
+     * loadFinalCellBoundaries loads a clump's final cell boundaries from the checkpoint into memory
+     * A record without exactly one boundary per cell is discarded and the boundaries are recomputed
+     */
+    void loadFinalCellBoundaries(const CheckpointStore &finalCellBoundaries, Clump *clump, int clumpIdx) {
+        CheckpointRecord record;
+        if (!finalCellBoundaries.load(clumpIdx, record)) return;
+        // The checkpoint does not belong to this clump
+        if (record.contours.size() != clump->cells.size()) return;
+        for (int cellIdx = 0; cellIdx < record.contours.size(); cellIdx++) {
+            Cell *cell = &clump->cells[cellIdx];
+            cell->finalContour = record.contours[cellIdx];
+            cell->phiArea = cv::contourArea(cell->finalContour);
         }
+        clump->finalCellContoursLoaded = true;
     }
 
     /*
-     * loadInitialCellBoundaries loads final cell boundaries from a JSON file into memory
+     * startOverlappingCellSegmentation finds the final cell boundaries of a single clump
+     * The boundaries are loaded from the checkpoint if they were saved before. Clumps without cells are skipped.
      */
-    void loadFinalCellBoundaries(json &finalCellBoundaries, Image *image, vector<Clump> *clumps) {
-        finalCellBoundaries = image->loadJSON("finalCellBoundaries");
-        for (int clumpIdx = 0; clumpIdx < finalCellBoundaries.size(); clumpIdx++) {
-            Clump *clump = &(*clumps)[clumpIdx];
-            json jsonClumpContours = finalCellBoundaries[clumpIdx];
-            if (jsonClumpContours == nullptr) continue;
-
-            int jsonNumberCells = finalCellBoundaries[clumpIdx].size();
-            for (int cellIdx = 0; cellIdx < jsonNumberCells; cellIdx++) {
-                json jsonCellContour = finalCellBoundaries[clumpIdx][cellIdx];
-                // Will not load incomplete clumps
-                if (jsonCellContour == nullptr) continue;
-                vector<cv::Point> contour;
-                for (json &jsonPoint : jsonCellContour) {
-                    int x = jsonPoint[0];
-                    int y = jsonPoint[1];
-                    cv::Point point = cv::Point(x, y);
-                    contour.push_back(point);
-                }
-                Cell *cell = &clump->cells[cellIdx];
-                cell->finalContour = contour;
-                cell->phiArea = cv::contourArea(contour);
-                // Clump cyto boundaries are fully loaded
-                if (cellIdx == jsonNumberCells - 1) {
-                    clump->finalCellContoursLoaded = true;
-                }
-            }
+    void startOverlappingCellSegmentation(Image *image, Clump *clump, int clumpIdx,
+                                          const CheckpointStore &finalCellBoundaries,
+                                          double dt, double epsilon, double mu, double kappa, double chi) {
+        if (clump->cells.empty()) return;
 
+        // Do not run the level set algorithm if the final contours have been loaded from file
+        loadFinalCellBoundaries(finalCellBoundaries, clump, clumpIdx);
+        if (clump->finalCellContoursLoaded) {
+            image->log(LOG_DEBUG, "Loaded clump %u final cell boundaries from file\n", clumpIdx);
+            return;
         }
+
+        image->log(LOG_DEBUG, "Calculating clump %u's edge enforcer and clump prior\n", clumpIdx);
+        // Pad the edge enforcer, clump prior and the cells' phi so that the level set algorithm
+        // will not distort any cells that happen to be at the boundary of the image
+        clump->edgeEnforcer = drlse::calcEdgeEnforcer(padMatrix(clump->extract(image->readPlaneRegion(PLANE_GRAY, clump->boundingRect)), cv::Scalar(255)));
+        clump->clumpPrior = padMatrix(clump->calcClumpPrior(), cv::Scalar(255, 255, 255));
+
+        // Run the level set algorithm
+        startOverlappingCellSegmentationThread(image, clump, clumpIdx, dt, epsilon, mu, kappa, chi);
     }
-    
+
+    /*
+     * saveOverlappingCellSegmentation saves a clump's final cell boundaries and nuclei to cytoplasm ratios
+     * if they weren't loaded from the checkpoint
+     */
+    void saveOverlappingCellSegmentation(CheckpointStore &finalCellBoundaries, Clump *clump, int clumpIdx) {
+        if (!clump->finalCellContoursLoaded && !clump->cells.empty()) {
+            saveFinalCellBoundaries(finalCellBoundaries, clump, clumpIdx);
+        }
+    }
+
     /*
      * runOverlappingSegmentation is the main function that finds the final cell boundaries for the image
      * This function spawns multiple threads for each clump that finds the final cell boundaries.
@@ -148,41 +246,22 @@ namespace segment {
     void runOverlappingSegmentation(Image *image, double dt, double epsilon, double mu, double kappa, double chi) {
         vector<Clump> *clumps = &image->clumps;
 
-        json finalCellBoundaries;
-        json nucleiCytoRatios;
-
-        // Load final cell boundaries from finalCellBoundaries.json if it exists
-        loadFinalCellBoundaries(finalCellBoundaries, image, clumps);
+        // The threads load clumps from the records of a previous run while the done function appends new ones
+        CheckpointStore finalCellBoundaries(image->getCheckpointPath("finalCellBoundaries"), image->useCache);
 
-        function<void(Clump *, int)> threadFunction = [&image, &dt, &epsilon, &mu, &kappa, &chi](Clump *clump, int clumpIdx) {
-            // Do not run the level set algorithm if the final contours have been loaded from file
-            if (clump->finalCellContoursLoaded) {
-                image->log("Loaded clump %u final cell boundaries from file\n", clumpIdx);
-                return;
-            }
-
-            image->log("Calculating clump %u's edge enforcer and clump prior\n", clumpIdx);
-            // Pad the edge enforcer, clump prior and the cells' phi so that the level set algorithm
-            // will not distort any cells that happen to be at the boundary of the image
-            clump->edgeEnforcer = drlse::calcEdgeEnforcer(padMatrix(clump->extract(), cv::Scalar(255, 255, 255)));
-            clump->clumpPrior = padMatrix(clump->calcClumpPrior(), cv::Scalar(255, 255, 255));
-
-            // Run the level set algorithm
-            startOverlappingCellSegmentationThread(image, clump, clumpIdx, dt, epsilon, mu, kappa, chi);
+        function<void(Clump *, int)> threadFunction = [&image, &finalCellBoundaries, &dt, &epsilon, &mu, &kappa, &chi](Clump *clump, int clumpIdx) {
+            startOverlappingCellSegmentation(image, clump, clumpIdx, finalCellBoundaries,
+                                             dt, epsilon, mu, kappa, chi);
         };
 
-        function<void(Clump *, int)> threadDoneFunction = [&finalCellBoundaries, &nucleiCytoRatios, &image](Clump *clump, int clumpIdx) {
-            if (!clump->finalCellContoursLoaded) {
-                saveFinalCellBoundaries(finalCellBoundaries, nucleiCytoRatios, image, clump, clumpIdx);
-            }
+        function<void(Clump *, int)> threadDoneFunction = [&finalCellBoundaries](Clump *clump, int clumpIdx) {
+            saveOverlappingCellSegmentation(finalCellBoundaries, clump, clumpIdx);
         };
 
-        int maxThreads = 16;
-        // Spawns threads that run the thread function for each clump
-        ClumpsThread(maxThreads, clumps, threadFunction, threadDoneFunction);
+        // Runs the thread function for each clump on the thread pool
+        ClumpsThread(clumps, OVERLAPPING_CELL_SEGMENTATION, threadFunction, threadDoneFunction);
 
-        image->writeJSON("finalCellBoundaries", finalCellBoundaries);
-        image->writeJSON("nucleiCytoRatios", nucleiCytoRatios);
+        finalCellBoundaries.flush();
     }
 
-}
\ No newline at end of file
+}
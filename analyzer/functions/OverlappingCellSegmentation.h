@@ -2,6 +2,7 @@
 #define OVERLAPPINGCELLSEGMENTATION_H
 
 #include "../objects/Clump.h"
+#include "../objects/CheckpointStore.h"
 
 namespace segment {
     /*
@@ -15,9 +16,17 @@ namespace segment {
 
     bool clumpHasSingleCell(Clump *clump);
 
+    vector<vector<int>> colorCells(Clump *clump);
+
     void startOverlappingCellSegmentationThread(Image *image, Clump *clump, int clumpIdx,
                                                 double dt, double epsilon, double mu, double kappa, double chi);
 
+    void startOverlappingCellSegmentation(Image *image, Clump *clump, int clumpIdx,
+                                          const CheckpointStore &finalCellBoundaries,
+                                          double dt, double epsilon, double mu, double kappa, double chi);
+
+    void saveOverlappingCellSegmentation(CheckpointStore &finalCellBoundaries, Clump *clump, int clumpIdx);
+
     void runOverlappingSegmentation(Image *image, double dt, double epsilon, double mu, double kappa, double chi);
 
     void updatePhi(Cell *cellI, Clump *clump, double dt, double epsilon, double mu, double kappa, double chi);
@@ -1,13 +1,21 @@
-#include <thread>
-#include <future>
 #include <chrono>
 #include "../objects/Image.h"
 #include "../objects/SubImage.h"
+#include "../objects/ThreadPool.h"
+#include "../objects/Trace.h"
+#include "../objects/MemoryBudget.h"
 #include "ClumpSegmentation.h"
 
 using namespace std;
 
 namespace segment {
+    // Approximate memory used per pixel of a subimage by quickshift, edge detection and GMM
+    const size_t TILE_BYTES_PER_PIXEL = 96;
+    // Minimum margin in pixels around a coarse clump that is refined at full resolution
+    const int COARSE_ROI_MARGIN = 32;
+    // Padding of the preprocessing tiles as a fraction of their size, clumps on the border of two tiles are found whole
+    const double TILE_PADDING = 0.30;
+
     /*
      * startPreprocessingThread is the main function that finds a mask of the clumps of an image
      * This function takes in a subimage of the image.
@@ -17,14 +25,20 @@ namespace segment {
      * 3) Compute Convex Hulls
      * 4) Gaussian Mixture Modeling
      */
-    SubImage startProcessingThread(Image *image, SubImage subImage, int kernelsize, int maxDist, int threshold1, int threshold2, int maxGmmIterations) {
+    SubImage startProcessingThread(Image *image, SubImage subImage, int kernelsize, int maxDist, string quickshift, int threshold1, int threshold2, int maxGmmIterations, string gmm) {
         bool debug = true;
+        TraceSpan span("startProcessingThread");
         auto start = chrono::high_resolution_clock::now();
         double end;
 
         if (debug) image->log("Beginning quickshift...\n");
 
-        cv::Mat postQuickShift = runQuickshift(&(subImage.mat), kernelsize, maxDist);
+        TraceSpan quickshiftSpan("runQuickshift");
+        // The superpixel gmm is trained on the trees quickshift finds
+        cv::Mat roots;
+        cv::Mat postQuickShift = runQuickshift(&(subImage.mat), kernelsize, maxDist, quickshift,
+                                               gmm == "superpixels" ? &roots : nullptr);
+        quickshiftSpan.end();
 
         end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
@@ -33,7 +47,9 @@ namespace segment {
         start = chrono::high_resolution_clock::now();
         if (debug) image->log("Beginning Edge Detection...\n");
 
+        TraceSpan cannySpan("runCanny");
         cv::Mat postEdgeDetection = runCanny(postQuickShift, threshold1, threshold2, true);
+        cannySpan.end();
         //image.writeImage("edgeDetectedEroded_cyto.png", postEdgeDetection);
 
         end = std::chrono::duration_cast<std::chrono::microseconds>(
@@ -43,6 +59,7 @@ namespace segment {
         start = chrono::high_resolution_clock::now();
         if (debug) image->log("Beginning CCA and building convex hulls...\n");
 
+        TraceSpan convexHullsSpan("runFindConvexHulls");
         // find contours
         vector <vector<cv::Point>> contours;
 
@@ -50,6 +67,7 @@ namespace segment {
 
         // find convex hulls
         vector <vector<cv::Point>> hulls = runFindConvexHulls(contours);
+        convexHullsSpan.end();
 
         end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
@@ -58,7 +76,16 @@ namespace segment {
         start = chrono::high_resolution_clock::now();
         if (debug) image->log("Beginning Gaussian Mixture Modeling...\n");
 
-        cv::Mat gmmPredictions = runGmm(&(subImage.mat), hulls, maxGmmIterations);
+        TraceSpan gmmSpan("runGmm");
+        cv::Mat gmmPredictions;
+        if (gmm == "histogram") {
+            gmmPredictions = runHistogramGmm(&(subImage.mat), hulls, maxGmmIterations);
+        } else if (gmm == "superpixels") {
+            gmmPredictions = runSuperpixelGmm(&(subImage.mat), roots, hulls, maxGmmIterations);
+        } else {
+            gmmPredictions = runGmm(&(subImage.mat), hulls, maxGmmIterations);
+        }
+        gmmSpan.end();
 
         end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
@@ -70,74 +97,246 @@ namespace segment {
     }
 
     /*
-     * runPreprocessing is the main function that finds a mask of the clumps of the image
-     * This function spawns multiple threads for each subimage that finds the mask of the clumps of the image.
+     * processSubImages runs startProcessingThread on each subimage on the thread pool
+     * Subimages are started while their predicted memory fits in the memory budget, a subimage is
+     * always started when no other subimage is running.
+     * Subimages without pixels are read with Image::readRegion when they start and released when they finish,
+     * so only the running subimages are in memory.
+     * Returns the processed subimages in the same order, their mats are the gmm predictions
      */
-    cv::Mat runPreprocessing(Image *image, int kernelsize, int maxdist, int threshold1, int threshold2, int maxGmmIterations) {
-        //Number of horizontal and vertical subimages
-        //Total number of subimages is subMatNumX * subMatNumY
-        const int subMatNumX = 1;
-        const int subMatNumY = 1;
-        const int numThreads = 16;
-
-        cv::Mat *mat = &image->mat;
-        //Percentage of overlap padding between subimages
-        double paddingWidth = 0.30;
-        double paddingHeight = 0.30;
-        vector<SubImage> subImages = splitMat(mat, subMatNumX, subMatNumY, paddingWidth, paddingHeight);
-        cv::Mat returnMatrixArray[subMatNumX][subMatNumY];
+    vector<SubImage> processSubImages(Image *image, vector<SubImage> &subImages, int kernelsize, int maxdist, string quickshift, int threshold1, int threshold2, int maxGmmIterations, string gmm) {
+        vector<SubImage> processedSubImages(subImages);
+        ThreadPool &pool = ThreadPool::getInstance();
+        MemoryBudget &budget = MemoryBudget::getInstance();
+        mutex lock;
+        condition_variable subImageDone;
+        int subImagesRunning = 0;
+        exception_ptr error;
+
+        unique_lock<mutex> guard(lock);
+        for (unsigned int k = 0; k < subImages.size(); k++) {
+            SubImage *subImage = &subImages[k];
+            SubImage *processed = &processedSubImages[k];
+            size_t memory = subImage->getRect().area() * TILE_BYTES_PER_PIXEL;
+            // The memory is only reserved once the wait is over, other images can take the budget in between
+            // so the wait is repeated until the reservation succeeds
+            bool reserved = false;
+            while (!error && !reserved) {
+                pool.waitUntil(guard, subImageDone, [&budget, &error, &subImagesRunning, memory]() {
+                    return error || subImagesRunning == 0 || budget.fits(memory);
+                });
+                if (!error) reserved = budget.tryReserve(memory, subImagesRunning == 0);
+            }
+            if (error) break;
+            subImagesRunning++;
+            pool.submit([image, subImage, processed, kernelsize, maxdist, quickshift, threshold1, threshold2, maxGmmIterations, gmm,
+                         memory, &budget, &lock, &subImageDone, &subImagesRunning, &error]() {
+                exception_ptr subImageError;
+                try {
+                    SubImage tile = *subImage;
+                    if (tile.mat.empty()) {
+                        TraceSpan span("readTile");
+                        tile.mat = image->readRegion(tile.getRect() + tile.origin);
+                    }
+                    *processed = startProcessingThread(image, tile, kernelsize, maxdist, quickshift, threshold1, threshold2, maxGmmIterations, gmm);
+                } catch (...) {
+                    subImageError = current_exception();
+                }
+                budget.release(memory);
+                lock_guard<mutex> guard(lock);
+                if (subImageError && !error) error = subImageError;
+                subImagesRunning--;
+                subImageDone.notify_all();
+            });
+        }
+        pool.waitUntil(guard, subImageDone, [&subImagesRunning]() { return subImagesRunning == 0; });
+        guard.unlock();
+        if (error) {
+            rethrow_exception(error);
+        }
+        return processedSubImages;
+    }
 
-        auto start = chrono::high_resolution_clock::now();
+    /*
+     * fitTiles reduces the number of tiles along a side of length until splitMat leaves none of them empty
+     */
+    static int fitTiles(int tiles, int length) {
+        tiles = max(1, min(tiles, length));
+        while (tiles > 1 && (tiles - 1) * (int) ceil(length / (double) tiles) >= length) {
+            tiles--;
+        }
+        return tiles;
+    }
 
-        // Below is similar to ClumpThread, but runs on a list of SubImages instead of Clumps
-        vector<shared_future<SubImage>> allThreads;
+    /*
+     * getPreprocessingTiles returns the number of horizontal and vertical tiles an image is preprocessed in
+     * size: size of the image
+     * tilesX, tilesY: number of tiles
+     * tileSize: if more than 0, the tiles are chosen from the size of the image so no tile is larger than tileSize
+     * and tilesX and tilesY are ignored. The tiles only depend on the image and the options, so the masks and
+     * their cache keys are the same on every machine, the number of threads only changes how many tiles run at once.
+     */
+    cv::Size getPreprocessingTiles(cv::Size size, int tilesX, int tilesY, int tileSize) {
+        if (tileSize > 0) {
+            tilesX = (int) ceil(size.width / (double) tileSize);
+            tilesY = (int) ceil(size.height / (double) tileSize);
+        }
+        return cv::Size(fitTiles(tilesX, size.width), fitTiles(tilesY, size.height));
+    }
 
-        do {
-            // Fill thread queue
-            while (allThreads.size() < numThreads && subImages.size() > 0) {
-                SubImage subImage = subImages.front();
-                subImages.erase(subImages.begin());
-                shared_future<SubImage> thread_object = async(&startProcessingThread, image, subImage, kernelsize, maxdist, threshold1, threshold2, maxGmmIterations);
-                allThreads.push_back(thread_object);
+    /*
+     * stitchSubImages combines the gmm predictions of the subimages into a mask of the whole image
+     * Each clump is taken whole, padding included, from the subimage whose core contains its centroid.
+     * A clump crossing the border of two subimages is found by both, but only one of them keeps it,
+     * so it is neither cut at the border nor stitched together from two different predictions.
+     * Clumps wider than the padding can still be cut by the edge of the padded subimage.
+     */
+    static cv::Mat stitchSubImages(cv::Size size, vector<SubImage> &subImages) {
+        cv::Mat fullMat = cv::Mat::zeros(size, CV_8UC1);
+        for (SubImage &subImage : subImages) {
+            cv::Rect rect = subImage.getRect();
+            cv::Rect core = subImage.getCoreRect();
+            cv::Mat labels, stats, centroids;
+            int count = cv::connectedComponentsWithStats(subImage.mat, labels, stats, centroids, 8, CV_32S);
+            vector<bool> owned(count, false);
+            for (int label = 1; label < count; label++) {
+                cv::Point centroid(rect.x + (int) centroids.at<double>(label, 0),
+                                   rect.y + (int) centroids.at<double>(label, 1));
+                owned[label] = core.contains(centroid);
             }
 
-            // Wait for a thread to finish
-            auto timeout = std::chrono::milliseconds(10);
-            for (int i = 0; i < allThreads.size(); i++) {
-                shared_future<SubImage> thread = allThreads[i];
-                if (thread.valid() && thread.wait_for(timeout) == future_status::ready) {
-                    SubImage subImage = thread.get();
-                    allThreads.erase(allThreads.begin() + i);
-                    cv::Mat cropped = subImage.undoPadding();
-                    returnMatrixArray[subImage.i][subImage.j] = cropped;
-                    break;
+            cv::Mat out = fullMat(rect);
+            for (int row = 0; row < out.rows; row++) {
+                const int *rowLabels = labels.ptr<int>(row);
+                const uchar *in = subImage.mat.ptr<uchar>(row);
+                uchar *outRow = out.ptr<uchar>(row);
+                for (int col = 0; col < out.cols; col++) {
+                    if (owned[rowLabels[col]]) {
+                        outRow[col] = max(outRow[col], in[col]);
+                    }
                 }
             }
+        }
+        return fullMat;
+    }
 
-        } while(allThreads.size() > 0 || subImages.size() > 0);
+    /*
+     * runPreprocessing is the main function that finds a mask of the clumps of the image
+     * The image is split into overlapping tiles that are preprocessed in parallel on the thread pool,
+     * see getPreprocessingTiles, and the clumps found are stitched back together by stitchSubImages.
+     * Each tile is read with Image::readRegion when it starts, so a TIFF that isn't in memory is decoded tile by tile.
+     * Nothing is written, the caller saves the mask under the name of its run
+     * tiles: number of horizontal and vertical tiles
+     */
+    cv::Mat runPreprocessing(Image *image, cv::Size tiles, int kernelsize, int maxdist, string quickshift, int threshold1, int threshold2, int maxGmmIterations, string gmm) {
+        cv::Size size = image->getSize();
+        vector<SubImage> subImages = splitRegion(cv::Rect(cv::Point(), size), tiles.width, tiles.height, TILE_PADDING, TILE_PADDING);
+        image->log("Preprocessing in %i x %i tiles\n", tiles.width, tiles.height);
 
-        // Stich the subimages back together
-        cv::Mat verticalMatrices[subMatNumX];
-        for (int i = 0; i < subMatNumX; i++) {
-            cv::Mat verticalMatrix;
-            cv::vconcat(returnMatrixArray[i], subMatNumY, verticalMatrix);
-            verticalMatrices[i] = verticalMatrix;
-        }
-        cv::Mat fullMat;
-        cv::hconcat(verticalMatrices, subMatNumX, fullMat);
+        auto start = chrono::high_resolution_clock::now();
+
+        vector<SubImage> processedSubImages = processSubImages(image, subImages, kernelsize, maxdist, quickshift, threshold1, threshold2, maxGmmIterations, gmm);
+        TraceSpan stitchSpan("stitchSubImages");
+        cv::Mat fullMat = stitchSubImages(size, processedSubImages);
+        stitchSpan.end();
 
         double end = std::chrono::duration_cast<std::chrono::microseconds>(
                 chrono::high_resolution_clock::now() - start).count() / 1000000.0;
-        printf("Preprocessing time: %f", end);
-
-        cv::Mat temp;
-        cv::threshold(fullMat, temp, 0, 256, CV_THRESH_BINARY);
-        image->writeImage("gmmPredictions.png", temp);
+        image->log(LOG_DEBUG, "Preprocessing time: %f\n", end);
 
         return fullMat;
     }
 
+    /*
+     * runCoarsePreprocessing finds the mask of the clumps of the image on a downsampled level of the image,
+     * then refines the mask at full resolution only around the clumps that were found.
+     * Most of a cytology image is background, so only a fraction of the pixels go through preprocessing
+     * at full resolution.
+     * pyramidLevel: the image is downsampled by 2^pyramidLevel, 2 for 1/4 and 3 for 1/8
+     * minAreaThreshold: clumps smaller than this at full resolution are not refined
+     * tileSize: regions larger than this are refined in tiles, see getPreprocessingTiles. 0 to refine each region whole
+     * Returns the mask of the clumps at full resolution, background outside the refined regions
+     */
+    cv::Mat runCoarsePreprocessing(Image *image, int pyramidLevel, double minAreaThreshold, int tileSize, int kernelsize, int maxdist, string quickshift, int threshold1, int threshold2, int maxGmmIterations, string gmm) {
+        auto start = chrono::high_resolution_clock::now();
+        int scale = 1 << pyramidLevel;
+
+        TraceSpan coarseSpan("runCoarsePreprocessing");
+        cv::Mat coarse = image->readPyramidLevel(pyramidLevel);
+        image->log("Finding clumps on pyramid level %i: (rows) %i (cols) %i\n", pyramidLevel, coarse.rows, coarse.cols);
+
+        vector<SubImage> coarseSubImages = splitMat(&coarse, 1, 1);
+        cv::Mat coarsePredictions = processSubImages(image, coarseSubImages, kernelsize, maxdist, quickshift, threshold1, threshold2, maxGmmIterations, gmm)[0].mat;
+        vector<vector<cv::Point>> coarseClumps = findFinalClumpBoundaries(coarsePredictions, minAreaThreshold / (scale * scale));
+        coarseSpan.end();
+
+        // Region around the coarse clumps the full resolution mask is kept in, this also removes
+        // anything the gmm finds at the edges of the regions of interest
+        int margin = max(COARSE_ROI_MARGIN, 4 * scale);
+        int coarseRadius = (int) ceil(margin / 2.0 / scale);
+        cv::Mat coarseMask = cv::Mat::zeros(coarse.size(), CV_8UC1);
+        cv::drawContours(coarseMask, coarseClumps, -1, 255, -1);
+        cv::dilate(coarseMask, coarseMask, cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * coarseRadius + 1, 2 * coarseRadius + 1)));
+        cv::Mat keepMask;
+        cv::resize(coarseMask, keepMask, image->getSize(), 0, 0, cv::INTER_NEAREST);
+        coarseMask.release();
+
+        // Regions of interest are the bounding boxes of the coarse clumps at full resolution with a margin,
+        // overlapping regions are merged so no pixel is processed twice
+        cv::Rect imageRect(cv::Point(), image->getSize());
+        vector<cv::Rect> rois;
+        for (vector<cv::Point> &clump : coarseClumps) {
+            cv::Rect rect = cv::boundingRect(clump);
+            rect = cv::Rect(rect.x * scale - margin, rect.y * scale - margin,
+                            rect.width * scale + 2 * margin, rect.height * scale + 2 * margin) & imageRect;
+            rois.push_back(rect);
+        }
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (unsigned int a = 0; a < rois.size() && !merged; a++) {
+                for (unsigned int b = a + 1; b < rois.size(); b++) {
+                    if ((rois[a] & rois[b]).area() > 0) {
+                        rois[a] |= rois[b];
+                        rois.erase(rois.begin() + b);
+                        merged = true;
+                        break;
+                    }
+                }
+            }
+        }
 
+        // Each region is read with Image::readRegion like the tiles of runPreprocessing, large regions are split
+        // into tiles like the whole image is. The subimages of every region are processed together on the thread pool.
+        double roiArea = 0;
+        vector<SubImage> subImages;
+        vector<size_t> roiSubImages;
+        for (cv::Rect &roi : rois) {
+            roiArea += roi.area();
+            cv::Size tiles = getPreprocessingTiles(roi.size(), 1, 1, tileSize);
+            vector<SubImage> roiTiles = splitRegion(roi, tiles.width, tiles.height, TILE_PADDING, TILE_PADDING);
+            subImages.insert(subImages.end(), roiTiles.begin(), roiTiles.end());
+            roiSubImages.push_back(roiTiles.size());
+        }
+        image->log("Refining %zu clump regions in %zu tiles at full resolution, %f%% of the image\n", rois.size(),
+                   subImages.size(), 100.0 * roiArea / ((double) imageRect.width * imageRect.height));
+
+        TraceSpan refineSpan("refineClumpRegions");
+        cv::Mat gmmPredictions = cv::Mat::zeros(image->getSize(), CV_8UC1);
+        vector<SubImage> processedSubImages = processSubImages(image, subImages, kernelsize, maxdist, quickshift, threshold1, threshold2, maxGmmIterations, gmm);
+        auto roiStart = processedSubImages.begin();
+        for (unsigned int k = 0; k < rois.size(); k++) {
+            vector<SubImage> roiTiles(roiStart, roiStart + roiSubImages[k]);
+            roiStart += roiSubImages[k];
+            cv::Mat roiPredictions = stitchSubImages(rois[k].size(), roiTiles);
+            cv::bitwise_and(roiPredictions, keepMask(rois[k]), gmmPredictions(rois[k]));
+        }
+        refineSpan.end();
 
+        double end = std::chrono::duration_cast<std::chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+        image->log(LOG_DEBUG, "Coarse preprocessing time: %f\n", end);
 
+        return gmmPredictions;
+    }
 }
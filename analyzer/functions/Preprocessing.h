@@ -7,8 +7,11 @@
 using namespace std;
 
 namespace segment {
-    vector<SubImage> startProcessingThread(Image *image, SubImage subImage, int kernelsize, int maxdist, int threshold1, int threshold2, int maxGmmIterations);
-    cv::Mat runPreprocessing(Image *image, int kernelsize, int maxdist, int threshold1, int threshold2, int maxGmmIterations);
+    SubImage startProcessingThread(Image *image, SubImage subImage, int kernelsize, int maxdist, string quickshift, int threshold1, int threshold2, int maxGmmIterations, string gmm);
+    vector<SubImage> processSubImages(Image *image, vector<SubImage> &subImages, int kernelsize, int maxdist, string quickshift, int threshold1, int threshold2, int maxGmmIterations, string gmm);
+    cv::Size getPreprocessingTiles(cv::Size size, int tilesX, int tilesY, int tileSize);
+    cv::Mat runPreprocessing(Image *image, cv::Size tiles, int kernelsize, int maxdist, string quickshift, int threshold1, int threshold2, int maxGmmIterations, string gmm);
+    cv::Mat runCoarsePreprocessing(Image *image, int pyramidLevel, double minAreaThreshold, int tileSize, int kernelsize, int maxdist, string quickshift, int threshold1, int threshold2, int maxGmmIterations, string gmm);
     cv::Mat crop(cv::Mat *mat, int x, int y, int width, int height, int paddingWidth, int paddingHeight);
 }
 #endif //PREPROCESSING_H
@@ -0,0 +1,210 @@
+#include "Quickshift.h"
+#include "../objects/ThreadPool.h"
+#include "../objects/Trace.h"
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+namespace segment {
+    // Color values are scaled like the image VLFeat was given, so the distances are the same
+    static const double QUICKSHIFT_SCALE = 1 / 255.0;
+    // Rows of the image each task of the thread pool processes
+    static const int QUICKSHIFT_BAND_ROWS = 16;
+
+    /*
+     * quickshiftDistance is the squared distance between two pixels in position and color, the same as VLFeat's
+     */
+    template<typename T, int CN>
+    static inline double quickshiftDistance(const T *a, const T *b, int dx, int dy) {
+        double dist = 0;
+        dist += dx * dx + dy * dy;
+        for (int k = 0; k < CN; k++) {
+            double d = a[k] * QUICKSHIFT_SCALE - b[k] * QUICKSHIFT_SCALE;
+            dist += d * d;
+        }
+        return dist;
+    }
+
+    /*
+     * forEachRowBand runs body on bands of rows of the image on the thread pool and waits for them
+     */
+    static void forEachRowBand(int rows, const function<void(int, int)> &body) {
+        TaskGroup tasks;
+        for (int rowStart = 0; rowStart < rows; rowStart += QUICKSHIFT_BAND_ROWS) {
+            int rowEnd = min(rows, rowStart + QUICKSHIFT_BAND_ROWS);
+            tasks.run([&body, rowStart, rowEnd]() {
+                body(rowStart, rowEnd);
+            });
+        }
+        tasks.wait();
+    }
+
+    /*
+     * computeQuickshiftRoots runs quickshift directly on the interleaved pixels of the image
+     * The density and the parents are computed in the same order and precision as VLFeat, so ties are broken
+     * the same way and the trees are identical. Only the density (8 bytes per pixel) and the parents
+     * (4 bytes per pixel) are allocated, the image isn't copied or transposed.
+     */
+    template<typename T, int CN>
+    static cv::Mat computeQuickshiftRoots(const cv::Mat &mat, double sigma, double tau, int *superpixels) {
+        int rows = mat.rows;
+        int cols = mat.cols;
+        int R = (int) ceil(3 * sigma);
+        int tR = (int) ceil(tau);
+        double tau2 = tau * tau;
+        double twoSigma2 = 2 * sigma * sigma;
+
+        // Parzen window estimate of the density of every pixel
+        cv::Mat density(rows, cols, CV_64FC1);
+        {
+            TraceSpan span("quickshiftDensity");
+            forEachRowBand(rows, [&mat, &density, rows, cols, R, twoSigma2](int rowStart, int rowEnd) {
+                for (int y = rowStart; y < rowEnd; y++) {
+                    const T *center = mat.ptr<T>(y);
+                    double *E = density.ptr<double>(y);
+                    int yMin = max(y - R, 0);
+                    int yMax = min(y + R, rows - 1);
+                    for (int x = 0; x < cols; x++) {
+                        int xMin = max(x - R, 0);
+                        int xMax = min(x + R, cols - 1);
+                        double e = 0;
+                        for (int ny = yMin; ny <= yMax; ny++) {
+                            const T *row = mat.ptr<T>(ny);
+                            for (int nx = xMin; nx <= xMax; nx++) {
+                                double dist = quickshiftDistance<T, CN>(center + x * CN, row + nx * CN, nx - x, ny - y);
+                                e += exp(-dist / twoSigma2);
+                            }
+                        }
+                        E[x] = e;
+                    }
+                }
+            });
+        }
+
+        // Each pixel's parent is the closest pixel within tau with a higher density, roots are their own parent
+        cv::Mat roots(rows, cols, CV_32SC1);
+        {
+            TraceSpan span("quickshiftParents");
+            forEachRowBand(rows, [&mat, &density, &roots, rows, cols, tR, tau2](int rowStart, int rowEnd) {
+                for (int y = rowStart; y < rowEnd; y++) {
+                    const T *center = mat.ptr<T>(y);
+                    int *parents = roots.ptr<int>(y);
+                    int yMin = max(y - tR, 0);
+                    int yMax = min(y + tR, rows - 1);
+                    for (int x = 0; x < cols; x++) {
+                        double E0 = density.ptr<double>(y)[x];
+                        double best = INFINITY;
+                        int parent = y * cols + x;
+                        int xMin = max(x - tR, 0);
+                        int xMax = min(x + tR, cols - 1);
+                        for (int ny = yMin; ny <= yMax; ny++) {
+                            const double *E = density.ptr<double>(ny);
+                            const T *row = mat.ptr<T>(ny);
+                            for (int nx = xMin; nx <= xMax; nx++) {
+                                if (E[nx] > E0) {
+                                    double dist = quickshiftDistance<T, CN>(center + x * CN, row + nx * CN, nx - x, ny - y);
+                                    if (dist <= tau2 && dist < best) {
+                                        best = dist;
+                                        parent = ny * cols + nx;
+                                    }
+                                }
+                            }
+                        }
+                        parents[x] = parent;
+                    }
+                }
+            });
+        }
+        density.release();
+
+        // Point every pixel directly at its root, the path walked from each pixel is compressed so
+        // every parent link is followed at most once
+        int *parents = (int *) roots.data;
+        int count = 0;
+        for (int p = 0; p < rows * cols; p++) {
+            int root = p;
+            while (parents[root] != root) {
+                root = parents[root];
+            }
+            int node = p;
+            while (parents[node] != root) {
+                int next = parents[node];
+                parents[node] = root;
+                node = next;
+            }
+            if (root == p) count++;
+        }
+        if (superpixels) *superpixels = count;
+        return roots;
+    }
+
+    cv::Mat quickshiftRoots(const cv::Mat &mat, double kernelSize, double maxDist, int *superpixels) {
+        TraceSpan span("quickshiftRoots");
+        switch (mat.type()) {
+            case CV_8UC1:
+                return computeQuickshiftRoots<uchar, 1>(mat, kernelSize, maxDist, superpixels);
+            case CV_8UC3:
+                return computeQuickshiftRoots<uchar, 3>(mat, kernelSize, maxDist, superpixels);
+            case CV_8UC4:
+                return computeQuickshiftRoots<uchar, 4>(mat, kernelSize, maxDist, superpixels);
+            case CV_32FC1:
+                return computeQuickshiftRoots<float, 1>(mat, kernelSize, maxDist, superpixels);
+            case CV_32FC3:
+                return computeQuickshiftRoots<float, 3>(mat, kernelSize, maxDist, superpixels);
+            case CV_32FC4:
+                return computeQuickshiftRoots<float, 4>(mat, kernelSize, maxDist, superpixels);
+            default:
+                throw invalid_argument("Quickshift only supports 8 bit and float images with 1, 3 or 4 channels");
+        }
+    }
+
+    /*
+     * Constructor for Superpixels
+     * roots: the root of each pixel's tree returned by quickshiftRoots, labels are given to the roots in row-major order
+     */
+    Superpixels::Superpixels(const cv::Mat &roots) {
+        int total = roots.rows * roots.cols;
+        const int *rootIdx = (const int *) roots.data;
+        this->labels = cv::Mat(roots.size(), CV_32SC1);
+        int *label = (int *) this->labels.data;
+        for (int p = 0; p < total; p++) {
+            if (rootIdx[p] == p) {
+                label[p] = this->count++;
+            }
+        }
+        this->sizes.assign(this->count, 0);
+        for (int p = 0; p < total; p++) {
+            label[p] = label[rootIdx[p]];
+            this->sizes[label[p]]++;
+        }
+    }
+
+    /*
+     * mean returns the mean of the pixels of each superpixel in mat, like its mean color
+     * Returns a count x channels CV_64FC1 matrix
+     */
+    cv::Mat Superpixels::mean(const cv::Mat &mat) {
+        int channels = mat.channels();
+        cv::Mat values;
+        mat.convertTo(values, CV_64F);
+        cv::Mat means = cv::Mat::zeros(this->count, channels, CV_64FC1);
+        for (int row = 0; row < values.rows; row++) {
+            const int *label = this->labels.ptr<int>(row);
+            const double *value = values.ptr<double>(row);
+            for (int col = 0; col < values.cols; col++) {
+                double *sum = means.ptr<double>(label[col]);
+                for (int c = 0; c < channels; c++) {
+                    sum[c] += value[col * channels + c];
+                }
+            }
+        }
+        for (int i = 0; i < this->count; i++) {
+            double *sum = means.ptr<double>(i);
+            for (int c = 0; c < channels; c++) {
+                sum[c] /= this->sizes[i];
+            }
+        }
+        return means;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef QUICKSHIFT_H
+#define QUICKSHIFT_H
+
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+
+namespace segment {
+    /*
+     * quickshiftRoots finds the quickshift tree of every pixel of an interleaved 8 bit or float image, 1, 3 or 4 channels
+     * The trees are the same as the ones of VLFeat's vl_quickshift_process on the image scaled by 1/255.
+     * Returns the row-major index of the root of each pixel's tree, CV_32SC1
+     * Params:
+     *  cv::Mat mat = the image, it may be a region of a larger image
+     *  double kernelSize = the sigma of the Parzen window the density is estimated with
+     *  double maxDist = the largest distance a pixel can be from its parent
+     *  int *superpixels = set to the number of trees if not null
+     */
+    cv::Mat quickshiftRoots(const cv::Mat &mat, double kernelSize, double maxDist, int *superpixels = nullptr);
+
+    /*
+     * Superpixels are the trees found by quickshift, each pixel is labeled with the tree it belongs to
+     */
+    class Superpixels {
+    public:
+        // Label of each pixel from 0 to count - 1, CV_32SC1
+        cv::Mat labels;
+        int count = 0;
+        // Number of pixels of each superpixel
+        vector<int> sizes;
+
+        Superpixels(const cv::Mat &roots);
+        cv::Mat mean(const cv::Mat &mat);
+    };
+}
+
+#endif //QUICKSHIFT_H
@@ -0,0 +1,206 @@
+#include "ArtifactWriter.h"
+#include "Trace.h"
+#include <chrono>
+#include <stdexcept>
+
+using namespace std;
+
+namespace segment {
+    // Number of writer threads and size of the queue in bytes the writer is created with
+    static int writerThreads = 2;
+    static size_t writerQueueBytes = (size_t) 256 << 20;
+
+    /*
+     * Constructor for ArtifactWriter
+     * numThreads: number of threads encoding images, 0 to encode on the calling thread
+     * maxQueuedBytes: bytes of images that may wait to be encoded, an image is always queued if the queue is empty
+     */
+    ArtifactWriter::ArtifactWriter(int numThreads, size_t maxQueuedBytes) {
+        this->maxQueuedBytes = maxQueuedBytes;
+        for (int i = 0; i < numThreads; i++) {
+            this->threads.push_back(thread(&ArtifactWriter::runWriter, this));
+        }
+    }
+
+    /*
+     * The destructor writes the queued images before stopping the threads
+     */
+    ArtifactWriter::~ArtifactWriter() {
+        {
+            lock_guard<mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->jobReady.notify_all();
+        for (thread &writer : this->threads) {
+            writer.join();
+        }
+    }
+
+    /*
+     * getInstance returns the process wide writer, it is created on first use
+     */
+    ArtifactWriter &ArtifactWriter::getInstance() {
+        static ArtifactWriter writer(writerThreads, writerQueueBytes);
+        return writer;
+    }
+
+    /*
+     * setNumThreads sets the number of writer threads, it must be called before the writer is first used
+     */
+    void ArtifactWriter::setNumThreads(int numThreads) {
+        writerThreads = numThreads;
+    }
+
+    /*
+     * setQueueLimit sets the bytes of images that may be queued, it must be called before the writer is first used
+     */
+    void ArtifactWriter::setQueueLimit(size_t bytes) {
+        writerQueueBytes = bytes;
+    }
+
+    /*
+     * setFormat sets the codec images are written with
+     * format: png, jpg or webp
+     * compression: PNG compression level 0-9, or JPEG and WebP quality 0-100, -1 for the codec's default
+     * Throws an invalid_argument for other formats
+     */
+    void ArtifactWriter::setFormat(string format, int compression) {
+        vector<int> params;
+        if (format == "png") {
+            if (compression >= 0) params = {cv::IMWRITE_PNG_COMPRESSION, min(compression, 9)};
+        } else if (format == "jpg") {
+            if (compression >= 0) params = {cv::IMWRITE_JPEG_QUALITY, min(compression, 100)};
+        } else if (format == "webp") {
+            if (compression >= 0) params = {cv::IMWRITE_WEBP_QUALITY, max(1, min(compression, 100))};
+        } else {
+            throw invalid_argument("Unknown image format: " + format);
+        }
+        lock_guard<mutex> guard(this->lock);
+        this->format = format;
+        this->params = params;
+    }
+
+    /*
+     * getExtension returns the extension of the images that are written, including the dot
+     */
+    string ArtifactWriter::getExtension() {
+        lock_guard<mutex> guard(this->lock);
+        return "." + this->format;
+    }
+
+    /*
+     * write queues an image to be encoded to path
+     * Waits while the queue is full, the image is encoded right away if there are no writer threads
+     */
+    void ArtifactWriter::write(string path, cv::Mat &&mat) {
+        Job job;
+        job.path = move(path);
+        job.mat = move(mat);
+        submit(move(job));
+    }
+
+    /*
+     * write queues an image to be encoded in memory, encoded is called with the bytes on the writer thread
+     * encoded gets an empty buffer if the image can't be encoded
+     */
+    void ArtifactWriter::write(cv::Mat &&mat, function<void(vector<uchar> &)> encoded) {
+        Job job;
+        job.mat = move(mat);
+        job.encoded = move(encoded);
+        submit(move(job));
+    }
+
+    void ArtifactWriter::submit(Job &&job) {
+        if (this->threads.empty()) {
+            encode(job);
+            return;
+        }
+
+        size_t bytes = job.mat.total() * job.mat.elemSize();
+        unique_lock<mutex> guard(this->lock);
+        if (this->queuedBytes > 0 && this->queuedBytes + bytes > this->maxQueuedBytes) {
+            auto start = chrono::high_resolution_clock::now();
+            this->jobDone.wait(guard, [this, bytes]() {
+                return this->queuedBytes == 0 || this->queuedBytes + bytes <= this->maxQueuedBytes;
+            });
+            this->stats.waitSeconds += chrono::duration_cast<chrono::microseconds>(
+                    chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+        }
+        this->jobs.push_back(move(job));
+        this->queuedBytes += bytes;
+        this->stats.maxBacklog = max(this->stats.maxBacklog, this->jobs.size());
+        guard.unlock();
+        this->jobReady.notify_one();
+    }
+
+    /*
+     * flush waits until every queued image is written
+     */
+    void ArtifactWriter::flush() {
+        unique_lock<mutex> guard(this->lock);
+        this->jobDone.wait(guard, [this]() { return this->jobs.empty() && this->running == 0; });
+    }
+
+    ArtifactWriterStats ArtifactWriter::getStats() {
+        lock_guard<mutex> guard(this->lock);
+        return this->stats;
+    }
+
+    void ArtifactWriter::runWriter() {
+        unique_lock<mutex> guard(this->lock);
+        while (true) {
+            this->jobReady.wait(guard, [this]() { return this->stopping || !this->jobs.empty(); });
+            if (this->jobs.empty()) return;
+            Job job = move(this->jobs.front());
+            this->jobs.pop_front();
+            this->running++;
+            guard.unlock();
+
+            encode(job);
+
+            guard.lock();
+            this->queuedBytes -= job.mat.total() * job.mat.elemSize();
+            this->running--;
+            this->jobDone.notify_all();
+        }
+    }
+
+    /*
+     * encode writes an image with the current codec and adds the time it took to the stats
+     */
+    void ArtifactWriter::encode(const Job &job) {
+        TraceSpan span("encodeArtifact");
+        vector<int> params;
+        string extension;
+        {
+            lock_guard<mutex> guard(this->lock);
+            params = this->params;
+            extension = "." + this->format;
+        }
+        auto start = chrono::high_resolution_clock::now();
+        if (job.encoded) {
+            vector<uchar> buffer;
+            try {
+                if (!cv::imencode(extension, job.mat, buffer, params)) buffer.clear();
+            } catch (const cv::Exception &e) {
+                cerr << "Could not encode image: " << e.what() << endl;
+                buffer.clear();
+            }
+            job.encoded(buffer);
+        } else {
+            try {
+                if (!cv::imwrite(job.path, job.mat, params)) {
+                    cerr << "Could not write image: " << job.path << endl;
+                }
+            } catch (const cv::Exception &e) {
+                cerr << "Could not write image: " << job.path << ": " << e.what() << endl;
+            }
+        }
+        double seconds = chrono::duration_cast<chrono::microseconds>(
+                chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+
+        lock_guard<mutex> guard(this->lock);
+        this->stats.written++;
+        this->stats.encodeSeconds += seconds;
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef ARTIFACTWRITER_H
+#define ARTIFACTWRITER_H
+
+#include "opencv2/opencv.hpp"
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <functional>
+
+using namespace std;
+
+namespace segment {
+    class ArtifactWriterStats {
+    public:
+        // Number of images encoded and written
+        size_t written = 0;
+        // Most images waiting to be encoded at once
+        size_t maxBacklog = 0;
+        // Time in seconds the writer threads spent encoding and writing
+        double encodeSeconds = 0;
+        // Time in seconds callers waited for room in the queue
+        double waitSeconds = 0;
+    };
+
+    /*
+     * ArtifactWriter is the process wide pool of threads that encode and write the result images
+     * (boundary renders, thumbnails) so the segmentation doesn't wait on image compression.
+     * Images can also be encoded in memory and handed to a callback, for containers like the ThumbnailPack.
+     * Images are queued by move and are not copied, they must not be modified after being written.
+     * The queue is bounded by the bytes of the queued images, writers block while it is full.
+     * With no threads images are encoded on the calling thread.
+     */
+    class ArtifactWriter {
+    private:
+        class Job {
+        public:
+            string path;
+            cv::Mat mat;
+            // Called with the encoded bytes instead of writing them to path if set
+            function<void(vector<uchar> &)> encoded;
+        };
+
+        deque<Job> jobs;
+        vector<thread> threads;
+        mutex lock;
+        condition_variable jobReady;
+        condition_variable jobDone;
+        size_t maxQueuedBytes;
+        size_t queuedBytes = 0;
+        int running = 0;
+        bool stopping = false;
+        string format = "png";
+        vector<int> params;
+        ArtifactWriterStats stats;
+
+        ArtifactWriter(int numThreads, size_t maxQueuedBytes);
+        void submit(Job &&job);
+        void runWriter();
+        void encode(const Job &job);
+
+    public:
+        ~ArtifactWriter();
+        static ArtifactWriter &getInstance();
+        static void setNumThreads(int numThreads);
+        static void setQueueLimit(size_t bytes);
+        void setFormat(string format, int compression = -1);
+        string getExtension();
+        void write(string path, cv::Mat &&mat);
+        void write(cv::Mat &&mat, function<void(vector<uchar> &)> encoded);
+        void flush();
+        ArtifactWriterStats getStats();
+    };
+}
+
+#endif //ARTIFACTWRITER_H
@@ -0,0 +1,79 @@
+#include "CacheKey.h"
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+namespace segment {
+    static const uint64_t HASH_PRIME = 0x100000001b3;
+    static const uint64_t MIX_PRIME = 0x9e3779b97f4a7c15;
+
+    /*
+     * addBytes mixes bytes into the hash, eight at a time so hashing the pixels of a slide stays fast
+     */
+    void CacheKey::addBytes(const void *bytes, size_t length) {
+        const unsigned char *data = (const unsigned char *) bytes;
+        size_t words = length / 8;
+        for (size_t i = 0; i < words; i++) {
+            uint64_t word;
+            memcpy(&word, data + i * 8, 8);
+            this->hash = (this->hash ^ (word * MIX_PRIME)) * HASH_PRIME;
+            this->hash ^= this->hash >> 29;
+        }
+        for (size_t i = words * 8; i < length; i++) {
+            this->hash = (this->hash ^ data[i]) * HASH_PRIME;
+        }
+        uint64_t size = length;
+        this->hash = (this->hash ^ (size * MIX_PRIME)) * HASH_PRIME;
+    }
+
+    CacheKey &CacheKey::add(const CacheKey &key) {
+        addBytes(&key.hash, sizeof(key.hash));
+        return *this;
+    }
+
+    CacheKey &CacheKey::add(const string &value) {
+        addBytes(value.data(), value.size());
+        return *this;
+    }
+
+    CacheKey &CacheKey::add(int value) {
+        int64_t wide = value;
+        addBytes(&wide, sizeof(wide));
+        return *this;
+    }
+
+    CacheKey &CacheKey::add(double value) {
+        addBytes(&value, sizeof(value));
+        return *this;
+    }
+
+    /*
+     * add hashes the size, type and pixels of a matrix, padding between rows is skipped
+     */
+    CacheKey &CacheKey::add(const cv::Mat &mat) {
+        add(mat.rows).add(mat.cols).add(mat.type());
+        return addPixels(mat);
+    }
+
+    /*
+     * addPixels hashes the pixels of a matrix without its size and type, so an image can be hashed
+     * a strip at a time after adding its size and type
+     */
+    CacheKey &CacheKey::addPixels(const cv::Mat &mat) {
+        size_t rowBytes = mat.cols * mat.elemSize();
+        for (int row = 0; row < mat.rows; row++) {
+            addBytes(mat.ptr<unsigned char>(row), rowBytes);
+        }
+        return *this;
+    }
+
+    /*
+     * str returns the key as 16 hex digits
+     */
+    string CacheKey::str() const {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) this->hash);
+        return hex;
+    }
+}
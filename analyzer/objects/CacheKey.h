@@ -0,0 +1,34 @@
+#ifndef CACHEKEY_H
+#define CACHEKEY_H
+
+#include "opencv2/opencv.hpp"
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * CacheKey hashes the inputs of a stage into the name of its cache entry.
+     * A stage's key is built from the key of the stage before it and only the parameters the stage uses,
+     * so changing a parameter invalidates that stage and the stages after it but not the ones before.
+     * The first key is built from the pixels of the image, identical images share their cache entries.
+     */
+    class CacheKey {
+    private:
+        uint64_t hash = 0xcbf29ce484222325;
+
+        void addBytes(const void *bytes, size_t length);
+
+    public:
+        CacheKey &add(const CacheKey &key);
+        CacheKey &add(const string &value);
+        CacheKey &add(int value);
+        CacheKey &add(double value);
+        CacheKey &add(const cv::Mat &mat);
+        CacheKey &addPixels(const cv::Mat &mat);
+        string str() const;
+    };
+}
+
+#endif //CACHEKEY_H
@@ -0,0 +1,268 @@
+#include "CheckpointStore.h"
+#include "Varint.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include "Logger.h"
+
+using namespace std;
+
+namespace segment {
+    // Written at the start of every checkpoint file, changes when the record format changes
+    static const char CHECKPOINT_MAGIC[8] = {'C', 'Y', 'T', 'O', 'C', 'K', 'P', '1'};
+    // Payload length, CRC32 and clump index before the payload of each record
+    static const size_t RECORD_HEADER_SIZE = 12;
+
+    /*
+     * crc32 computes the CRC32 (IEEE) of a buffer, continuing from crc
+     */
+    static uint32_t crc32(uint32_t crc, const unsigned char *buffer, size_t length) {
+        static uint32_t table[256];
+        static once_flag tableFlag;
+        call_once(tableFlag, []() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                table[i] = c;
+            }
+        });
+        crc = ~crc;
+        for (size_t i = 0; i < length; i++) {
+            crc = table[(crc ^ buffer[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    /*
+     * RecordReader decodes the payload of a record, every read fails instead of reading past the end
+     */
+    class RecordReader {
+    public:
+        const unsigned char *position;
+        const unsigned char *end;
+
+        RecordReader(const unsigned char *position, const unsigned char *end) : position(position), end(end) {}
+
+        bool readVarint(uint32_t &value) {
+            uint64_t varint;
+            if (!segment::readVarint(position, end, varint) || varint > UINT32_MAX) return false;
+            value = varint;
+            return true;
+        }
+
+        bool readSigned(int &value) {
+            int64_t varint;
+            if (!readSignedVarint(position, end, varint)) return false;
+            value = varint;
+            return true;
+        }
+
+        // Reads a count of elements that are at least minSize bytes each, so a corrupt count can't allocate
+        bool readCount(uint32_t &count, size_t minSize) {
+            return readVarint(count) && count * minSize <= (size_t) (end - position);
+        }
+    };
+
+    /*
+     * Constructor for CheckpointStore
+     * path: checkpoint file, created if it doesn't exist. The store does nothing if the path is empty.
+     * load: if false the records of a previous run are discarded instead of being loaded
+     */
+    CheckpointStore::CheckpointStore(boost::filesystem::path path, bool load) {
+        if (path.empty()) return;
+        this->path = path.string();
+        boost::filesystem::create_directories(path.parent_path());
+
+        this->fd = open(this->path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (this->fd < 0) {
+            Logger::getInstance().log(LOG_ERROR, nullptr, "Could not open checkpoint file: " + this->path + "\n");
+            return;
+        }
+
+        struct stat fileStat;
+        fstat(this->fd, &fileStat);
+        size_t fileSize = fileStat.st_size;
+        char magic[sizeof(CHECKPOINT_MAGIC)];
+        bool valid = fileSize >= sizeof(CHECKPOINT_MAGIC) &&
+                     pread(this->fd, magic, sizeof(magic), 0) == (ssize_t) sizeof(magic) &&
+                     memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0;
+
+        if (!load || !valid) {
+            if (ftruncate(this->fd, 0) != 0 ||
+                write(this->fd, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != (ssize_t) sizeof(CHECKPOINT_MAGIC)) {
+                Logger::getInstance().log(LOG_ERROR, nullptr, "Could not write checkpoint file: " + this->path + "\n");
+                close(this->fd);
+                this->fd = -1;
+            }
+            return;
+        }
+
+        scan(fileSize);
+    }
+
+    CheckpointStore::~CheckpointStore() {
+        if (this->data) {
+            munmap((void *) this->data, this->mappedSize);
+        }
+        if (this->fd >= 0) {
+            close(this->fd);
+        }
+    }
+
+    /*
+     * scan maps the file and indexes its records, a torn or corrupt record and everything after it is cut off
+     */
+    void CheckpointStore::scan(size_t fileSize) {
+        void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, this->fd, 0);
+        if (mapped == MAP_FAILED) {
+            Logger::getInstance().log(LOG_ERROR, nullptr, "Could not map checkpoint file: " + this->path + "\n");
+            return;
+        }
+        this->data = (const unsigned char *) mapped;
+        this->mappedSize = fileSize;
+
+        size_t offset = sizeof(CHECKPOINT_MAGIC);
+        while (offset + RECORD_HEADER_SIZE <= fileSize) {
+            uint32_t length, crc;
+            int32_t clumpIdx;
+            memcpy(&length, this->data + offset, 4);
+            memcpy(&crc, this->data + offset + 4, 4);
+            memcpy(&clumpIdx, this->data + offset + 8, 4);
+            if (length > fileSize - offset - RECORD_HEADER_SIZE) break;
+            if (crc32(0, this->data + offset + 8, 4 + length) != crc) break;
+            this->index[clumpIdx] = offset;
+            offset += RECORD_HEADER_SIZE + length;
+        }
+
+        if (offset < fileSize) {
+            Logger::getInstance().log(LOG_WARNING, nullptr, "Checkpoint file " + this->path + " has a torn record at byte " +
+                                      to_string(offset) + ", the records after it are discarded\n");
+            if (ftruncate(this->fd, offset) != 0) {
+                Logger::getInstance().log(LOG_ERROR, nullptr, "Could not truncate checkpoint file: " + this->path + "\n");
+            }
+        }
+    }
+
+    bool CheckpointStore::isOpen() const {
+        return this->fd >= 0;
+    }
+
+    /*
+     * size returns the number of clumps that have a record that can be loaded
+     */
+    size_t CheckpointStore::size() const {
+        return this->index.size();
+    }
+
+    bool CheckpointStore::has(int clumpIdx) const {
+        return this->index.count(clumpIdx) > 0;
+    }
+
+    /*
+     * load decodes the record of a clump from the mapped file
+     * Returns false if the clump has no record
+     */
+    bool CheckpointStore::load(int clumpIdx, CheckpointRecord &record) const {
+        auto found = this->index.find(clumpIdx);
+        if (found == this->index.end()) return false;
+
+        uint32_t length;
+        memcpy(&length, this->data + found->second, 4);
+        const unsigned char *payload = this->data + found->second + RECORD_HEADER_SIZE;
+        RecordReader reader(payload, payload + length);
+        record = CheckpointRecord();
+
+        uint32_t count;
+        if (!reader.readCount(count, 1)) return false;
+        record.contours.resize(count);
+        for (vector<cv::Point> &contour : record.contours) {
+            uint32_t points;
+            if (!reader.readCount(points, 2)) return false;
+            contour.resize(points);
+            cv::Point previous(0, 0);
+            for (cv::Point &point : contour) {
+                int dx, dy;
+                if (!reader.readSigned(dx) || !reader.readSigned(dy)) return false;
+                point = previous + cv::Point(dx, dy);
+                previous = point;
+            }
+        }
+
+        if (!reader.readCount(count, 1)) return false;
+        record.neighbors.resize(count);
+        for (vector<int> &neighbors : record.neighbors) {
+            uint32_t neighborCount;
+            if (!reader.readCount(neighborCount, 1)) return false;
+            neighbors.resize(neighborCount);
+            for (int &neighbor : neighbors) {
+                uint32_t neighborIdx;
+                if (!reader.readVarint(neighborIdx)) return false;
+                neighbor = neighborIdx;
+            }
+        }
+
+        if (!reader.readCount(count, sizeof(double))) return false;
+        record.values.resize(count);
+        for (double &value : record.values) {
+            memcpy(&value, reader.position, sizeof(double));
+            reader.position += sizeof(double);
+        }
+        return true;
+    }
+
+    /*
+     * append writes the record of a clump to the end of the file with a single write
+     */
+    void CheckpointStore::append(int clumpIdx, const CheckpointRecord &record) {
+        if (this->fd < 0) return;
+
+        string buffer(RECORD_HEADER_SIZE, '\0');
+        writeVarint(buffer, record.contours.size());
+        for (const vector<cv::Point> &contour : record.contours) {
+            writeVarint(buffer, contour.size());
+            cv::Point previous(0, 0);
+            for (const cv::Point &point : contour) {
+                writeSignedVarint(buffer, point.x - previous.x);
+                writeSignedVarint(buffer, point.y - previous.y);
+                previous = point;
+            }
+        }
+        writeVarint(buffer, record.neighbors.size());
+        for (const vector<int> &neighbors : record.neighbors) {
+            writeVarint(buffer, neighbors.size());
+            for (int neighbor : neighbors) {
+                writeVarint(buffer, neighbor);
+            }
+        }
+        writeVarint(buffer, record.values.size());
+        for (double value : record.values) {
+            buffer.append((const char *) &value, sizeof(double));
+        }
+
+        uint32_t length = buffer.size() - RECORD_HEADER_SIZE;
+        int32_t idx = clumpIdx;
+        memcpy(&buffer[0], &length, 4);
+        memcpy(&buffer[8], &idx, 4);
+        uint32_t crc = crc32(0, (const unsigned char *) &buffer[8], 4 + length);
+        memcpy(&buffer[4], &crc, 4);
+
+        lock_guard<mutex> guard(this->lock);
+        if (write(this->fd, buffer.data(), buffer.size()) != (ssize_t) buffer.size()) {
+            Logger::getInstance().log(LOG_ERROR, nullptr, "Could not write checkpoint of clump " + to_string(clumpIdx) +
+                                      " to: " + this->path + "\n");
+        }
+    }
+
+    /*
+     * flush waits until the appended records are on disk
+     */
+    void CheckpointStore::flush() {
+        if (this->fd < 0) return;
+        lock_guard<mutex> guard(this->lock);
+        fdatasync(this->fd);
+    }
+}
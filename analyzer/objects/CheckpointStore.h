@@ -0,0 +1,63 @@
+#ifndef CHECKPOINTSTORE_H
+#define CHECKPOINTSTORE_H
+
+#include "opencv2/opencv.hpp"
+#include "boost/filesystem.hpp"
+#include <unordered_map>
+#include <string>
+#include <mutex>
+#include <cstdint>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * CheckpointRecord is the checkpoint of one clump for one stage, every vector is indexed by cell
+     * (or by nucleus for nuclei detection). Stages only fill the vectors they need.
+     */
+    class CheckpointRecord {
+    public:
+        vector<vector<cv::Point>> contours;
+        vector<vector<int>> neighbors;
+        vector<double> values;
+    };
+
+    /*
+     * CheckpointStore is an append-only file of CheckpointRecords, one record per finished clump.
+     * Each record is written with a single append and carries a CRC32, a record torn by a crash is
+     * detected and cut off the next time the file is opened, so the records before it are never lost.
+     * The file is memory-mapped when it is opened and indexed by clump, loading a clump only decodes its
+     * record. Records appended after opening are not indexed, the clumps they belong to are already in memory.
+     * If a clump has several records the last one is loaded.
+     *
+     * Points are stored as zigzag varint deltas from the previous point of the contour, most
+     * contour points take 2 bytes.
+     */
+    class CheckpointStore {
+    private:
+        string path;
+        int fd = -1;
+        const unsigned char *data = nullptr;
+        size_t mappedSize = 0;
+        // Offset of the last record of each clump in the mapped file
+        unordered_map<int, size_t> index;
+        mutex lock;
+
+    public:
+        CheckpointStore(boost::filesystem::path path, bool load = true);
+        CheckpointStore(const CheckpointStore &) = delete;
+        CheckpointStore &operator=(const CheckpointStore &) = delete;
+        ~CheckpointStore();
+        bool isOpen() const;
+        size_t size() const;
+        bool has(int clumpIdx) const;
+        bool load(int clumpIdx, CheckpointRecord &record) const;
+        void append(int clumpIdx, const CheckpointRecord &record);
+        void flush();
+
+    private:
+        void scan(size_t fileSize);
+    };
+}
+
+#endif //CHECKPOINTSTORE_H
@@ -90,14 +90,35 @@ namespace segment {
     /*
      * extract returns a cropped version of the clump and masks it such that anything outside the clump is 1.0
      * and anything inside the clump is the image of the clump and optionally adds a boundary to the clump.
+     * Same as cropping extractFull, but only allocates the bounding box instead of the whole image.
      */
     cv::Mat Clump::extract(bool showBoundary)
     {
-        cv::Mat img = this->extractFull(showBoundary);
+        return extract(this->image->readRegion(this->boundingRect), showBoundary);
+    }
+
+    /*
+     * extract masks the clump from source, the region of the image or of one of its planes in the clump's
+     * bounding rect, the same way as extract(showBoundary)
+     * Anything outside the clump is white, so a plane of the clump equals the plane of the extracted clump.
+     */
+    cv::Mat Clump::extract(cv::Mat source, bool showBoundary)
+    {
+        cv::Mat img = source;
+        vector<vector<cv::Point> > offsetContours(1, this->offsetContour);
+
+        // create clump mask
+        cv::Mat mask = cv::Mat::zeros(img.rows, img.cols, CV_8U);
+        cv::drawContours(mask, offsetContours, 0, cv::Scalar(1.0), CV_FILLED);
+        cv::Mat clump = cv::Mat::zeros(img.rows, img.cols, img.type());
+        img.copyTo(clump, mask);
 
-        cv::Mat clump = cv::Mat(img, this->boundingRect);
         if (showBoundary)
-            cv::drawContours(clump, vector<vector<cv::Point> >(1, this->contour), 0, cv::Scalar(1.0, 0.0, 1.0));
+            cv::drawContours(clump, offsetContours, 0, cv::Scalar(1.0, 0., 1.0));
+
+        // invert the mask and then invert the black pixels in the extracted image
+        cv::bitwise_not(clump, clump, mask);
+        cv::bitwise_not(clump, clump);
 
 
         //this->mat = clump;
@@ -42,6 +42,8 @@ namespace segment {
         cv::Mat extractFull(bool showBoundary=false);
         // mask the clump from the image, then return image cropped to show only the clump
         cv::Mat extract(bool showBoundary=false);
+        // mask the clump from the region of the image or of a plane in its bounding rect, like Image::readPlaneRegion
+        cv::Mat extract(cv::Mat source, bool showBoundary=false);
         // If nucleiBoundaries are defined, compute the center of each nuclei
         vector<cv::Point> computeNucleusCenters();
         // Allows for the reversal of computeOffsetContour, as used to generate nuclei_boundaries.png
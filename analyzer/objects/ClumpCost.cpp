@@ -0,0 +1,139 @@
+#include "ClumpCost.h"
+#include <mutex>
+#include <algorithm>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * Coefficients of the cost model of each stage, cost in seconds is
+     * c[0] + c[1] * boundingArea + c[2] * boundingArea * nuclei + c[3] * cellArea * neighbors
+     * where cellArea is the contour area per nucleus.
+     * Refit these from the clumpCosts.csv files written by writeClumpCosts.
+     */
+    static const double costCoefficients[3][4] = {
+        // MSER runs on the whole bounding box
+        {1e-3, 2e-7, 0, 0},
+        // Every pixel is associated with a nucleus, then the overlap of each pair of neighbors is interpolated
+        {1e-3, 1e-7, 2e-8, 4e-8},
+        // Every level set iteration updates each cell over the clump's bounding box and its neighbors' overlap
+        {1e-2, 0, 2e-6, 1e-6}
+    };
+
+    /*
+     * Coefficients of the memory model of each stage, memory in bytes is
+     * m[0] * boundingArea + m[1] * boundingArea * nuclei + m[2] * contourArea
+     */
+    static const double memoryCoefficients[3][3] = {
+        // The extracted clump, its grayscale copy and MSER's per pixel component data
+        {64, 0, 0},
+        // associatedCells holds a pointer per pixel, every cell and nucleus has a mask of the bounding box
+        {16, 2, 0},
+        // edgeEnforcer, clumpPrior and the intermediate float matrices of calcEdgeEnforcer, the cell masks
+        // and a float phi per cell, which together cover the clump about twice
+        {48, 1, 8}
+    };
+
+    /*
+     * Constructor for ClumpCost
+     * Computes the clump's features and predicts the time and memory the stage will take on it.
+     * Nuclei are only known after nuclei detection and neighbors after initial cell segmentation,
+     * so earlier stages are predicted from the bounding box alone.
+     */
+    ClumpCost::ClumpCost(Clump *clump, int clumpIdx, ClumpStage stage) {
+        this->stage = stage;
+        this->clumpIdx = clumpIdx;
+        this->boundingArea = clump->boundingRect.area();
+        this->contourArea = cv::contourArea(clump->offsetContour);
+        this->nuclei = clump->cells.empty() ? clump->nucleiBoundaries.size() : clump->cells.size();
+        this->neighbors = 0;
+        for (Cell &cell : clump->cells) {
+            this->neighbors += cell.neighbors.size();
+        }
+
+        const double *c = costCoefficients[stage];
+        double cellArea = this->contourArea / max(1, this->nuclei);
+        this->predicted = c[0] + c[1] * this->boundingArea + c[2] * this->boundingArea * this->nuclei
+                          + c[3] * cellArea * this->neighbors;
+
+        const double *m = memoryCoefficients[stage];
+        this->memory = m[0] * this->boundingArea + m[1] * this->boundingArea * this->nuclei
+                       + m[2] * this->contourArea;
+    }
+
+    /*
+     * setActual records the time the stage took on the clump
+     * Clumps that were loaded from a checkpoint or skipped by the stage are not recorded
+     */
+    void ClumpCost::setActual(Clump *clump, double seconds) {
+        bool skipped;
+        switch (this->stage) {
+            case NUCLEI_DETECTION:
+                skipped = clump->nucleiBoundariesLoaded;
+                break;
+            case INITIAL_CELL_SEGMENTATION:
+                skipped = clump->initCytoBoundariesLoaded || clump->nucleiBoundaries.empty();
+                break;
+            case OVERLAPPING_CELL_SEGMENTATION:
+                skipped = clump->finalCellContoursLoaded || clump->cells.empty();
+                break;
+        }
+        if (!skipped) {
+            this->actual = seconds;
+        }
+    }
+
+    /*
+     * getClumpStageName returns the name of a stage as written to clumpCosts.csv
+     */
+    const char *getClumpStageName(ClumpStage stage) {
+        switch (stage) {
+            case NUCLEI_DETECTION: return "nucleiDetection";
+            case INITIAL_CELL_SEGMENTATION: return "initialCellSegmentation";
+            case OVERLAPPING_CELL_SEGMENTATION: return "overlappingCellSegmentation";
+        }
+        return "unknown";
+    }
+
+    /*
+     * sortClumpsByCost returns the clump indexes in order of decreasing predicted cost
+     * Starting the longest clumps first keeps a large clump from being the last one running
+     */
+    vector<int> sortClumpsByCost(vector<ClumpCost> &costs) {
+        vector<int> order;
+        for (int i = 0; i < costs.size(); i++) {
+            order.push_back(i);
+        }
+        stable_sort(order.begin(), order.end(), [&costs](int a, int b) {
+            return costs[a].predicted > costs[b].predicted;
+        });
+        for (int &i : order) {
+            i = costs[i].clumpIdx;
+        }
+        return order;
+    }
+
+    /*
+     * writeClumpCosts appends the predicted and actual cost of each clump to clumpCosts.csv
+     * Clumps that weren't run are skipped
+     */
+    void writeClumpCosts(Image *image, const vector<ClumpCost> &costs) {
+        if (!image->hasWriteDirectory()) return;
+        static mutex lock;
+        lock_guard<mutex> guard(lock);
+
+        boost::filesystem::path writePath = image->getWritePath("clumpCosts", ".csv");
+        bool exists = boost::filesystem::exists(writePath);
+        FILE *file = fopen(writePath.string().c_str(), "a");
+        if (!file) return;
+        if (!exists) {
+            fprintf(file, "stage,clump,boundingArea,contourArea,nuclei,neighbors,predicted,actual\n");
+        }
+        for (const ClumpCost &cost : costs) {
+            if (cost.actual < 0) continue;
+            fprintf(file, "%s,%d,%.0f,%.0f,%d,%d,%f,%f\n", getClumpStageName(cost.stage), cost.clumpIdx,
+                    cost.boundingArea, cost.contourArea, cost.nuclei, cost.neighbors, cost.predicted, cost.actual);
+        }
+        fclose(file);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef CLUMPCOST_H
+#define CLUMPCOST_H
+
+#include "Clump.h"
+
+using namespace std;
+
+namespace segment {
+    enum ClumpStage {
+        NUCLEI_DETECTION,
+        INITIAL_CELL_SEGMENTATION,
+        OVERLAPPING_CELL_SEGMENTATION
+    };
+
+    /*
+     * ClumpCost is the predicted and measured time a stage took on a clump, with the clump features
+     * the prediction is based on
+     */
+    class ClumpCost {
+    public:
+        ClumpStage stage;
+        int clumpIdx;
+        // Features
+        double boundingArea;
+        double contourArea;
+        int nuclei;
+        int neighbors;
+        // Seconds
+        double predicted;
+        double actual = -1;
+        // Bytes of memory the stage is predicted to hold while it runs on the clump
+        size_t memory;
+
+        ClumpCost(Clump *clump, int clumpIdx, ClumpStage stage);
+        void setActual(Clump *clump, double seconds);
+    };
+
+    const char *getClumpStageName(ClumpStage stage);
+
+    vector<int> sortClumpsByCost(vector<ClumpCost> &costs);
+
+    void writeClumpCosts(Image *image, const vector<ClumpCost> &costs);
+}
+
+#endif //CLUMPCOST_H
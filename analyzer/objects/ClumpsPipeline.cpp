@@ -0,0 +1,183 @@
+#include "ClumpsPipeline.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "MemoryBudget.h"
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * Constructor for ClumpsPipeline
+     * clumps: list of Clumps to run the stages on
+     * maxClumpsInFlight: maximum number of clumps that have started the first stage but not finished the last,
+     *                    bounds the memory held by partially segmented clumps. Defaults to 4 clumps per thread.
+     */
+    ClumpsPipeline::ClumpsPipeline(vector<Clump> *clumps, int maxClumpsInFlight) {
+        this->clumps = clumps;
+        this->maxClumpsInFlight = maxClumpsInFlight > 0 ? maxClumpsInFlight
+                                                        : ThreadPool::getInstance().getNumThreads() * 4;
+    }
+
+    /*
+     * addStage appends a stage to the pipeline, stages are run in the order they are added
+     * stage: stage the thread function runs, used to predict how long each clump will take
+     * threadFunction: function run on the thread pool. Parameters must be Clump *clump, int clumpIdx
+     * threadDoneFunction: function run after the thread function. Done functions of all stages run one
+     *                     at a time on the thread that called start, so they may share state without locking.
+     */
+    void ClumpsPipeline::addStage(ClumpStage stage,
+                                  const function<void(Clump *, int)> &threadFunction,
+                                  const function<void(Clump *, int)> &threadDoneFunction) {
+        Stage pipelineStage;
+        pipelineStage.stage = stage;
+        pipelineStage.threadFunction = threadFunction;
+        pipelineStage.threadDoneFunction = threadDoneFunction;
+        this->stages.push_back(pipelineStage);
+    }
+
+    /*
+     * addReadyClump predicts the clump's cost for a stage, queues it and submits a task to run it
+     * Returns the clump's predicted memory for the stage. The lock must be held by the caller
+     */
+    size_t ClumpsPipeline::addReadyClump(int stageIdx, int clumpIdx) {
+        Stage *stage = &this->stages[stageIdx];
+        stage->costs.push_back(ClumpCost(&(*this->clumps)[clumpIdx], clumpIdx, stage->stage));
+        stage->ready.push_back(stage->costs.size() - 1);
+        this->tasksInFlight++;
+        ThreadPool::getInstance().submit([this]() { runTask(); });
+        return stage->costs.back().memory;
+    }
+
+    /*
+     * runTask runs one waiting clump on the thread pool
+     * The clump is picked when the task starts, later stages first, so clumps already in flight
+     * finish before new ones are started. Within a stage the clump with the largest predicted cost is picked.
+     */
+    void ClumpsPipeline::runTask() {
+        unique_lock<mutex> guard(this->lock);
+        if (!this->stopping) {
+            int stageIdx = this->stages.size() - 1;
+            while (stageIdx > 0 && this->stages[stageIdx].ready.empty()) stageIdx--;
+            Stage *stage = &this->stages[stageIdx];
+            auto largest = max_element(stage->ready.begin(), stage->ready.end(), [stage](int a, int b) {
+                return stage->costs[a].predicted < stage->costs[b].predicted;
+            });
+            int costIdx = *largest;
+            stage->ready.erase(largest);
+            int clumpIdx = stage->costs[costIdx].clumpIdx;
+
+            guard.unlock();
+            exception_ptr taskError;
+            auto start = chrono::high_resolution_clock::now();
+            try {
+                TraceSpan span(getClumpStageName(stage->stage), clumpIdx);
+                stage->threadFunction(&(*this->clumps)[clumpIdx], clumpIdx);
+            } catch (...) {
+                taskError = current_exception();
+            }
+            double seconds = chrono::duration_cast<chrono::microseconds>(
+                    chrono::high_resolution_clock::now() - start).count() / 1000000.0;
+            guard.lock();
+
+            if (taskError && !this->error) this->error = taskError;
+            this->finished.push_back(FinishedClump{stageIdx, costIdx, seconds});
+        }
+        this->tasksInFlight--;
+        this->workDone.notify_all();
+    }
+
+    /*
+     * start runs all clumps through the stages and returns when every clump finished the last stage
+     * New clumps are admitted to the first stage in order of decreasing predicted cost, and only while
+     * fewer than maxClumpsInFlight are in the pipeline and their predicted memory fits in the MemoryBudget.
+     * A clump is always admitted when the pipeline is empty. Clumps already in the pipeline always move on
+     * to the next stage, even over the budget, since finishing them is what frees their memory.
+     * The predicted and actual cost of each clump in each stage is written to clumpCosts.csv.
+     */
+    void ClumpsPipeline::start() {
+        if (this->stages.empty()) return;
+
+        ThreadPool &pool = ThreadPool::getInstance();
+        // The pool already runs a clump per core
+        OpenCVThreadLimit openCVThreadLimit;
+
+        int numClumps = this->clumps->size();
+        vector<ClumpCost> admissionCosts;
+        for (int clumpIdx = 0; clumpIdx < numClumps; clumpIdx++) {
+            admissionCosts.push_back(ClumpCost(&(*this->clumps)[clumpIdx], clumpIdx, this->stages[0].stage));
+        }
+        vector<int> admissionOrder = sortClumpsByCost(admissionCosts);
+        int nextClump = 0;
+        int clumpsInFlight = 0;
+        int clumpsDone = 0;
+        MemoryBudget &budget = MemoryBudget::getInstance();
+        // Memory reserved for the stage each clump in the pipeline is in
+        vector<size_t> reserved(numClumps, 0);
+
+        unique_lock<mutex> guard(this->lock);
+        while (clumpsDone < numClumps && !this->error) {
+            // Admit new clumps to the first stage
+            while (nextClump < numClumps && clumpsInFlight < this->maxClumpsInFlight) {
+                int clumpIdx = admissionOrder[nextClump];
+                if (!budget.tryReserve(admissionCosts[clumpIdx].memory, clumpsInFlight == 0)) break;
+                reserved[clumpIdx] = admissionCosts[clumpIdx].memory;
+                nextClump++;
+                addReadyClump(0, clumpIdx);
+                clumpsInFlight++;
+            }
+
+            pool.waitUntil(guard, this->workDone, [this]() { return !this->finished.empty(); });
+            FinishedClump done = this->finished.front();
+            this->finished.pop_front();
+            if (this->error) break;
+
+            int stageIdx = done.stageIdx;
+            Stage *stage = &this->stages[stageIdx];
+            int clumpIdx = stage->costs[done.costIdx].clumpIdx;
+            stage->costs[done.costIdx].setActual(&(*this->clumps)[clumpIdx], done.seconds);
+
+            if (stage->threadDoneFunction) {
+                exception_ptr doneError;
+                guard.unlock();
+                try {
+                    TraceSpan span("threadDoneFunction", clumpIdx);
+                    stage->threadDoneFunction(&(*this->clumps)[clumpIdx], clumpIdx);
+                } catch (...) {
+                    doneError = current_exception();
+                }
+                guard.lock();
+                if (doneError && !this->error) this->error = doneError;
+            }
+
+            // Pass the clump to the next stage
+            budget.release(reserved[clumpIdx]);
+            reserved[clumpIdx] = 0;
+            if (stageIdx + 1 < this->stages.size()) {
+                reserved[clumpIdx] = addReadyClump(stageIdx + 1, clumpIdx);
+                budget.tryReserve(reserved[clumpIdx], true);
+            } else {
+                clumpsInFlight--;
+                clumpsDone++;
+            }
+        }
+
+        // Tasks reference the pipeline, wait for the ones still queued after an error
+        this->stopping = true;
+        pool.waitUntil(guard, this->workDone, [this]() { return this->tasksInFlight == 0; });
+        for (size_t bytes : reserved) {
+            budget.release(bytes);
+        }
+
+        if (numClumps > 0) {
+            for (Stage &stage : this->stages) {
+                writeClumpCosts((*this->clumps)[0].image, stage.costs);
+            }
+        }
+
+        if (this->error) {
+            rethrow_exception(this->error);
+        }
+    }
+}
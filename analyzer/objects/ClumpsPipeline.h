@@ -0,0 +1,65 @@
+#ifndef CLUMPSPIPELINE_H
+#define CLUMPSPIPELINE_H
+
+#include "Clump.h"
+#include "ClumpCost.h"
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * ClumpsPipeline runs every clump through a list of stages without waiting for the other
+     * clumps to finish a stage, so a clump can be in the last stage while others are still in the first.
+     */
+    class ClumpsPipeline {
+    private:
+        class Stage {
+        public:
+            ClumpStage stage;
+            function<void(Clump *, int)> threadFunction;
+            function<void(Clump *, int)> threadDoneFunction;
+            // Cost of every clump that entered the stage
+            vector<ClumpCost> costs;
+            // Indexes into costs of clumps waiting to run this stage
+            vector<int> ready;
+        };
+
+        class FinishedClump {
+        public:
+            int stageIdx;
+            int costIdx;
+            double seconds;
+        };
+
+        int maxClumpsInFlight;
+        vector<Clump> *clumps;
+        vector<Stage> stages;
+
+        mutex lock;
+        condition_variable workDone;
+        // Stage and index of clumps whose thread function finished but whose done function hasn't run
+        deque<FinishedClump> finished;
+        // Number of tasks submitted to the thread pool that haven't finished
+        int tasksInFlight = 0;
+        exception_ptr error;
+        bool stopping = false;
+
+    public:
+        ClumpsPipeline(vector<Clump> *clumps, int maxClumpsInFlight = 0);
+        void addStage(ClumpStage stage,
+                      const function<void(Clump *, int)> &threadFunction,
+                      const function<void(Clump *, int)> &threadDoneFunction = {});
+        void start();
+
+    private:
+        size_t addReadyClump(int stageIdx, int clumpIdx);
+        void runTask();
+    };
+
+}
+
+#endif //CLUMPSPIPELINE_H
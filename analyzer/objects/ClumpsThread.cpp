@@ -1,6 +1,10 @@
 #include "ClumpsThread.h"
-#include <future>
-#include <thread>
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "MemoryBudget.h"
+#include <set>
+#include <deque>
+#include <chrono>
 #include <functional>
 
 using namespace std;
@@ -8,70 +12,119 @@ using namespace std;
 namespace segment {
     /*
      * Constructor for ClumpsThread
-     * maxThreads: maximum number of threads run simutaneously
      * clumps: list of Clumps to run the threads on
+     * stage: stage the thread function runs, used to predict how long each clump will take
      * threadFunction: function to run the treads on, thread function's parameters must be Clump *clump, int clumpIdx
      * threadDoneFunction: function to run after its thread finishes. Parameters must be Clump *clump, int clumpIdx
      */
-    ClumpsThread::ClumpsThread(int maxThreads,
-                               vector<Clump> *clumps,
+    ClumpsThread::ClumpsThread(vector<Clump> *clumps,
+                               ClumpStage stage,
                                const function<void(Clump *, int)> &threadFunction,
                                const function<void(Clump *, int)> &threadDoneFunction) {
-        this->maxThreads = maxThreads;
         this->clumps = clumps;
+        this->stage = stage;
         this->threadFunction = threadFunction;
         this->threadDoneFunction = threadDoneFunction;
         start();
     }
 
     /*
-     * start starts the clump threads
-     * Threads are continuously spawned until the max thread threshold is reached.
-     * The function continously checks for threads that are finished and then runs the thread done function.
+     * start runs the thread function of every clump on the thread pool
+     * Clumps are started in order of decreasing predicted cost so the largest clumps don't finish last,
+     * and only while their predicted memory fits in the MemoryBudget. A clump is always started when
+     * none of this stage's clumps are running, so clumps larger than the budget still run on their own.
+     * The thread done functions are run one at a time on the calling thread as soon as each clump finishes.
+     * The predicted and actual cost of each clump is written to clumpCosts.csv.
      */
     void ClumpsThread::start() {
-        vector<shared_future<void>> allThreads;
-        vector<int> threadClumpIdx;
-        vector<Clump>::iterator clumpIterator = this->clumps->begin();
-        do {
-            // Fill thread queue
-            while (allThreads.size() < this->maxThreads && clumpIterator < this->clumps->end()) {
-                // Find the next clump
-                Clump *clump = &(*clumpIterator);
-                int clumpIdx = clumpIterator - this->clumps->begin();
-                clumpIterator++;
-                // Create a new thread with the clump
-                shared_future<void> thread_object = async(this->threadFunction, clump, clumpIdx);
-                //Track the threads
-                allThreads.push_back(thread_object);
-                threadClumpIdx.push_back(clumpIdx);
+        ThreadPool &pool = ThreadPool::getInstance();
+        // The pool already runs a clump per core
+        OpenCVThreadLimit openCVThreadLimit;
+
+        mutex lock;
+        condition_variable clumpDone;
+        deque<int> finished;
+        exception_ptr error;
+        set<int> waitingClumps;
+        int numClumps = this->clumps->size();
+
+        vector<ClumpCost> costs;
+        for (int clumpIdx = 0; clumpIdx < numClumps; clumpIdx++) {
+            costs.push_back(ClumpCost(&(*this->clumps)[clumpIdx], clumpIdx, this->stage));
+        }
+
+        vector<int> order = sortClumpsByCost(costs);
+        int nextClump = 0;
+        MemoryBudget &budget = MemoryBudget::getInstance();
+
+        auto submitClump = [this, &pool, &costs, &lock, &clumpDone, &finished, &error](int clumpIdx) {
+            Clump *clump = &(*this->clumps)[clumpIdx];
+            ClumpCost *cost = &costs[clumpIdx];
+            pool.submit([this, clump, clumpIdx, cost, &lock, &clumpDone, &finished, &error]() {
+                exception_ptr threadError;
+                auto start = chrono::high_resolution_clock::now();
+                try {
+                    TraceSpan span(getClumpStageName(this->stage), clumpIdx);
+                    this->threadFunction(clump, clumpIdx);
+                } catch (...) {
+                    threadError = current_exception();
+                }
+                cost->setActual(clump, chrono::duration_cast<chrono::microseconds>(
+                        chrono::high_resolution_clock::now() - start).count() / 1000000.0);
+                lock_guard<mutex> guard(lock);
+                if (threadError && !error) error = threadError;
+                finished.push_back(clumpIdx);
+                clumpDone.notify_all();
+            });
+        };
+
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            // Start clumps while they fit in the memory budget, stop starting clumps after an error
+            while (nextClump < numClumps && !error) {
+                int clumpIdx = order[nextClump];
+                if (!budget.tryReserve(costs[clumpIdx].memory, waitingClumps.empty())) break;
+                nextClump++;
+                waitingClumps.insert(clumpIdx);
+                submitClump(clumpIdx);
             }
+            if (waitingClumps.empty()) break;
 
-            // Wait for a thread to finish every 10 milliseconds
-            auto timeout = std::chrono::milliseconds(10);
-            for (int i = 0; i < allThreads.size(); i++) {
-                shared_future<void> thread = allThreads[i];
-                int clumpIdx = threadClumpIdx[i];
-                Clump *clump = &(*this->clumps)[clumpIdx];
-                // If thread is finished
-                if (thread.valid() && thread.wait_for(timeout) == future_status::ready) {
-                    thread.get();
-                    // Run a thread done function if it exists
-                    if (this->threadDoneFunction) {
-                        this->threadDoneFunction(clump, clumpIdx);
-                    }
-                    allThreads.erase(allThreads.begin() + i);
-                    threadClumpIdx.erase(threadClumpIdx.begin() + i);
-                    // Print threads that are still running when the last clump thread finishes running
-                    if (allThreads.size() > 0 && clumpIterator == this->clumps->end()) {
-                        for (int waitingClumpIdx : threadClumpIdx) {
-                            printf("Still waiting for clump: %d\n", waitingClumpIdx);
-                        }
-                    }
-                    break;
+            pool.waitUntil(guard, clumpDone, [&finished]() { return !finished.empty(); });
+            int clumpIdx = finished.front();
+            finished.pop_front();
+            waitingClumps.erase(clumpIdx);
+            budget.release(costs[clumpIdx].memory);
+            if (error) continue;
+
+            // Run a thread done function if it exists
+            if (this->threadDoneFunction) {
+                exception_ptr doneError;
+                guard.unlock();
+                try {
+                    TraceSpan span("threadDoneFunction", clumpIdx);
+                    this->threadDoneFunction(&(*this->clumps)[clumpIdx], clumpIdx);
+                } catch (...) {
+                    doneError = current_exception();
+                }
+                guard.lock();
+                if (doneError && !error) error = doneError;
+            }
+
+            // Print clumps that are still running once every remaining clump has a thread
+            if (nextClump == numClumps && !waitingClumps.empty() && waitingClumps.size() <= pool.getNumThreads()) {
+                for (int waitingClumpIdx : waitingClumps) {
+                    (*this->clumps)[waitingClumpIdx].image->log(LOG_DEBUG, "Still waiting for clump: %d\n", waitingClumpIdx);
                 }
             }
-        // Repeat if there are threads still running or if we haven't traversed all clumps,
-        } while(allThreads.size() > 0 || clumpIterator < this->clumps->end());
+        }
+
+        if (numClumps > 0) {
+            writeClumpCosts((*this->clumps)[0].image, costs);
+        }
+
+        if (error) {
+            rethrow_exception(error);
+        }
     }
-}
\ No newline at end of file
+}
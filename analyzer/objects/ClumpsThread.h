@@ -2,6 +2,7 @@
 #define CLUMPSTHREAD_H
 
 #include "Clump.h"
+#include "ClumpCost.h"
 #include <functional>
 
 using namespace std;
@@ -9,14 +10,14 @@ using namespace std;
 namespace segment {
     class ClumpsThread {
     private:
-        int maxThreads;
         vector<Clump> *clumps;
+        ClumpStage stage;
         function<void(Clump *, int)> threadFunction;
         function<void(Clump *, int)> threadDoneFunction;
 
     public:
-        ClumpsThread(int maxThreads,
-                     vector<Clump> *clumps,
+        ClumpsThread(vector<Clump> *clumps,
+                     ClumpStage stage,
                      const function<void(Clump *, int)> &threadFunction,
                      const function<void(Clump *, int)> &threadDoneFunction = {});
         void start();
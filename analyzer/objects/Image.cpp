@@ -1,41 +1,301 @@
 #include "Image.h"
+#include "MaskFile.h"
+#include "CacheKey.h"
+#include "ArtifactWriter.h"
 #include "../functions/SegmenterTools.h"
 
 using namespace std;
 using json = nlohmann::json;
 
 namespace segment {
-    Image::Image(string path) {
+    // Size in pixels of the blocks readPyramidLevel downsamples a streamed image in
+    const int PYRAMID_BLOCK_SIZE = 4096;
+    // Rows of a streamed image hashed at a time by getContentHash
+    const int HASH_STRIP_ROWS = 256;
+
+    /*
+     * isStreamedSize returns true if an image of this size is too large to be read into memory
+     */
+    static bool isStreamedSize(cv::Size size) {
+        return (int64_t) size.width * size.height > STREAMED_IMAGE_PIXELS;
+    }
+
+    /*
+     * getPyramidSize returns the size of an image downsampled 2^level times by cv::pyrDown
+     */
+    static cv::Size getPyramidSize(cv::Size size, int level) {
+        for (int i = 0; i < level; i++) {
+            size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+        }
+        return size;
+    }
+
+    /*
+     * Constructor for Image
+     * path: path of the image, the results are written to a directory named after it
+     * mat: the image if it was already read, read from path if empty
+     * page: page of a TIFF file to read, -1 for the largest page
+     * region: region of the file to read, the whole image if empty
+     */
+    Image::Image(string path, cv::Mat mat, int page, cv::Rect region) {
         boost::filesystem::path tmp(path);
         this->path = tmp;
+        this->page = page;
+        this->region = region;
+        this->writeDirectory = boost::filesystem::path("../images") / this->path.filename();
+        // Pages and regions of the same file get their own results
+        if (page >= 0 || region.area() > 0) {
+            this->writeDirectory += "_p" + to_string(page);
+            if (region.area() > 0) {
+                this->writeDirectory += "_" + to_string(region.x) + "_" + to_string(region.y) + "_" +
+                                        to_string(region.width) + "_" + to_string(region.height);
+            }
+        }
+        this->cacheDirectory = this->writeDirectory.parent_path() / ".cache";
         this->padding = 1;
-        this->mat = readImage();
+        this->mat = mat.empty() ? readImage() : mat;
 
 
-        int channels = this->mat.channels();
-        int width = this->mat.cols;
-        int height = this->mat.rows;
+        // Streamed images are decoded as BGR by the TiffReader
+        int channels = isStreamed() ? 3 : this->mat.channels();
+        int width = getSize().width;
+        int height = getSize().height;
 
         clearLog();
         log("Loaded %s\n", path.c_str());
         log("Image data: (rows) %i (cols) %i (channels) %i\n", height, width, channels);
+        if (isStreamed()) {
+            log("The image is streamed from the file, full resolution boundary images are not written\n");
+        }
 
     }
 
+    /*
+     * Constructor for an Image that is already in memory
+     * mat: the image, it is not copied and must outlive the Image
+     * writeDirectory: directory results and checkpoints are written to, nothing is written to disk if empty
+     */
+    Image::Image(cv::Mat mat, string writeDirectory) {
+        this->writeDirectory = writeDirectory;
+        if (!this->writeDirectory.empty()) {
+            boost::filesystem::path parent = this->writeDirectory.parent_path();
+            this->cacheDirectory = (parent.empty() ? this->writeDirectory : parent) / ".cache";
+        }
+        this->padding = 1;
+        this->mat = mat;
+
+        clearLog();
+        log("Image data: (rows) %i (cols) %i (channels) %i\n", this->mat.rows, this->mat.cols, this->mat.channels());
+    }
+
+    /*
+     * readImage reads the page and region of the image from path
+     * TIFF files are read with a TiffReader that is kept open for readRegion, only the tiles overlapping
+     * the region are decoded. TIFF images larger than STREAMED_IMAGE_PIXELS are not read, an empty Mat
+     * is returned and the image is streamed, see isStreamed.
+     */
     cv::Mat Image::readImage() {
-        cv::Mat image = cv::imread(this->path.string());
+        cv::Mat image;
+        if (isTiff(this->path.string())) {
+            try {
+                this->tiff = make_shared<TiffReader>(this->path.string(), this->page);
+                cv::Rect rect = this->region.area() > 0 ? this->region : cv::Rect(cv::Point(), this->tiff->getSize());
+                if (isStreamedSize(getSize())) {
+                    return image;
+                }
+                image = this->tiff->readRegion(rect);
+            } catch (const runtime_error &e) {
+                log(LOG_ERROR, "%s\n", e.what());
+                this->tiff.reset();
+            }
+        } else {
+            image = readImage(this->path.string(), this->page, this->region);
+        }
 
-        if (image.empty()) {
-            cerr << "Could not read image at: " << path << endl;
+        if (image.empty() && !this->tiff) {
+            log(LOG_ERROR, "Could not read image at: %s\n", this->path.string().c_str());
         }
 
         return image;
     }
 
+    /*
+     * readImage reads a page and region of an image file without creating an Image
+     * path: path of the image file
+     * page: page of a TIFF file to read, -1 for the largest page
+     * region: region of the file to read, the whole image if empty
+     * Returns an empty Mat if the file can't be read
+     */
+    cv::Mat Image::readImage(string path, int page, cv::Rect region) {
+        if (isTiff(path)) {
+            try {
+                TiffReader reader(path, page);
+                return reader.readRegion(region.area() > 0 ? region : cv::Rect(cv::Point(), reader.getSize()));
+            } catch (const runtime_error &e) {
+                Logger::getInstance().log(LOG_ERROR, nullptr, string(e.what()) + "\n");
+                return cv::Mat();
+            }
+        }
+
+        cv::Mat image = cv::imread(path);
+        if (!image.empty() && region.area() > 0) {
+            image = image(region & cv::Rect(0, 0, image.cols, image.rows)).clone();
+        }
+        return image;
+    }
+
+    /*
+     * getStreamedSize returns the size of a page and region of an image file if it is a TIFF image that
+     * would be streamed instead of read into memory, otherwise an empty size
+     */
+    cv::Size Image::getStreamedSize(string path, int page, cv::Rect region) {
+        if (!isTiff(path)) return cv::Size();
+        try {
+            TiffReader reader(path, page);
+            cv::Rect rect(cv::Point(), reader.getSize());
+            if (region.area() > 0) rect &= region;
+            return isStreamedSize(rect.size()) ? rect.size() : cv::Size();
+        } catch (const runtime_error &e) {
+            return cv::Size();
+        }
+    }
+
+    /*
+     * isStreamed returns true if the pixels of the image are not in mat but decoded from its TIFF file
+     * by readRegion when they are needed
+     */
+    bool Image::isStreamed() {
+        return this->mat.empty() && this->tiff;
+    }
+
+    /*
+     * getSize returns the size of the image, the size of mat unless the image is streamed
+     */
+    cv::Size Image::getSize() {
+        if (!isStreamed()) return this->mat.size();
+        cv::Rect rect(cv::Point(), this->tiff->getSize());
+        if (this->region.area() > 0) rect &= this->region;
+        return rect.size();
+    }
+
+    /*
+     * readRegion returns a region of the image, in the coordinates of mat
+     * The region is a view of mat if the image is in memory, otherwise only the tiles of the TIFF file that
+     * overlap it are decoded
+     */
+    cv::Mat Image::readRegion(cv::Rect rect) {
+        rect &= cv::Rect(cv::Point(), getSize());
+        if (!isStreamed()) {
+            return this->mat(rect);
+        }
+        return this->tiff->readRegion(rect + this->region.tl());
+    }
+
+    /*
+     * readPyramidRegion returns a region of the image downsampled 2^level times by cv::pyrDown
+     * Only the region and a margin around it are read and downsampled. The margin covers every pixel
+     * pyrDown uses, so the region is the same as in the downsampled whole image.
+     * rect: region in the coordinates of the downsampled image
+     */
+    cv::Mat Image::readPyramidRegion(int level, cv::Rect rect) {
+        int scale = 1 << level;
+        int margin = 2 * scale;
+        cv::Size size = getSize();
+        rect &= cv::Rect(cv::Point(), getPyramidSize(size, level));
+        if (rect.area() == 0) return cv::Mat();
+        // The source starts on a multiple of scale, so it is aligned with the pixels of the downsampled image
+        cv::Rect source = cv::Rect(rect.x * scale - margin, rect.y * scale - margin,
+                                   rect.width * scale + 2 * margin, rect.height * scale + 2 * margin) &
+                          cv::Rect(cv::Point(), size);
+        cv::Mat downsampled = readRegion(source);
+        for (int i = 0; i < level; i++) {
+            cv::pyrDown(downsampled, downsampled);
+        }
+        return downsampled(cv::Rect(rect.x - source.x / scale, rect.y - source.y / scale, rect.width, rect.height));
+    }
+
+    /*
+     * readPyramidLevel returns the image downsampled 2^level times by cv::pyrDown
+     * Streamed images are downsampled in blocks by readPyramidRegion, so only one block is decoded at a time
+     */
+    cv::Mat Image::readPyramidLevel(int level) {
+        if (!isStreamed()) {
+            cv::Mat downsampled = this->mat;
+            for (int i = 0; i < level; i++) {
+                cv::pyrDown(downsampled, downsampled);
+            }
+            return downsampled;
+        }
+        cv::Size size = getPyramidSize(getSize(), level);
+        int blockSize = max(PYRAMID_BLOCK_SIZE >> level, 64);
+        cv::Mat downsampled = cv::Mat::zeros(size, CV_8UC3);
+        for (int y = 0; y < size.height; y += blockSize) {
+            for (int x = 0; x < size.width; x += blockSize) {
+                cv::Rect block = cv::Rect(x, y, blockSize, blockSize) & cv::Rect(cv::Point(), size);
+                cv::Mat target = downsampled(block);
+                readPyramidRegion(level, block).copyTo(target);
+            }
+        }
+        return downsampled;
+    }
+
+    /*
+     * getPlane returns a plane derived from the image, it is computed the first time any thread asks for it
+     * The planes must not be modified, stages take regions of them instead of converting the image themselves
+     * PLANE_GRAY: the image in grayscale, CV_8UC1
+     */
+    cv::Mat Image::getPlane(ImagePlane plane) {
+        DerivedPlanes *planes = this->planes.get();
+        call_once(planes->computed[plane], [this, planes, plane]() {
+            cv::Mat computed;
+            switch (plane) {
+                case PLANE_GRAY:
+                    if (this->mat.channels() == 1) {
+                        computed = this->mat;
+                    } else {
+                        cv::cvtColor(this->mat, computed, cv::COLOR_BGR2GRAY);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            planes->mats[plane] = computed;
+        });
+        return planes->mats[plane];
+    }
+
+    /*
+     * readPlaneRegion returns a region of a plane derived from the image, see getPlane
+     * The planes of streamed images are not kept, the region is read and converted each time
+     */
+    cv::Mat Image::readPlaneRegion(ImagePlane plane, cv::Rect rect) {
+        if (!isStreamed()) {
+            return getPlane(plane)(rect & cv::Rect(cv::Point(), getSize()));
+        }
+        cv::Mat region = readRegion(rect);
+        cv::Mat computed;
+        switch (plane) {
+            case PLANE_GRAY:
+                cv::cvtColor(region, computed, cv::COLOR_BGR2GRAY);
+                break;
+            default:
+                break;
+        }
+        return computed;
+    }
+
+    /*
+     * hasWriteDirectory returns false if the image's results are kept in memory only
+     */
+    bool Image::hasWriteDirectory() {
+        return !this->writeDirectory.empty();
+    }
+
     boost::filesystem::path Image::getWriteDirectory() {
-        boost::filesystem::path path("../images");
-        path /= this->path.filename();
-        boost::filesystem::create_directories(path);
+        boost::filesystem::path path = this->writeDirectory;
+        if (!path.empty()) {
+            boost::filesystem::create_directories(path);
+        }
         return path;
     }
 
@@ -48,37 +308,113 @@ namespace segment {
         return writePath;
     }
 
+    /*
+     * getContentHash returns a hash of the image's pixels, computed the first time it is needed
+     * Streamed images are hashed a strip at a time, the hash is the same as if the image was in memory
+     */
+    string Image::getContentHash() {
+        if (this->contentHash.empty()) {
+            if (!isStreamed()) {
+                this->contentHash = CacheKey().add(this->mat).str();
+                return this->contentHash;
+            }
+            cv::Size size = getSize();
+            CacheKey key;
+            key.add(size.height).add(size.width).add(CV_8UC3);
+            for (int y = 0; y < size.height; y += HASH_STRIP_ROWS) {
+                key.addPixels(readRegion(cv::Rect(0, y, size.width, HASH_STRIP_ROWS)));
+            }
+            this->contentHash = key.str();
+        }
+        return this->contentHash;
+    }
+
+    /*
+     * getCachePath returns the path of a stage's cache entry, named after the stage and its key in
+     * the cache directory. Stages without a key are saved to the write directory.
+     */
+    boost::filesystem::path Image::getCachePath(string name, string ext) {
+        auto key = this->cacheKeys.find(name);
+        if (key == this->cacheKeys.end() || this->cacheDirectory.empty()) {
+            return getWritePath(name, ext);
+        }
+        return this->cacheDirectory / (name + "-" + key->second + ext);
+    }
+
+    /*
+     * writeImage queues an image to be written by the ArtifactWriter in its format, the extension of name is replaced
+     * mat is not copied and must not be modified afterwards
+     */
     void Image::writeImage(string name, cv::Mat mat) {
-        boost::filesystem::path writePath = getWritePath(name, ".png");
+        if (!hasWriteDirectory() || mat.empty()) return;
+        ArtifactWriter &writer = ArtifactWriter::getInstance();
+        boost::filesystem::path writePath = getWritePath(name, writer.getExtension());
+        writePath.replace_extension(writer.getExtension());
         boost::filesystem::create_directories(writePath.parent_path());
-        cv::imwrite(writePath.string(), mat);
+        writer.write(writePath.string(), move(mat));
     }
 
     cv::Mat Image::loadMatrix(string name) {
         boost::filesystem::path loadPath = getWritePath(name, ".yml");
         cv::Mat mat;
 
-        if (is_regular_file(loadPath)) {
+        if (this->useCache && hasWriteDirectory() && is_regular_file(loadPath)) {
             cv::FileStorage fs(loadPath.string(), cv::FileStorage::READ);
             fs["mat"] >> mat;
             fs.release();
-            cout << "Loaded from file: " << loadPath.string() << endl;
+            log(LOG_DEBUG, "Loaded from file: %s\n", loadPath.string().c_str());
         }
         return mat;
     }
 
-    void Image::writeMatrix(string name, cv::Mat mat) {
-        boost::filesystem::path writePath = getWritePath(name, ".yml");
+    /*
+     * loadMask loads a mask written by writeMask from the stage's cache entry
+     * With migrateCache, a mask saved as a .yml matrix in the write directory by an older version is loaded if
+     * there is no mask file, and converted to the mask file of the current cache entry so it is only parsed once.
+     */
+    cv::Mat Image::loadMask(string name) {
+        if (!this->useCache || !hasWriteDirectory()) return cv::Mat();
+        boost::filesystem::path loadPath = getCachePath(name, ".mask");
+        cv::Mat mask;
+        if (is_regular_file(loadPath)) {
+            mask = readMaskFile(loadPath.string());
+            if (!mask.empty()) {
+                log(LOG_DEBUG, "Loaded from file: %s\n", loadPath.string().c_str());
+            }
+        } else if (this->migrateCache) {
+            mask = loadMatrix(name + ".yml");
+            if (!mask.empty()) {
+                log(LOG_WARNING, "Converting %s.yml to mask file %s, the parameters it was made with can't be checked\n",
+                    name.c_str(), loadPath.string().c_str());
+                writeMask(name, mask);
+            }
+        }
+        return mask;
+    }
+
+    /*
+     * writeMask writes a single channel 8 bit mask to the stage's cache entry in the binary mask format of MaskFile
+     */
+    void Image::writeMask(string name, cv::Mat mask) {
+        if (!hasWriteDirectory()) return;
+        boost::filesystem::path writePath = getCachePath(name, ".mask");
         boost::filesystem::create_directories(writePath.parent_path());
-        cv::FileStorage fs(writePath.string(), cv::FileStorage::WRITE);
-        fs << "mat" << mat;
-        fs.release();
+        writeMaskFile(writePath.string(), mask);
+    }
+
+    /*
+     * getCheckpointPath returns the path of a stage's CheckpointStore, empty if nothing is written to disk
+     */
+    boost::filesystem::path Image::getCheckpointPath(string name) {
+        if (!hasWriteDirectory()) return boost::filesystem::path();
+        return getCachePath(name, ".ckpt");
     }
 
     json Image::loadJSON(string name) {
+        json j;
+        if (!this->useCache || !hasWriteDirectory()) return j;
         boost::filesystem::path writePath = getWritePath(name, ".json");
         ifstream ifs(writePath.string());
-        json j;
         try {
             ifs >> j;
         } catch(json::parse_error& ex) {
@@ -89,6 +425,7 @@ namespace segment {
 
 
     void Image::writeJSON(string name, json &j) {
+        if (!hasWriteDirectory()) return;
         boost::filesystem::path writePath = getWritePath(name, ".json");
         boost::filesystem::create_directories(writePath.parent_path());
         ofstream ofs(writePath.string());
@@ -99,24 +436,32 @@ namespace segment {
         return getWritePath("log", ".txt");
     }
 
+    /*
+     * log queues an info message for the Logger to print and append to log.txt
+     */
     void Image::log(const char * format, ...) {
         va_list args;
         va_start(args, format);
-        auto ret = vprintf(format, args);
+        Logger::getInstance().log(LOG_INFO, this->logFile, format, args);
         va_end(args);
+    }
 
+    /*
+     * log queues a message of the given level for the Logger to print and append to log.txt
+     */
+    void Image::log(LogLevel level, const char * format, ...) {
+        va_list args;
         va_start(args, format);
-        boost::filesystem::path logPath = getLogPath();
-        FILE *file = fopen(logPath.string().c_str(), "a");
-        vfprintf(file, format, args);
-        fclose(file);
+        Logger::getInstance().log(level, this->logFile, format, args);
         va_end(args);
     }
 
+    /*
+     * clearLog starts a new log.txt, the messages logged before are still written to the previous one
+     */
     void Image::clearLog() {
-        boost::filesystem::path logPath = getLogPath();
-        FILE *file = fopen(logPath.string().c_str(), "w");
-        fclose(file);
+        if (!hasWriteDirectory()) return;
+        this->logFile = make_shared<LogFile>(getLogPath());
     }
 
     void Image::createClumps(vector<vector<cv::Point>> clumpBoundaries) {
@@ -137,7 +482,11 @@ namespace segment {
         }
     }
 
+    /*
+     * getNucleiBoundaries draws the nuclei on a copy of the image, empty if the image is streamed
+     */
     cv::Mat Image::getNucleiBoundaries() {
+        if (isStreamed()) return cv::Mat();
         cv::Mat img = this->mat.clone();
         cv::RNG rng(12345);
         for (int i = 0; i < this->clumps.size(); i++) {
@@ -148,7 +497,29 @@ namespace segment {
         return img;
     }
 
+    /*
+     * getInitialCellBoundaries draws the initial cell boundaries on a copy of the image, empty if the image is streamed
+     */
+    cv::Mat Image::getInitialCellBoundaries() {
+        if (isStreamed()) return cv::Mat();
+        cv::Mat img = this->mat.clone();
+        cv::RNG rng(12345);
+        for (int clumpIdx = 0; clumpIdx < this->clumps.size(); clumpIdx++) {
+            Clump *clump = &this->clumps[clumpIdx];
+            for (Cell &cell : clump->cells) {
+                vector<cv::Point> contour = clump->undoBoundingRect(cell.cytoBoundary);
+                cv::Scalar color = cv::Scalar(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
+                cv::drawContours(img, vector<vector<cv::Point>>{contour}, 0, color, 3);
+            }
+        }
+        return img;
+    }
+
+    /*
+     * getFinalResult draws the final cell boundaries on a copy of the image, empty if the image is streamed
+     */
     cv::Mat Image::getFinalResult() {
+        if (isStreamed()) return cv::Mat();
         cv::RNG rng(12345);
         cv::Mat img = this->mat.clone();
         for (int clumpIdx = 0; clumpIdx < this->clumps.size(); clumpIdx++) {
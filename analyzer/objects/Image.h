@@ -3,16 +3,32 @@
 
 #include "opencv2/opencv.hpp"
 #include "Clump.h"
+#include "TiffReader.h"
+#include "CheckpointStore.h"
+#include "Logger.h"
 #include "boost/filesystem.hpp"
 #include "../thirdparty/nlohmann/json.hpp"
+#include <memory>
+#include <map>
+#include <mutex>
 
 using namespace std;
 using json = nlohmann::json;
 
 namespace segment {
+    // Planes derived from the image that are computed once and shared by the stages
+    enum ImagePlane {
+        PLANE_GRAY,
+        PLANE_COUNT
+    };
+
+    // TIFF images with more pixels than this are not read into mat, their regions are decoded when they are needed
+    const int64_t STREAMED_IMAGE_PIXELS = 256LL * 1024 * 1024;
+
     class Clump; //forward declaration
     class Image {
     public:
+        // Pixels of the image, empty if the image is streamed from its TIFF file, see isStreamed
         cv::Mat mat;
         cv::Mat gmmPredictions;
 
@@ -20,24 +36,73 @@ namespace segment {
         int padding;
 
         boost::filesystem::path path;
+        // Page of a TIFF file that is read, -1 for the largest page
+        int page = -1;
+        // Region of the file that is read, the whole image if empty
+        cv::Rect region;
+        // Reader of TIFF files, kept open so regions can be read later
+        shared_ptr<TiffReader> tiff;
+        // Directory results and checkpoints are written to and loaded from, nothing is written if empty
+        boost::filesystem::path writeDirectory;
+        // Directory the stage caches are kept in, shared by the images next to the write directory
+        boost::filesystem::path cacheDirectory;
+        // Key of the cache entry of each stage, set by the Segmenter. Stages without a key are
+        // saved to the write directory.
+        map<string, string> cacheKeys;
         vector<Clump> clumps;
+        // If false, saved matrices, checkpoints and JSON files are never loaded
+        bool useCache = true;
+        // If true, loadMask converts masks saved as .yml matrices by older versions, see Segmenter::migrateCache
+        bool migrateCache = false;
+
+    private:
+        string contentHash;
+        // log.txt in the write directory, opened once by clearLog
+        shared_ptr<LogFile> logFile;
+
+        class DerivedPlanes {
+        public:
+            once_flag computed[PLANE_COUNT];
+            cv::Mat mats[PLANE_COUNT];
+        };
+        // Shared by copies of the image like its other matrices
+        shared_ptr<DerivedPlanes> planes = make_shared<DerivedPlanes>();
+
+    public:
 
-        Image(string path);
+        Image(string path, cv::Mat mat = cv::Mat(), int page = -1, cv::Rect region = cv::Rect());
+        Image(cv::Mat mat, string writeDirectory = "");
 
         cv::Mat padMatrix();
         cv::Mat readImage();
+        static cv::Mat readImage(string path, int page = -1, cv::Rect region = cv::Rect());
+        static cv::Size getStreamedSize(string path, int page = -1, cv::Rect region = cv::Rect());
+        bool isStreamed();
+        cv::Size getSize();
+        cv::Mat readRegion(cv::Rect rect);
+        cv::Mat readPyramidRegion(int level, cv::Rect rect);
+        cv::Mat readPyramidLevel(int level);
+        cv::Mat getPlane(ImagePlane plane);
+        cv::Mat readPlaneRegion(ImagePlane plane, cv::Rect rect);
+        bool hasWriteDirectory();
         boost::filesystem::path getWriteDirectory();
         boost::filesystem::path getWritePath(string name, string defaultExt);
+        string getContentHash();
+        boost::filesystem::path getCachePath(string name, string ext);
         void writeImage(string name, cv::Mat mat);
         cv::Mat loadMatrix(string name);
-        void writeMatrix(string name, cv::Mat mat);
+        cv::Mat loadMask(string name);
+        void writeMask(string name, cv::Mat mask);
+        boost::filesystem::path getCheckpointPath(string name);
         json loadJSON(string name);
         void writeJSON(string name, json &j);
         boost::filesystem::path getLogPath();
         void log(const char * format, ...);
+        void log(LogLevel level, const char * format, ...);
         void clearLog();
         void createClumps(vector<vector<cv::Point>> clumpBoundaries);
         cv::Mat getNucleiBoundaries();
+        cv::Mat getInitialCellBoundaries();
         cv::Mat getFinalResult();
     };
 }
@@ -0,0 +1,244 @@
+#include "JobQueue.h"
+#include "MemoryBudget.h"
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace segment {
+
+    /*
+     * getJobStatusName returns the name of a job status as reported to clients
+     */
+    string getJobStatusName(JobStatus status) {
+        switch (status) {
+            case JOB_QUEUED: return "queued";
+            case JOB_RUNNING: return "running";
+            case JOB_DONE: return "done";
+            case JOB_FAILED: return "failed";
+        }
+        return "unknown";
+    }
+
+    /*
+     * toJSON returns the job's status as a JSON object
+     */
+    json Job::toJSON() const {
+        auto seconds = [](chrono::system_clock::time_point from, chrono::system_clock::time_point to) {
+            return chrono::duration_cast<chrono::microseconds>(to - from).count() / 1000000.0;
+        };
+        json j;
+        j["id"] = this->id;
+        j["status"] = getJobStatusName(this->status);
+        j["priority"] = this->priority;
+        j["cpus"] = this->cpus;
+        j["memory"] = this->memory;
+        j["args"] = this->args;
+        j["submitted"] = chrono::duration_cast<chrono::seconds>(this->submitted.time_since_epoch()).count();
+        bool wasStarted = this->started != chrono::system_clock::time_point();
+        if (this->status == JOB_QUEUED) {
+            j["queuedTime"] = seconds(this->submitted, chrono::system_clock::now());
+        } else if (!wasStarted) {
+            // Dropped from the queue before it started
+            j["queuedTime"] = seconds(this->submitted, this->finished);
+        } else {
+            j["queuedTime"] = seconds(this->submitted, this->started);
+        }
+        if (this->status == JOB_RUNNING) {
+            j["runTime"] = seconds(this->started, chrono::system_clock::now());
+        } else if ((this->status == JOB_DONE || this->status == JOB_FAILED) && wasStarted) {
+            j["runTime"] = seconds(this->started, this->finished);
+        }
+        if (this->status == JOB_DONE || this->status == JOB_FAILED) {
+            j["finished"] = chrono::duration_cast<chrono::seconds>(this->finished.time_since_epoch()).count();
+        }
+        if (!this->error.empty()) {
+            j["error"] = this->error;
+        }
+        return j;
+    }
+
+    /*
+     * Constructor for JobQueue
+     * maxQueued: maximum number of jobs waiting to be started, further submissions are rejected
+     * cpuBudget: number of cores that may be used by all running jobs together
+     * jobFunction: function that runs a job, the job failed if it throws an exception
+     * The memory of each running job is reserved from the MemoryBudget
+     */
+    JobQueue::JobQueue(int maxQueued, int cpuBudget, const function<void(Job *)> &jobFunction) {
+        this->maxQueued = maxQueued;
+        this->cpuBudget = max(1, cpuBudget);
+        this->jobFunction = jobFunction;
+    }
+
+    JobQueue::~JobQueue() {
+        stop();
+    }
+
+    /*
+     * submit adds a job to the queue and starts it if the budget allows
+     * Returns the id of the job or -1 if the queue is full
+     */
+    int JobQueue::submit(const vector<string> &args, int priority, int cpus, size_t memory) {
+        unique_lock<mutex> guard(this->lock);
+        if (this->stopping || this->queued.size() >= this->maxQueued) {
+            return -1;
+        }
+
+        Job job;
+        job.id = this->nextId++;
+        job.priority = priority;
+        // A job can never use more than the entire budget
+        job.cpus = min(max(1, cpus), this->cpuBudget);
+        job.memory = memory;
+        job.args = args;
+        job.status = JOB_QUEUED;
+        job.submitted = chrono::system_clock::now();
+        this->jobs[job.id] = job;
+
+        // Keep the queue sorted by priority, jobs of equal priority keep their submission order
+        auto position = find_if(this->queued.begin(), this->queued.end(), [this, priority](int id) {
+            return this->jobs[id].priority < priority;
+        });
+        this->queued.insert(position, job.id);
+
+        removeOldJobs();
+        startJobs();
+        return job.id;
+    }
+
+    /*
+     * getJob copies the job with the specified id, returns false if there is no such job
+     */
+    bool JobQueue::getJob(int id, Job &job) {
+        lock_guard<mutex> guard(this->lock);
+        auto it = this->jobs.find(id);
+        if (it == this->jobs.end()) return false;
+        job = it->second;
+        return true;
+    }
+
+    /*
+     * getStatus returns the state of the queue and its budget as a JSON object
+     * The memory in use includes the clumps and tiles of the running jobs, see MemoryBudget
+     */
+    json JobQueue::getStatus() {
+        lock_guard<mutex> guard(this->lock);
+        json j;
+        j["queued"] = this->queued.size();
+        j["running"] = this->runningJobs;
+        j["maxQueued"] = this->maxQueued;
+        j["cpuBudget"] = this->cpuBudget;
+        j["cpusInUse"] = this->cpusInUse;
+        j["memoryBudget"] = MemoryBudget::getInstance().getLimit();
+        j["memoryInUse"] = MemoryBudget::getInstance().getInUse();
+        return j;
+    }
+
+    /*
+     * getJobs returns the status of every job that is still tracked
+     */
+    json JobQueue::getJobs() {
+        lock_guard<mutex> guard(this->lock);
+        json j = json::array();
+        for (auto &job : this->jobs) {
+            j.push_back(job.second.toJSON());
+        }
+        return j;
+    }
+
+    /*
+     * stop rejects new jobs, drops the jobs that haven't started and waits for running jobs to finish
+     */
+    void JobQueue::stop() {
+        unique_lock<mutex> guard(this->lock);
+        this->stopping = true;
+        auto now = chrono::system_clock::now();
+        for (int id : this->queued) {
+            this->jobs[id].status = JOB_FAILED;
+            this->jobs[id].error = "Server stopped";
+            this->jobs[id].finished = now;
+        }
+        this->queued.clear();
+        this->changed.wait(guard, [this]() { return this->runningJobs == 0; });
+    }
+
+    /*
+     * canStart returns true if a job fits in the remaining cores and reserves its memory from the MemoryBudget
+     * A job is always allowed to start when nothing else is running so that jobs
+     * larger than the budget are not queued forever
+     */
+    bool JobQueue::canStart(const Job &job) {
+        if (this->runningJobs > 0 && this->cpusInUse + job.cpus > this->cpuBudget) return false;
+        return MemoryBudget::getInstance().tryReserve(job.memory, this->runningJobs == 0);
+    }
+
+    /*
+     * startJobs starts queued jobs in priority order until the budget is used up
+     * A job that doesn't fit is retried when a running job finishes
+     * The lock must be held by the caller
+     */
+    void JobQueue::startJobs() {
+        while (!this->queued.empty()) {
+            Job *job = &this->jobs[this->queued.front()];
+            // Only the front of the queue is considered so large jobs are not starved by smaller ones
+            if (!canStart(*job)) break;
+            this->queued.erase(this->queued.begin());
+
+            job->status = JOB_RUNNING;
+            job->started = chrono::system_clock::now();
+            this->cpusInUse += job->cpus;
+            this->runningJobs++;
+
+            thread(&JobQueue::runJob, this, job->id).detach();
+        }
+    }
+
+    /*
+     * runJob runs a job on its own thread and releases its budget when it finishes
+     */
+    void JobQueue::runJob(int id) {
+        Job job;
+        {
+            lock_guard<mutex> guard(this->lock);
+            job = this->jobs[id];
+        }
+
+        string error;
+        try {
+            this->jobFunction(&job);
+        } catch (const exception &ex) {
+            error = ex.what();
+        } catch (...) {
+            error = "Unknown error";
+        }
+
+        lock_guard<mutex> guard(this->lock);
+        Job *finishedJob = &this->jobs[id];
+        finishedJob->finished = chrono::system_clock::now();
+        finishedJob->status = error.empty() ? JOB_DONE : JOB_FAILED;
+        finishedJob->error = error;
+        this->cpusInUse -= finishedJob->cpus;
+        MemoryBudget::getInstance().release(finishedJob->memory);
+        this->runningJobs--;
+
+        startJobs();
+        this->changed.notify_all();
+    }
+
+    /*
+     * removeOldJobs forgets the oldest finished jobs once more than maxHistory jobs are tracked
+     * The lock must be held by the caller
+     */
+    void JobQueue::removeOldJobs() {
+        auto it = this->jobs.begin();
+        while (this->jobs.size() > this->maxHistory && it != this->jobs.end()) {
+            if (it->second.status == JOB_DONE || it->second.status == JOB_FAILED) {
+                it = this->jobs.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+}
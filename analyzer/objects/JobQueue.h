@@ -0,0 +1,81 @@
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include "../thirdparty/nlohmann/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace segment {
+    enum JobStatus {
+        JOB_QUEUED,
+        JOB_RUNNING,
+        JOB_DONE,
+        JOB_FAILED
+    };
+
+    class Job {
+    public:
+        int id;
+        // Jobs with a higher priority are started first, jobs of equal priority are started in order
+        int priority;
+        // Number of cores and bytes of memory the job is expected to use while running
+        int cpus;
+        size_t memory;
+        // Options of the job in the form "--name=value"
+        vector<string> args;
+        JobStatus status;
+        string error;
+        chrono::system_clock::time_point submitted;
+        // Left at the epoch for jobs that were dropped before they started
+        chrono::system_clock::time_point started;
+        // Time the job finished or failed, including jobs dropped by JobQueue::stop
+        chrono::system_clock::time_point finished;
+
+        json toJSON() const;
+    };
+
+    class JobQueue {
+    private:
+        int maxQueued;
+        int cpuBudget;
+        int maxHistory = 1000;
+
+        int cpusInUse = 0;
+        int runningJobs = 0;
+        int nextId = 1;
+        bool stopping = false;
+
+        map<int, Job> jobs;
+        vector<int> queued;
+        mutex lock;
+        condition_variable changed;
+        function<void(Job *)> jobFunction;
+
+    public:
+        JobQueue(int maxQueued, int cpuBudget, const function<void(Job *)> &jobFunction);
+        ~JobQueue();
+        int submit(const vector<string> &args, int priority, int cpus, size_t memory);
+        bool getJob(int id, Job &job);
+        json getStatus();
+        json getJobs();
+        void stop();
+
+    private:
+        bool canStart(const Job &job);
+        void startJobs();
+        void runJob(int id);
+        void removeOldJobs();
+    };
+
+    string getJobStatusName(JobStatus status);
+}
+
+#endif //JOBQUEUE_H
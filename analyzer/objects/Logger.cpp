@@ -0,0 +1,211 @@
+#include "Logger.h"
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+namespace segment {
+    // Lowest level that is logged and whether only warnings and errors are printed to the console
+    static atomic<int> logLevel(LOG_DEBUG);
+    static atomic<bool> logQuiet(false);
+    // Number of messages a thread can queue before it waits for the writer
+    static const size_t RING_CAPACITY = 4096;
+    // Time the writer sleeps between passes if no thread is waiting on it
+    static const chrono::milliseconds WRITER_INTERVAL(50);
+
+    /*
+     * parseLogLevel converts debug, info, warning or error to a LogLevel
+     * Throws an invalid_argument for other levels
+     */
+    LogLevel parseLogLevel(const string &level) {
+        if (level == "debug") return LOG_DEBUG;
+        if (level == "info") return LOG_INFO;
+        if (level == "warning") return LOG_WARNING;
+        if (level == "error") return LOG_ERROR;
+        throw invalid_argument("Unknown log level: " + level);
+    }
+
+    /*
+     * Constructor for LogFile
+     * path: file the messages are written to, its directory is created and the file is truncated
+     */
+    LogFile::LogFile(boost::filesystem::path path) {
+        this->path = path.string();
+        boost::filesystem::create_directories(path.parent_path());
+        this->file = fopen(this->path.c_str(), "w");
+        if (!this->file) {
+            cerr << "Could not open log file: " << this->path << endl;
+        }
+    }
+
+    LogFile::~LogFile() {
+        if (this->file) {
+            fclose(this->file);
+        }
+    }
+
+    Logger::Ring::Ring(size_t capacity) : entries(capacity), head(0), tail(0), abandoned(false) {}
+
+    Logger::RingOwner::~RingOwner() {
+        if (this->ring) {
+            this->ring->abandoned = true;
+        }
+    }
+
+    Logger::Logger() {
+        this->writer = thread(&Logger::runWriter, this);
+    }
+
+    /*
+     * getInstance returns the process wide logger, it is created on first use
+     * The logger is never destroyed so threads can log until the process exits, flush must be called
+     * before exiting for the last messages to be written
+     */
+    Logger &Logger::getInstance() {
+        static Logger *logger = new Logger();
+        return *logger;
+    }
+
+    /*
+     * setLevel sets the lowest level that is logged, messages below it are discarded
+     */
+    void Logger::setLevel(LogLevel level) {
+        logLevel = level;
+    }
+
+    /*
+     * setQuiet only prints warnings and errors to the console if true, log files are not affected
+     */
+    void Logger::setQuiet(bool quiet) {
+        logQuiet = quiet;
+    }
+
+    bool Logger::isEnabled(LogLevel level) {
+        return level >= logLevel;
+    }
+
+    /*
+     * getRing returns the ring of the calling thread, it is created the first time the thread logs
+     */
+    Logger::Ring &Logger::getRing() {
+        static thread_local RingOwner owner;
+        if (!owner.ring) {
+            owner.ring = make_shared<Ring>(RING_CAPACITY);
+            lock_guard<mutex> guard(this->lock);
+            this->rings.push_back(owner.ring);
+        }
+        return *owner.ring;
+    }
+
+    /*
+     * log queues a message to be written to the console and to file, file may be null
+     * Waits for the writer if the calling thread's ring is full
+     */
+    void Logger::log(LogLevel level, const shared_ptr<LogFile> &file, string message) {
+        if (!isEnabled(level)) return;
+        Ring &ring = getRing();
+        size_t capacity = ring.entries.size();
+        size_t tail = ring.tail.load(memory_order_relaxed);
+        if (tail - ring.head.load(memory_order_acquire) == capacity) {
+            unique_lock<mutex> guard(this->lock);
+            this->flushWaiters++;
+            this->wake.notify_one();
+            this->drained.wait(guard, [&ring, tail, capacity]() {
+                return tail - ring.head.load(memory_order_acquire) < capacity;
+            });
+            this->flushWaiters--;
+        }
+
+        Entry &entry = ring.entries[tail % capacity];
+        entry.level = level;
+        entry.file = file;
+        entry.message = move(message);
+        ring.tail.store(tail + 1, memory_order_release);
+        // Wake the writer early if the ring is filling up faster than it is drained
+        if (tail + 1 - ring.head.load(memory_order_relaxed) == capacity / 2) {
+            this->wake.notify_one();
+        }
+    }
+
+    /*
+     * log formats a message like vprintf and queues it, nothing is formatted if the level is disabled
+     */
+    void Logger::log(LogLevel level, const shared_ptr<LogFile> &file, const char *format, va_list args) {
+        if (!isEnabled(level)) return;
+        va_list sizeArgs;
+        va_copy(sizeArgs, args);
+        int length = vsnprintf(nullptr, 0, format, sizeArgs);
+        va_end(sizeArgs);
+        if (length < 0) return;
+        vector<char> buffer(length + 1);
+        vsnprintf(buffer.data(), buffer.size(), format, args);
+        log(level, file, string(buffer.data(), length));
+    }
+
+    /*
+     * flush waits until every message logged before it was called is written
+     */
+    void Logger::flush() {
+        unique_lock<mutex> guard(this->lock);
+        // The pass running now may have missed the messages, wait for the one after it
+        uint64_t target = this->passes + 2;
+        this->flushWaiters++;
+        this->wake.notify_one();
+        this->drained.wait(guard, [this, target]() { return this->passes >= target; });
+        this->flushWaiters--;
+    }
+
+    void Logger::runWriter() {
+        unique_lock<mutex> guard(this->lock);
+        while (true) {
+            this->wake.wait_for(guard, WRITER_INTERVAL, [this]() { return this->flushWaiters > 0; });
+            vector<shared_ptr<Ring>> rings = this->rings;
+            guard.unlock();
+
+            // Files are kept open until their messages are flushed
+            vector<shared_ptr<LogFile>> files;
+            for (shared_ptr<Ring> &ring : rings) {
+                size_t head = ring->head.load(memory_order_relaxed);
+                size_t tail = ring->tail.load(memory_order_acquire);
+                for (; head < tail; head++) {
+                    Entry &entry = ring->entries[head % ring->entries.size()];
+                    write(entry);
+                    if (entry.file && find(files.begin(), files.end(), entry.file) == files.end()) {
+                        files.push_back(entry.file);
+                    }
+                    entry.file.reset();
+                    entry.message.clear();
+                    ring->head.store(head + 1, memory_order_release);
+                }
+            }
+            fflush(stdout);
+            for (shared_ptr<LogFile> &file : files) {
+                if (file->file) fflush(file->file);
+            }
+            files.clear();
+
+            guard.lock();
+            this->rings.erase(remove_if(this->rings.begin(), this->rings.end(), [](const shared_ptr<Ring> &ring) {
+                return ring->abandoned && ring->head.load() == ring->tail.load();
+            }), this->rings.end());
+            this->passes++;
+            this->drained.notify_all();
+        }
+    }
+
+    /*
+     * write prints a message to the console and appends it to its log file
+     */
+    void Logger::write(Entry &entry) {
+        const char *prefix = entry.level == LOG_ERROR ? "Error: " : entry.level == LOG_WARNING ? "Warning: " : "";
+        if (entry.level >= LOG_WARNING) {
+            fprintf(stderr, "%s%s", prefix, entry.message.c_str());
+        } else if (!logQuiet) {
+            fputs(entry.message.c_str(), stdout);
+        }
+        if (entry.file && entry.file->file) {
+            fprintf(entry.file->file, "%s%s", prefix, entry.message.c_str());
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "boost/filesystem.hpp"
+#include <cstdio>
+#include <cstdarg>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+using namespace std;
+
+namespace segment {
+    enum LogLevel {
+        LOG_DEBUG,
+        LOG_INFO,
+        LOG_WARNING,
+        LOG_ERROR
+    };
+
+    LogLevel parseLogLevel(const string &level);
+
+    /*
+     * LogFile is a log file that messages are appended to, it is opened once and truncated when it is created
+     * The file is closed once the last message written to it is written
+     */
+    class LogFile {
+    public:
+        string path;
+        FILE *file = nullptr;
+
+        LogFile(boost::filesystem::path path);
+        LogFile(const LogFile &) = delete;
+        LogFile &operator=(const LogFile &) = delete;
+        ~LogFile();
+    };
+
+    /*
+     * Logger is the process wide logger that writes the messages of every thread to the console and to log files.
+     * Each thread queues its messages in its own ring buffer without taking a lock, a single writer thread drains
+     * the rings and writes the messages. The messages of a thread are written in the order they were logged.
+     * A thread whose ring is full waits for the writer instead of dropping messages.
+     * Messages below the level are discarded before they are formatted, in quiet mode only warnings and errors
+     * are printed to the console while log files still get every message of the level.
+     */
+    class Logger {
+    private:
+        class Entry {
+        public:
+            LogLevel level;
+            shared_ptr<LogFile> file;
+            string message;
+        };
+
+        class Ring {
+        public:
+            vector<Entry> entries;
+            // Entries are read at head and written at tail, both only grow
+            atomic<size_t> head;
+            atomic<size_t> tail;
+            // Set when the thread owning the ring exits, the ring is removed once it is drained
+            atomic<bool> abandoned;
+
+            Ring(size_t capacity);
+        };
+
+        class RingOwner {
+        public:
+            shared_ptr<Ring> ring;
+            ~RingOwner();
+        };
+
+        vector<shared_ptr<Ring>> rings;
+        thread writer;
+        mutex lock;
+        condition_variable wake;
+        condition_variable drained;
+        // Number of passes the writer finished, flush waits for a pass that started after it was called
+        uint64_t passes = 0;
+        // Threads waiting on the writer, passes run back to back while there are any
+        int flushWaiters = 0;
+
+        Logger();
+        Ring &getRing();
+        void runWriter();
+        void write(Entry &entry);
+
+    public:
+        static Logger &getInstance();
+        static void setLevel(LogLevel level);
+        static void setQuiet(bool quiet);
+        bool isEnabled(LogLevel level);
+        void log(LogLevel level, const shared_ptr<LogFile> &file, string message);
+        void log(LogLevel level, const shared_ptr<LogFile> &file, const char *format, va_list args);
+        void flush();
+    };
+}
+
+#endif //LOGGER_H
@@ -0,0 +1,160 @@
+#include "MaskFile.h"
+#include "Varint.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <functional>
+
+using namespace std;
+
+namespace segment {
+    // Written at the start of every mask file, changes when the format changes
+    static const char MASK_MAGIC[8] = {'C', 'Y', 'T', 'O', 'M', 'S', 'K', '1'};
+    static const uint32_t MASK_RAW = 0;
+    static const uint32_t MASK_RLE = 1;
+
+    class MaskHeader {
+    public:
+        char magic[8];
+        uint32_t rows;
+        uint32_t cols;
+        uint32_t encoding;
+        uint32_t reserved;
+        uint64_t payloadLength;
+    };
+
+    /*
+     * encodeRuns run-length encodes the pixels of a mask in row order
+     * Gives up and returns false as soon as the runs are larger than the raw pixels
+     */
+    static bool encodeRuns(const cv::Mat &mask, string &runs) {
+        size_t rawSize = mask.total();
+        unsigned char value = mask.at<unsigned char>(0, 0);
+        uint64_t length = 0;
+        for (int row = 0; row < mask.rows; row++) {
+            const unsigned char *pixels = mask.ptr<unsigned char>(row);
+            for (int col = 0; col < mask.cols; col++) {
+                if (pixels[col] == value) {
+                    length++;
+                    continue;
+                }
+                runs.push_back((char) value);
+                writeVarint(runs, length);
+                if (runs.size() >= rawSize) return false;
+                value = pixels[col];
+                length = 1;
+            }
+        }
+        runs.push_back((char) value);
+        writeVarint(runs, length);
+        return runs.size() < rawSize;
+    }
+
+    /*
+     * writeMaskFile writes a CV_8UC1 mask to path
+     * Returns false if the mask isn't a single channel 8 bit matrix or can't be written
+     */
+    bool writeMaskFile(const string &path, const cv::Mat &mask) {
+        if (mask.empty() || mask.type() != CV_8UC1) {
+            cerr << "Only single channel 8 bit masks can be written to a mask file: " << path << endl;
+            return false;
+        }
+
+        string payload;
+        MaskHeader header;
+        memcpy(header.magic, MASK_MAGIC, sizeof(MASK_MAGIC));
+        header.rows = mask.rows;
+        header.cols = mask.cols;
+        header.reserved = 0;
+        header.encoding = MASK_RLE;
+        if (!encodeRuns(mask, payload)) {
+            header.encoding = MASK_RAW;
+            payload.clear();
+            payload.reserve(mask.total());
+            for (int row = 0; row < mask.rows; row++) {
+                payload.append((const char *) mask.ptr<unsigned char>(row), mask.cols);
+            }
+        }
+        header.payloadLength = payload.size();
+
+        // Another thread or process may write the same cache entry at the same time
+        string tmpPath = path + "." + to_string(getpid()) + "_" +
+                         to_string(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+        FILE *file = fopen(tmpPath.c_str(), "wb");
+        if (!file) {
+            cerr << "Could not write mask file: " << path << endl;
+            return false;
+        }
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                       fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+        written = fflush(file) == 0 && fdatasync(fileno(file)) == 0 && written;
+        fclose(file);
+        if (!written || rename(tmpPath.c_str(), path.c_str()) != 0) {
+            cerr << "Could not write mask file: " << path << endl;
+            remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     * readMaskFile memory-maps and decodes a mask file
+     * Returns an empty Mat if the file doesn't exist or isn't a valid mask file
+     */
+    cv::Mat readMaskFile(const string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return cv::Mat();
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || (size_t) fileStat.st_size < sizeof(MaskHeader)) {
+            close(fd);
+            return cv::Mat();
+        }
+        size_t fileSize = fileStat.st_size;
+        void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return cv::Mat();
+        madvise(mapped, fileSize, MADV_SEQUENTIAL);
+
+        const unsigned char *data = (const unsigned char *) mapped;
+        MaskHeader header;
+        memcpy(&header, data, sizeof(header));
+        const unsigned char *position = data + sizeof(header);
+        const unsigned char *end = data + fileSize;
+
+        cv::Mat mask;
+        if (memcmp(header.magic, MASK_MAGIC, sizeof(MASK_MAGIC)) == 0 &&
+            header.payloadLength == fileSize - sizeof(header)) {
+            mask.create(header.rows, header.cols, CV_8UC1);
+            unsigned char *pixels = mask.data;
+            size_t total = mask.total();
+            size_t decoded = 0;
+            if (header.encoding == MASK_RAW && header.payloadLength == total) {
+                memcpy(pixels, position, total);
+                position += total;
+                decoded = total;
+            } else if (header.encoding == MASK_RLE) {
+                while (position < end) {
+                    unsigned char value = *position++;
+                    uint64_t length;
+                    if (!readVarint(position, end, length) || length > total - decoded) break;
+                    memset(pixels + decoded, value, length);
+                    decoded += length;
+                }
+            }
+            if (decoded != total || position != end) {
+                mask.release();
+            }
+        }
+        if (mask.empty()) {
+            cerr << "Invalid mask file: " << path << endl;
+        }
+
+        munmap(mapped, fileSize);
+        return mask;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef MASKFILE_H
+#define MASKFILE_H
+
+#include "opencv2/opencv.hpp"
+#include <string>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * Mask files store a single channel 8 bit mask, such as the gmm predictions, in binary.
+     * The pixels are run-length encoded as (value, varint length) pairs in row order, masks of clumps on
+     * a background are mostly long runs so this is a small fraction of the raw size. Masks that don't
+     * compress are stored raw. Files are written to a temporary file and renamed so a crash or another
+     * writer never leaves a partial mask behind, and are read by memory-mapping them.
+     */
+    bool writeMaskFile(const string &path, const cv::Mat &mask);
+    cv::Mat readMaskFile(const string &path);
+}
+
+#endif //MASKFILE_H
@@ -0,0 +1,62 @@
+#include "MemoryBudget.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * getInstance returns the process wide memory budget, it has no limit until setLimit is called
+     */
+    MemoryBudget &MemoryBudget::getInstance() {
+        static MemoryBudget budget;
+        return budget;
+    }
+
+    /*
+     * setLimit sets the bytes of memory all reservations may use together, 0 for no limit
+     */
+    void MemoryBudget::setLimit(size_t limit) {
+        lock_guard<mutex> guard(this->lock);
+        this->limit = limit;
+    }
+
+    size_t MemoryBudget::getLimit() {
+        lock_guard<mutex> guard(this->lock);
+        return this->limit;
+    }
+
+    size_t MemoryBudget::getInUse() {
+        lock_guard<mutex> guard(this->lock);
+        return this->inUse;
+    }
+
+    /*
+     * fits returns true if bytes of memory fit in the remaining budget, without reserving them
+     */
+    bool MemoryBudget::fits(size_t bytes) {
+        lock_guard<mutex> guard(this->lock);
+        return this->limit == 0 || this->inUse + bytes <= this->limit;
+    }
+
+    /*
+     * tryReserve reserves bytes of memory if they fit in the remaining budget, returns false otherwise
+     * force: reserve even if it exceeds the budget. Used when the caller has nothing else running,
+     *        so tasks larger than the budget still run one at a time instead of never starting.
+     */
+    bool MemoryBudget::tryReserve(size_t bytes, bool force) {
+        lock_guard<mutex> guard(this->lock);
+        if (!force && this->limit > 0 && this->inUse + bytes > this->limit) {
+            return false;
+        }
+        this->inUse += bytes;
+        return true;
+    }
+
+    /*
+     * release returns reserved bytes of memory to the budget
+     */
+    void MemoryBudget::release(size_t bytes) {
+        lock_guard<mutex> guard(this->lock);
+        this->inUse -= min(bytes, this->inUse);
+    }
+}
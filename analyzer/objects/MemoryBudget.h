@@ -0,0 +1,36 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <mutex>
+#include <cstddef>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * MemoryBudget is the process wide budget of memory that running jobs, images, clumps and preprocessing tiles
+     * may use, shared by every image being segmented. It is the only memory limit, set by --memoryLimit.
+     * Jobs of the JobQueue and images of the BatchSegmenter reserve their estimated memory when they start,
+     * tasks reserve their predicted memory before they are submitted to the thread pool, and both release it
+     * when they finish. Reserving never blocks, callers that can't reserve wait for their own work to finish.
+     */
+    class MemoryBudget {
+    private:
+        mutex lock;
+        size_t limit = 0;
+        size_t inUse = 0;
+
+        MemoryBudget() {}
+
+    public:
+        static MemoryBudget &getInstance();
+        void setLimit(size_t limit);
+        size_t getLimit();
+        size_t getInUse();
+        bool fits(size_t bytes);
+        bool tryReserve(size_t bytes, bool force = false);
+        void release(size_t bytes);
+    };
+}
+
+#endif //MEMORYBUDGET_H
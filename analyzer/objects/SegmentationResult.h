@@ -0,0 +1,40 @@
+#ifndef SEGMENTATIONRESULT_H
+#define SEGMENTATIONRESULT_H
+
+#include "opencv2/opencv.hpp"
+#include "../thirdparty/nlohmann/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace segment {
+    /*
+     * Results of segmenting an image in memory, every contour is in image coordinates
+     */
+    class CellResult {
+    public:
+        vector<cv::Point> nucleusBoundary;
+        // Boundary estimated by initial cell segmentation
+        vector<cv::Point> initialBoundary;
+        // Boundary found by overlapping cell segmentation
+        vector<cv::Point> boundary;
+        double nucleusArea;
+        double area;
+    };
+
+    class ClumpResult {
+    public:
+        vector<cv::Point> boundary;
+        cv::Rect boundingRect;
+        vector<CellResult> cells;
+    };
+
+    class SegmentationResult {
+    public:
+        vector<ClumpResult> clumps;
+        // Time in seconds of each stage and the size of the output, same as Segmenter::stats
+        json stats;
+    };
+}
+
+#endif //SEGMENTATIONRESULT_H
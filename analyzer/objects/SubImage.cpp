@@ -3,19 +3,30 @@
 #include "../functions/Preprocessing.h"
 
 namespace segment {
-    SubImage::SubImage(cv::Mat *image, int i, int j, int subMatWidth, int subMatHeight, int paddingWidth, int paddingHeight) {
+    SubImage::SubImage(cv::Mat *image, int i, int j, int subMatWidth, int subMatHeight, int paddingWidth, int paddingHeight) :
+            SubImage(image->size(), cv::Point(), i, j, subMatWidth, subMatHeight, paddingWidth, paddingHeight) {
         this->image = image;
+        this->mat = getMat();
+    }
+
+    /*
+     * Constructor for a SubImage without pixels, they are read when it is processed
+     * imageSize: size of the region of the image that was split
+     * origin: position of the region in the image
+     */
+    SubImage::SubImage(cv::Size imageSize, cv::Point origin, int i, int j, int subMatWidth, int subMatHeight, int paddingWidth, int paddingHeight) {
+        this->imageSize = imageSize;
+        this->origin = origin;
         this->x = i * subMatWidth;
         this->y = j * subMatHeight;
         this->subMatWidth = subMatWidth;
         this->subMatHeight = subMatHeight;
         this->i = i;
         this->j = j;
-        this->maxI = ceil(image->cols / (double) subMatWidth) - 1;
-        this->maxJ = ceil(image->rows / (double) subMatHeight) - 1;
+        this->maxI = ceil(imageSize.width / (double) subMatWidth) - 1;
+        this->maxJ = ceil(imageSize.height / (double) subMatHeight) - 1;
         this->paddingWidth = paddingWidth;
         this->paddingHeight = paddingHeight;
-        this->mat = getMat();
     }
 
 
@@ -23,6 +34,22 @@ namespace segment {
         return crop(image, x, y, subMatWidth, subMatHeight, paddingWidth, paddingHeight);
     }
 
+    /*
+     * getRect returns the region of the image the subimage covers, including its padding
+     */
+    cv::Rect SubImage::getRect() {
+        cv::Rect rect = cv::Rect(x - paddingWidth, y - paddingHeight, subMatWidth + (paddingWidth * 2), subMatHeight + (paddingHeight * 2));
+        return rect & cv::Rect(cv::Point(), imageSize);
+    }
+
+    /*
+     * getCoreRect returns the region of the image the subimage covers without its padding
+     * The cores of the subimages of splitMat cover the image without overlapping
+     */
+    cv::Rect SubImage::getCoreRect() {
+        return cv::Rect(x, y, subMatWidth, subMatHeight) & cv::Rect(cv::Point(), imageSize);
+    }
+
     cv::Mat SubImage::undoPadding() {
         int x = this->paddingWidth;
         int y = this->paddingHeight;
@@ -78,17 +105,29 @@ namespace segment {
     // paddingWidth: percent of overlap along the horizontal axis
     // paddingHeight: percent of overlap along the vertical axis
     vector<SubImage> splitMat(cv::Mat *mat, int numberSubMatX, int numberSubMatY, double paddingWidth, double paddingHeight) {
-        int subMatWidth = ceil(mat->cols / (double) numberSubMatX);
-        int subMatHeight = ceil(mat->rows / (double) numberSubMatY);
+        vector<SubImage> subImages = splitRegion(cv::Rect(cv::Point(), mat->size()), numberSubMatX, numberSubMatY, paddingWidth, paddingHeight);
+        for (SubImage &subImage : subImages) {
+            subImage.image = mat;
+            subImage.mat = subImage.getMat();
+        }
+        return subImages;
+    }
+
+    // Divides a region of an image into subImages like splitMat, but without pixels. Each subImage is read with
+    // Image::readRegion(subImage.getRect() + subImage.origin) when it is processed, so the image doesn't have to
+    // be in memory.
+    vector<SubImage> splitRegion(cv::Rect region, int numberSubMatX, int numberSubMatY, double paddingWidth, double paddingHeight) {
+        int subMatWidth = ceil(region.width / (double) numberSubMatX);
+        int subMatHeight = ceil(region.height / (double) numberSubMatY);
         paddingWidth = ceil(paddingWidth * subMatWidth);
         paddingHeight = ceil(paddingHeight * subMatHeight);
         vector<SubImage> subImages;
         for (int i = 0; i < numberSubMatX; i++) {
             for (int j = 0; j < numberSubMatY; j++) {
-                SubImage subImage = SubImage(mat, i, j, subMatWidth, subMatHeight, paddingWidth, paddingHeight);
+                SubImage subImage = SubImage(region.size(), region.tl(), i, j, subMatWidth, subMatHeight, paddingWidth, paddingHeight);
                 subImages.push_back(subImage);
             }
         }
         return subImages;
     }
-}
\ No newline at end of file
+}
@@ -8,7 +8,11 @@ namespace segment {
     class SubImage {
     public:
         cv::Mat mat;
-        cv::Mat *image;
+        // Matrix the subimage is a region of, null if its pixels are read with Image::readRegion
+        cv::Mat *image = nullptr;
+        // Size of the region that was split and the position of its top left corner in the image
+        cv::Size imageSize;
+        cv::Point origin;
         int x;
         int y;
         int i;
@@ -20,11 +24,15 @@ namespace segment {
         int paddingWidth;
         int paddingHeight;
         SubImage(cv::Mat *mat, int i, int j, int subMatWidth, int subMatHeight, int paddingWidth, int paddingHeight);
+        SubImage(cv::Size imageSize, cv::Point origin, int i, int j, int subMatWidth, int subMatHeight, int paddingWidth, int paddingHeight);
         cv::Mat getMat();
+        cv::Rect getRect();
+        cv::Rect getCoreRect();
         cv::Mat undoPadding();
         cv::Mat crop(cv::Mat *mat, int x, int y, int width, int height, int paddingWidth, int paddingHeight);
     };
     vector<SubImage> splitMat(cv::Mat *mat, int numberSubMatX, int numberSubMatY, double paddingWidth = 0.0, double paddingHeight = 0.0);
+    vector<SubImage> splitRegion(cv::Rect region, int numberSubMatX, int numberSubMatY, double paddingWidth = 0.0, double paddingHeight = 0.0);
 }
 
 
@@ -0,0 +1,210 @@
+#include "ThreadPool.h"
+#include "opencv2/opencv.hpp"
+#include <algorithm>
+
+using namespace std;
+
+namespace segment {
+    // Number of threads the pool is created with, 0 to use every core
+    static int poolThreads = 0;
+    // The pool and worker index of the current thread, -1 if it isn't a pool worker
+    static thread_local ThreadPool *currentPool = nullptr;
+    static thread_local int currentWorker = -1;
+
+    static mutex openCVLock;
+    static int openCVLimits = 0;
+    static int openCVThreads = 0;
+
+    /*
+     * Constructor for ThreadPool
+     * numThreads: number of worker threads
+     * OpenCV is set to the same number of threads so --threads also limits OpenCV's own parallelism
+     */
+    ThreadPool::ThreadPool(int numThreads) {
+        this->pendingTasks = 0;
+        this->nextWorker = 0;
+        cv::setNumThreads(numThreads);
+        for (int i = 0; i < numThreads; i++) {
+            this->workers.push_back(unique_ptr<Worker>(new Worker()));
+        }
+        for (int i = 0; i < numThreads; i++) {
+            this->threads.push_back(thread(&ThreadPool::runWorker, this, i));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            lock_guard<mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->taskReady.notify_all();
+        for (thread &worker : this->threads) {
+            worker.join();
+        }
+    }
+
+    /*
+     * getInstance returns the process wide thread pool, it is created on first use
+     */
+    ThreadPool &ThreadPool::getInstance() {
+        static ThreadPool pool(poolThreads > 0 ? poolThreads : max(1, (int) thread::hardware_concurrency()));
+        return pool;
+    }
+
+    /*
+     * setNumThreads sets the number of threads of the pool, it must be called before the pool is first used
+     */
+    void ThreadPool::setNumThreads(int numThreads) {
+        poolThreads = numThreads;
+    }
+
+    int ThreadPool::getNumThreads() {
+        return this->workers.size();
+    }
+
+    /*
+     * submit queues a task to run on the pool
+     * Tasks submitted from a worker are queued on that worker so they run close to their parent task
+     * group: group the task belongs to, threads waiting on the group only run its tasks, see waitUntil
+     */
+    void ThreadPool::submit(const function<void()> &task, const void *group) {
+        int workerIdx = isWorkerThread() ? currentWorker : this->nextWorker++ % this->workers.size();
+        Worker *worker = this->workers[workerIdx].get();
+        {
+            lock_guard<mutex> guard(worker->lock);
+            worker->tasks.push_back({task, group});
+        }
+        {
+            lock_guard<mutex> guard(this->lock);
+            this->pendingTasks++;
+        }
+        this->taskReady.notify_one();
+    }
+
+    /*
+     * popTask takes the oldest task of a worker's own queue, or steals one from another worker
+     * Tasks are run in the order they were submitted so callers can order them by priority
+     * group: only take a task of this group, any task if null
+     * Returns false if every queue is empty
+     */
+    bool ThreadPool::popTask(int workerIdx, function<void()> &task, const void *group) {
+        int numWorkers = this->workers.size();
+        for (int i = 0; i < numWorkers; i++) {
+            Worker *worker = this->workers[(workerIdx + i) % numWorkers].get();
+            lock_guard<mutex> guard(worker->lock);
+            auto it = worker->tasks.begin();
+            if (group) {
+                it = find_if(worker->tasks.begin(), worker->tasks.end(), [group](const Task &queued) {
+                    return queued.group == group;
+                });
+            }
+            if (it == worker->tasks.end()) continue;
+            task = move(it->run);
+            worker->tasks.erase(it);
+            this->pendingTasks--;
+            return true;
+        }
+        return false;
+    }
+
+    /*
+     * runPendingTask runs a queued task on the calling thread, returns false if there was none
+     * group: only run a task of this group, any task if null
+     */
+    bool ThreadPool::runPendingTask(const void *group) {
+        function<void()> task;
+        int workerIdx = isWorkerThread() ? currentWorker : 0;
+        if (!popTask(workerIdx, task, group)) return false;
+        task();
+        return true;
+    }
+
+    /*
+     * isWorkerThread returns true if the calling thread is one of the pool's workers
+     */
+    bool ThreadPool::isWorkerThread() {
+        return currentPool == this;
+    }
+
+    /*
+     * runWorker runs tasks until the pool is destroyed
+     */
+    void ThreadPool::runWorker(int workerIdx) {
+        currentPool = this;
+        currentWorker = workerIdx;
+        while (true) {
+            function<void()> task;
+            if (popTask(workerIdx, task)) {
+                task();
+                continue;
+            }
+            unique_lock<mutex> guard(this->lock);
+            this->taskReady.wait(guard, [this]() { return this->stopping || this->pendingTasks > 0; });
+            if (this->stopping) return;
+        }
+    }
+
+    /*
+     * Constructor for TaskGroup
+     * pool: thread pool the tasks are run on
+     */
+    TaskGroup::TaskGroup(ThreadPool &pool) {
+        this->pool = &pool;
+    }
+
+    // Tasks reference the group, so it can't be destroyed before they finish
+    TaskGroup::~TaskGroup() {
+        unique_lock<mutex> guard(this->lock);
+        this->pool->waitUntil(guard, this->tasksDone, [this]() { return this->pendingTasks == 0; }, this);
+    }
+
+    /*
+     * run queues a task on the pool as part of the group
+     */
+    void TaskGroup::run(const function<void()> &task) {
+        {
+            lock_guard<mutex> guard(this->lock);
+            this->pendingTasks++;
+        }
+        this->pool->submit([this, task]() {
+            exception_ptr taskError;
+            try {
+                task();
+            } catch (...) {
+                taskError = current_exception();
+            }
+            lock_guard<mutex> guard(this->lock);
+            if (taskError && !this->error) this->error = taskError;
+            this->pendingTasks--;
+            this->tasksDone.notify_all();
+        }, this);
+    }
+
+    /*
+     * wait waits for every task of the group to finish and rethrows the first exception thrown by a task
+     */
+    void TaskGroup::wait() {
+        unique_lock<mutex> guard(this->lock);
+        this->pool->waitUntil(guard, this->tasksDone, [this]() { return this->pendingTasks == 0; }, this);
+        if (this->error) {
+            exception_ptr taskError = this->error;
+            this->error = nullptr;
+            rethrow_exception(taskError);
+        }
+    }
+
+    OpenCVThreadLimit::OpenCVThreadLimit() {
+        lock_guard<mutex> guard(openCVLock);
+        if (openCVLimits++ == 0) {
+            openCVThreads = cv::getNumThreads();
+            cv::setNumThreads(1);
+        }
+    }
+
+    OpenCVThreadLimit::~OpenCVThreadLimit() {
+        lock_guard<mutex> guard(openCVLock);
+        if (--openCVLimits == 0) {
+            cv::setNumThreads(openCVThreads);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * ThreadPool is the process wide pool of worker threads that clumps and subimages are processed on.
+     * Every worker has its own queue of tasks, idle workers steal tasks from the other queues.
+     * Threads waiting on work submitted to the pool from a worker run other tasks while they wait,
+     * so waiting inside a task does not deadlock the pool. Tasks can be tagged with the group they belong to,
+     * so a thread waiting on a group only runs the tasks of that group.
+     */
+    class ThreadPool {
+    private:
+        class Task {
+        public:
+            function<void()> run;
+            // Group the task belongs to, see TaskGroup, null if it has none
+            const void *group;
+        };
+
+        class Worker {
+        public:
+            mutex lock;
+            deque<Task> tasks;
+        };
+
+        vector<unique_ptr<Worker>> workers;
+        vector<thread> threads;
+        mutex lock;
+        condition_variable taskReady;
+        atomic<int> pendingTasks;
+        atomic<unsigned int> nextWorker;
+        bool stopping = false;
+
+        ThreadPool(int numThreads);
+
+    public:
+        ~ThreadPool();
+        static ThreadPool &getInstance();
+        static void setNumThreads(int numThreads);
+        int getNumThreads();
+        void submit(const function<void()> &task, const void *group = nullptr);
+        bool runPendingTask(const void *group = nullptr);
+        bool isWorkerThread();
+
+        /*
+         * waitUntil waits on condition until predicate is true, the lock must be held by the caller
+         * Pool workers run pending tasks while they wait instead of blocking
+         * predicate may be called any number of times, so it must not have side effects
+         * group: only run the pending tasks of this group, any task if null
+         */
+        template<class Predicate>
+        void waitUntil(unique_lock<mutex> &guard, condition_variable &condition, Predicate predicate,
+                       const void *group = nullptr) {
+            if (!isWorkerThread()) {
+                condition.wait(guard, predicate);
+                return;
+            }
+            while (!predicate()) {
+                guard.unlock();
+                bool ranTask = runPendingTask(group);
+                guard.lock();
+                if (!ranTask && !predicate()) {
+                    condition.wait_for(guard, chrono::milliseconds(1));
+                }
+            }
+        }
+
+    private:
+        bool popTask(int workerIdx, function<void()> &task, const void *group = nullptr);
+        void runWorker(int workerIdx);
+    };
+
+    /*
+     * TaskGroup runs tasks on the thread pool and waits for all of them to finish
+     * A worker waiting on the group only helps with the group's own tasks, so it doesn't start
+     * unrelated work like another clump while the caller waits
+     */
+    class TaskGroup {
+    private:
+        ThreadPool *pool;
+        mutex lock;
+        condition_variable tasksDone;
+        int pendingTasks = 0;
+        exception_ptr error;
+
+    public:
+        TaskGroup(ThreadPool &pool = ThreadPool::getInstance());
+        ~TaskGroup();
+        void run(const function<void()> &task);
+        void wait();
+    };
+
+    /*
+     * OpenCVThreadLimit limits OpenCV to a single thread while it exists.
+     * Used while the pool runs one clump per core so OpenCV's own threads don't oversubscribe the cores.
+     */
+    class OpenCVThreadLimit {
+    public:
+        OpenCVThreadLimit();
+        ~OpenCVThreadLimit();
+    };
+}
+
+#endif //THREADPOOL_H
@@ -0,0 +1,103 @@
+#include "ThumbnailPack.h"
+#include "ArtifactWriter.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * Constructor for ThumbnailPack
+     * path: file the thumbnails are packed into, replaced when finish is called
+     */
+    ThumbnailPack::ThumbnailPack(boost::filesystem::path path) {
+        this->path = path.string();
+        this->tmpPath = this->path + "." + to_string(getpid()) + ".tmp";
+        boost::filesystem::create_directories(path.parent_path());
+        this->fd = open(this->tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (this->fd < 0) {
+            cerr << "Could not write thumbnail pack: " << this->path << endl;
+        }
+    }
+
+    /*
+     * The destructor waits for the queued thumbnails, the pack is discarded if finish wasn't called
+     */
+    ThumbnailPack::~ThumbnailPack() {
+        unique_lock<mutex> guard(this->lock);
+        this->thumbnailDone.wait(guard, [this]() { return this->pending == 0; });
+        if (this->fd >= 0) {
+            close(this->fd);
+            remove(this->tmpPath.c_str());
+        }
+    }
+
+    /*
+     * add queues a thumbnail to be encoded and appended to the pack
+     * thumbnail is not copied and must not be modified afterwards
+     * Returns the index of the thumbnail in getEntries
+     */
+    size_t ThumbnailPack::add(cv::Mat &&thumbnail) {
+        size_t idx;
+        {
+            lock_guard<mutex> guard(this->lock);
+            idx = this->entries.size();
+            this->entries.push_back({0, 0});
+            this->pending++;
+        }
+        ArtifactWriter::getInstance().write(move(thumbnail), [this, idx](vector<uchar> &bytes) {
+            append(idx, bytes);
+        });
+        return idx;
+    }
+
+    /*
+     * append writes an encoded thumbnail to the end of the pack, called on the writer threads
+     */
+    void ThumbnailPack::append(size_t idx, vector<uchar> &bytes) {
+        lock_guard<mutex> guard(this->lock);
+        if (this->fd >= 0 && !bytes.empty()) {
+            if (write(this->fd, bytes.data(), bytes.size()) == (ssize_t) bytes.size()) {
+                this->entries[idx] = {this->size, bytes.size()};
+                this->size += bytes.size();
+            } else {
+                cerr << "Could not write thumbnail " << idx << " to: " << this->path << endl;
+                close(this->fd);
+                this->fd = -1;
+                remove(this->tmpPath.c_str());
+            }
+        }
+        this->pending--;
+        this->thumbnailDone.notify_all();
+    }
+
+    /*
+     * finish waits for the queued thumbnails and replaces the pack of a previous run
+     * Returns false if the pack couldn't be written
+     */
+    bool ThumbnailPack::finish() {
+        unique_lock<mutex> guard(this->lock);
+        this->thumbnailDone.wait(guard, [this]() { return this->pending == 0; });
+        if (this->fd < 0) return false;
+        bool written = fdatasync(this->fd) == 0;
+        close(this->fd);
+        this->fd = -1;
+        if (!written || rename(this->tmpPath.c_str(), this->path.c_str()) != 0) {
+            cerr << "Could not write thumbnail pack: " << this->path << endl;
+            remove(this->tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     * getEntries returns the offset and length in bytes of each thumbnail, a thumbnail that
+     * couldn't be encoded has a length of 0
+     */
+    vector<pair<uint64_t, uint64_t>> ThumbnailPack::getEntries() {
+        lock_guard<mutex> guard(this->lock);
+        return this->entries;
+    }
+}
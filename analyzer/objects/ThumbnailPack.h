@@ -0,0 +1,47 @@
+#ifndef THUMBNAILPACK_H
+#define THUMBNAILPACK_H
+
+#include "opencv2/opencv.hpp"
+#include "boost/filesystem.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * ThumbnailPack writes the thumbnails of an image into a single file instead of one file per cell.
+     * The file is the encoded thumbnails one after the other with nothing in between, each thumbnail is
+     * read with a range read of its offset and length, which are kept in export.json.
+     * Thumbnails are encoded by the ArtifactWriter and appended in the order they finish, the pack is
+     * written to a temporary file and only replaces the pack of a previous run once every thumbnail is in it.
+     */
+    class ThumbnailPack {
+    private:
+        string path;
+        string tmpPath;
+        int fd = -1;
+        uint64_t size = 0;
+        // Offset and length of each thumbnail, by the index add returned
+        vector<pair<uint64_t, uint64_t>> entries;
+        int pending = 0;
+        mutex lock;
+        condition_variable thumbnailDone;
+
+    public:
+        ThumbnailPack(boost::filesystem::path path);
+        ThumbnailPack(const ThumbnailPack &) = delete;
+        ThumbnailPack &operator=(const ThumbnailPack &) = delete;
+        ~ThumbnailPack();
+        size_t add(cv::Mat &&thumbnail);
+        bool finish();
+        vector<pair<uint64_t, uint64_t>> getEntries();
+
+    private:
+        void append(size_t idx, vector<uchar> &bytes);
+    };
+}
+
+#endif //THUMBNAILPACK_H
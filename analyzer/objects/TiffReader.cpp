@@ -0,0 +1,175 @@
+#include "TiffReader.h"
+#include <tiffio.h>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <stdexcept>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * isTiff returns true if a file has a TIFF extension
+     */
+    bool isTiff(const string &path) {
+        string extension = boost::filesystem::path(path).extension().string();
+        transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return extension == ".tif" || extension == ".tiff";
+    }
+
+    /*
+     * Constructor for TiffReader
+     * path: path of the TIFF or BigTIFF file
+     * page: page to read, -1 for the largest page
+     * Throws a runtime_error if the file can't be opened or the page doesn't exist
+     */
+    TiffReader::TiffReader(string path, int page) {
+        this->path = path;
+        this->handle = TIFFOpen(path.c_str(), "r");
+        if (!this->handle) {
+            throw runtime_error("Could not open TIFF: " + path);
+        }
+        try {
+            setPage(page < 0 ? getLargestPage() : page);
+        } catch (...) {
+            TIFFClose(this->handle);
+            throw;
+        }
+    }
+
+    TiffReader::~TiffReader() {
+        if (this->handle) {
+            TIFFClose(this->handle);
+        }
+    }
+
+    int TiffReader::getNumPages() {
+        lock_guard<mutex> guard(this->lock);
+        return TIFFNumberOfDirectories(this->handle);
+    }
+
+    /*
+     * getPageSize returns the width and height of a page without changing the page that is read
+     */
+    cv::Size TiffReader::getPageSize(int page) {
+        lock_guard<mutex> guard(this->lock);
+        uint32_t width = 0, height = 0;
+        if (TIFFSetDirectory(this->handle, page)) {
+            TIFFGetField(this->handle, TIFFTAG_IMAGEWIDTH, &width);
+            TIFFGetField(this->handle, TIFFTAG_IMAGELENGTH, &height);
+        }
+        TIFFSetDirectory(this->handle, this->page);
+        return cv::Size(width, height);
+    }
+
+    /*
+     * getLargestPage returns the page with the most pixels, the full resolution level of a slide's pyramid
+     */
+    int TiffReader::getLargestPage() {
+        int largestPage = 0;
+        double largestArea = -1;
+        for (int page = 0; page < getNumPages(); page++) {
+            double area = getPageSize(page).area();
+            if (area > largestArea) {
+                largestPage = page;
+                largestArea = area;
+            }
+        }
+        return largestPage;
+    }
+
+    /*
+     * setPage selects the page regions are read from
+     */
+    void TiffReader::setPage(int page) {
+        lock_guard<mutex> guard(this->lock);
+        if (page < 0 || page >= TIFFNumberOfDirectories(this->handle) || !TIFFSetDirectory(this->handle, page)) {
+            throw runtime_error("No page " + to_string(page) + " in TIFF: " + this->path);
+        }
+        this->page = page;
+        readPageInfo();
+    }
+
+    int TiffReader::getPage() {
+        return this->page;
+    }
+
+    cv::Size TiffReader::getSize() {
+        return cv::Size(this->width, this->height);
+    }
+
+    /*
+     * readPageInfo reads the size and layout of the current page, the lock must be held by the caller
+     */
+    void TiffReader::readPageInfo() {
+        uint32_t width = 0, height = 0;
+        TIFFGetField(this->handle, TIFFTAG_IMAGEWIDTH, &width);
+        TIFFGetField(this->handle, TIFFTAG_IMAGELENGTH, &height);
+        this->width = width;
+        this->height = height;
+        this->tiled = TIFFIsTiled(this->handle);
+        if (this->tiled) {
+            uint32_t tileWidth = 0, tileHeight = 0;
+            TIFFGetField(this->handle, TIFFTAG_TILEWIDTH, &tileWidth);
+            TIFFGetField(this->handle, TIFFTAG_TILELENGTH, &tileHeight);
+            this->tileWidth = tileWidth;
+            this->tileHeight = tileHeight;
+        } else {
+            uint32_t rowsPerStrip = 0;
+            TIFFGetFieldDefaulted(this->handle, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+            this->tileWidth = width;
+            this->tileHeight = min(rowsPerStrip, height);
+        }
+    }
+
+    /*
+     * readRegion decodes a region of the current page as a BGR image
+     * Only the tiles or strips overlapping the region are decoded. Any compression and color space
+     * libtiff supports can be read, the region is clipped to the page.
+     */
+    cv::Mat TiffReader::readRegion(cv::Rect region) {
+        lock_guard<mutex> guard(this->lock);
+        region &= cv::Rect(0, 0, this->width, this->height);
+        if (region.area() == 0 || this->tileWidth == 0 || this->tileHeight == 0) {
+            return cv::Mat();
+        }
+
+        cv::Mat out(region.size(), CV_8UC3);
+        vector<uint32_t> raster((size_t) this->tileWidth * this->tileHeight);
+        int firstRow = region.y / this->tileHeight * this->tileHeight;
+        int firstColumn = region.x / this->tileWidth * this->tileWidth;
+        for (int y = firstRow; y < region.y + region.height; y += this->tileHeight) {
+            if (this->tiled) {
+                for (int x = firstColumn; x < region.x + region.width; x += this->tileWidth) {
+                    if (!TIFFReadRGBATile(this->handle, x, y, raster.data())) {
+                        throw runtime_error("Could not read tile " + to_string(x) + "," + to_string(y) + " of TIFF: " + this->path);
+                    }
+                    copyTile(raster, this->tileHeight, cv::Rect(x, y, this->tileWidth, this->tileHeight), region, out);
+                }
+            } else {
+                if (!TIFFReadRGBAStrip(this->handle, y, raster.data())) {
+                    throw runtime_error("Could not read strip at row " + to_string(y) + " of TIFF: " + this->path);
+                }
+                int rows = min(this->tileHeight, this->height - y);
+                copyTile(raster, rows, cv::Rect(0, y, this->width, rows), region, out);
+            }
+        }
+        return out;
+    }
+
+    /*
+     * copyTile copies the part of a decoded tile or strip that overlaps the region into out
+     * libtiff decodes to ABGR pixels starting from the bottom row of the tile
+     */
+    void TiffReader::copyTile(const vector<uint32_t> &raster, int rasterRows, cv::Rect tile, cv::Rect region,
+                              cv::Mat &out) {
+        cv::Rect overlap = tile & region;
+        for (int y = overlap.y; y < overlap.y + overlap.height; y++) {
+            const uint32_t *rasterRow = &raster[(size_t) (rasterRows - 1 - (y - tile.y)) * tile.width];
+            cv::Vec3b *outRow = out.ptr<cv::Vec3b>(y - region.y);
+            for (int x = overlap.x; x < overlap.x + overlap.width; x++) {
+                uint32_t abgr = rasterRow[x - tile.x];
+                outRow[x - region.x] = cv::Vec3b(TIFFGetB(abgr), TIFFGetG(abgr), TIFFGetR(abgr));
+            }
+        }
+    }
+}
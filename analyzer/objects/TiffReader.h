@@ -0,0 +1,52 @@
+#ifndef TIFFREADER_H
+#define TIFFREADER_H
+
+#include "opencv2/opencv.hpp"
+#include <string>
+#include <mutex>
+
+using namespace std;
+
+struct tiff;
+
+namespace segment {
+    /*
+     * TiffReader reads regions of a page of a tiled or striped TIFF or BigTIFF file, such as a whole slide image.
+     * Only the tiles or strips that overlap a region are decoded, so regions of slides far larger than memory can be read.
+     * Pages are the images stored in the file, slides usually store a pyramid of resolutions as pages.
+     */
+    class TiffReader {
+    private:
+        struct tiff *handle = nullptr;
+        string path;
+        int page = 0;
+        int width = 0;
+        int height = 0;
+        bool tiled = false;
+        // Size of a tile, or the width of the page and the rows per strip for striped pages
+        int tileWidth = 0;
+        int tileHeight = 0;
+        mutex lock;
+
+    public:
+        TiffReader(string path, int page = -1);
+        TiffReader(const TiffReader &) = delete;
+        TiffReader &operator=(const TiffReader &) = delete;
+        ~TiffReader();
+        int getNumPages();
+        cv::Size getPageSize(int page);
+        int getLargestPage();
+        void setPage(int page);
+        int getPage();
+        cv::Size getSize();
+        cv::Mat readRegion(cv::Rect region);
+
+    private:
+        void readPageInfo();
+        void copyTile(const vector<uint32_t> &raster, int rasterRows, cv::Rect tile, cv::Rect region, cv::Mat &out);
+    };
+
+    bool isTiff(const string &path);
+}
+
+#endif //TIFFREADER_H
@@ -0,0 +1,220 @@
+#include "Trace.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <set>
+#include <algorithm>
+#include "../thirdparty/nlohmann/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace segment {
+    atomic<bool> Trace::enabled(false);
+
+    class TraceEvent {
+    public:
+        const char *name;
+        int clumpIdx;
+        int64_t start;
+        int64_t end;
+    };
+
+    /*
+     * TraceBuffer holds the events of one thread in fixed size chunks
+     * Only the owning thread appends, so recording takes no lock. Chunks never move once allocated
+     * and count is published after the event is written, so the writer can read them at any time.
+     */
+    class TraceBuffer {
+    public:
+        static const int CHUNK_SIZE = 4096;
+        class Chunk {
+        public:
+            TraceEvent events[CHUNK_SIZE];
+            atomic<int> count;
+            Chunk() : count(0) {}
+        };
+
+        int threadId;
+        mutex chunksLock;
+        vector<unique_ptr<Chunk>> chunks;
+        Chunk *current = nullptr;
+
+        void append(const TraceEvent &event) {
+            if (!this->current || this->current->count.load(memory_order_relaxed) == CHUNK_SIZE) {
+                lock_guard<mutex> guard(this->chunksLock);
+                this->chunks.push_back(unique_ptr<Chunk>(new Chunk()));
+                this->current = this->chunks.back().get();
+            }
+            int count = this->current->count.load(memory_order_relaxed);
+            this->current->events[count] = event;
+            this->current->count.store(count + 1, memory_order_release);
+        }
+    };
+
+    // Buffers of every thread that recorded an event, kept after the thread exits
+    static mutex buffersLock;
+    static vector<shared_ptr<TraceBuffer>> buffers;
+    static thread_local TraceBuffer *threadBuffer = nullptr;
+    static thread_local int currentClumpIdx = -1;
+    static const chrono::steady_clock::time_point traceStart = chrono::steady_clock::now();
+    // Start times of the running sessions, spans that started before all of them are no longer needed
+    static mutex sessionsLock;
+    static multiset<int64_t> sessions;
+
+    /*
+     * getThreadBuffer returns the calling thread's buffer, registering it on first use
+     */
+    static TraceBuffer *getThreadBuffer() {
+        if (!threadBuffer) {
+            shared_ptr<TraceBuffer> buffer(new TraceBuffer());
+            lock_guard<mutex> guard(buffersLock);
+            buffer->threadId = buffers.size() + 1;
+            buffers.push_back(buffer);
+            threadBuffer = buffer.get();
+        }
+        return threadBuffer;
+    }
+
+    /*
+     * enable starts recording spans
+     */
+    void Trace::enable() {
+        enabled.store(true);
+    }
+
+    /*
+     * now returns the microseconds since the process started
+     */
+    int64_t Trace::now() {
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - traceStart).count();
+    }
+
+    /*
+     * record adds a span to the calling thread's buffer
+     */
+    void Trace::record(const char *name, int clumpIdx, int64_t start, int64_t end) {
+        getThreadBuffer()->append(TraceEvent{name, clumpIdx, start, end});
+    }
+
+    /*
+     * write writes the spans recorded since a time from now to a Chrome trace JSON file
+     * Spans of every thread are written, including those of other segmentations running at the same time
+     */
+    void Trace::write(string path, int64_t since) {
+        json events = json::array();
+        lock_guard<mutex> guard(buffersLock);
+        for (shared_ptr<TraceBuffer> &buffer : buffers) {
+            json threadName;
+            threadName["name"] = "thread_name";
+            threadName["ph"] = "M";
+            threadName["pid"] = 1;
+            threadName["tid"] = buffer->threadId;
+            threadName["args"]["name"] = "Thread " + to_string(buffer->threadId);
+            events.push_back(threadName);
+
+            lock_guard<mutex> chunksGuard(buffer->chunksLock);
+            for (unique_ptr<TraceBuffer::Chunk> &chunk : buffer->chunks) {
+                int count = chunk->count.load(memory_order_acquire);
+                for (int i = 0; i < count; i++) {
+                    TraceEvent &event = chunk->events[i];
+                    if (event.start < since) continue;
+                    json j;
+                    j["name"] = event.name;
+                    j["ph"] = "X";
+                    j["pid"] = 1;
+                    j["tid"] = buffer->threadId;
+                    j["ts"] = event.start;
+                    j["dur"] = event.end - event.start;
+                    if (event.clumpIdx >= 0) {
+                        j["args"]["clump"] = event.clumpIdx;
+                    }
+                    events.push_back(j);
+                }
+            }
+        }
+
+        json trace;
+        trace["traceEvents"] = events;
+        trace["displayTimeUnit"] = "ms";
+        ofstream ofs(path);
+        ofs << trace << endl;
+    }
+
+    /*
+     * release frees the full chunks of every thread whose spans all started before the oldest running session,
+     * or every full chunk if no session is running. The chunk a thread is appending to is kept.
+     */
+    void Trace::release() {
+        int64_t oldest;
+        {
+            lock_guard<mutex> guard(sessionsLock);
+            oldest = sessions.empty() ? INT64_MAX : *sessions.begin();
+        }
+        lock_guard<mutex> guard(buffersLock);
+        for (shared_ptr<TraceBuffer> &buffer : buffers) {
+            lock_guard<mutex> chunksGuard(buffer->chunksLock);
+            vector<unique_ptr<TraceBuffer::Chunk>> &chunks = buffer->chunks;
+            // Only the last chunk can still be appended to, the others are full
+            auto last = chunks.empty() ? chunks.end() : chunks.end() - 1;
+            auto unused = remove_if(chunks.begin(), last, [oldest](const unique_ptr<TraceBuffer::Chunk> &chunk) {
+                for (int i = 0; i < TraceBuffer::CHUNK_SIZE; i++) {
+                    if (chunk->events[i].start >= oldest) return false;
+                }
+                return true;
+            });
+            chunks.erase(unused, last);
+        }
+    }
+
+    /*
+     * Constructor for TraceSession, the session starts now
+     */
+    TraceSession::TraceSession() {
+        this->start = Trace::now();
+        lock_guard<mutex> guard(sessionsLock);
+        sessions.insert(this->start);
+    }
+
+    TraceSession::~TraceSession() {
+        {
+            lock_guard<mutex> guard(sessionsLock);
+            sessions.erase(sessions.find(this->start));
+        }
+        if (Trace::isEnabled()) {
+            Trace::release();
+        }
+    }
+
+    /*
+     * Constructor for TraceSpan
+     * name: name of the span, must be a string literal
+     * clumpIdx: index of the clump the span works on, -1 to use the enclosing span's clump
+     */
+    TraceSpan::TraceSpan(const char *name, int clumpIdx) {
+        this->recording = Trace::isEnabled();
+        if (!this->recording) return;
+        this->name = name;
+        this->parentClumpIdx = currentClumpIdx;
+        this->clumpIdx = clumpIdx >= 0 ? clumpIdx : currentClumpIdx;
+        currentClumpIdx = this->clumpIdx;
+        this->start = Trace::now();
+    }
+
+    TraceSpan::~TraceSpan() {
+        end();
+    }
+
+    /*
+     * end records the span before it goes out of scope
+     */
+    void TraceSpan::end() {
+        if (!this->recording) return;
+        this->recording = false;
+        Trace::record(this->name, this->clumpIdx, this->start, Trace::now());
+        currentClumpIdx = this->parentClumpIdx;
+    }
+}
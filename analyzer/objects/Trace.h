@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * Trace records timed spans of the segmentation into a buffer per thread and writes them
+     * as a Chrome trace (trace.json) that can be opened in Perfetto or chrome://tracing.
+     * Tracing is off by default, a disabled span only checks a flag.
+     */
+    class Trace {
+    private:
+        static atomic<bool> enabled;
+
+    public:
+        static void enable();
+        static inline bool isEnabled() {
+            return enabled.load(memory_order_relaxed);
+        }
+        static int64_t now();
+        static void record(const char *name, int clumpIdx, int64_t start, int64_t end);
+        static void write(string path, int64_t since = 0);
+        static void release();
+    };
+
+    /*
+     * TraceSession marks a segmentation that may write the spans recorded since it started.
+     * Spans that started before every running session are freed when a session ends,
+     * so a long running process doesn't keep every span it ever recorded.
+     */
+    class TraceSession {
+    public:
+        int64_t start;
+
+        TraceSession();
+        TraceSession(const TraceSession &) = delete;
+        TraceSession &operator=(const TraceSession &) = delete;
+        ~TraceSession();
+    };
+
+    /*
+     * TraceSpan records the time from its creation to its destruction or end as a span
+     * name must be a string literal, it is stored without being copied.
+     * Spans without a clump inherit the clump of the enclosing span on the same thread.
+     */
+    class TraceSpan {
+    private:
+        const char *name;
+        int clumpIdx;
+        int parentClumpIdx;
+        int64_t start;
+        bool recording;
+
+    public:
+        TraceSpan(const char *name, int clumpIdx = -1);
+        ~TraceSpan();
+        void end();
+    };
+}
+
+#endif //TRACE_H
@@ -0,0 +1,50 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+namespace segment {
+    /*
+     * Variable length integers for the binary checkpoint and mask files, 7 bits per byte with the
+     * high bit set on every byte but the last. Signed values are zigzag encoded first so small
+     * negative values stay short.
+     */
+    inline void writeVarint(string &out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back((char) (value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char) value);
+    }
+
+    inline void writeSignedVarint(string &out, int64_t value) {
+        writeVarint(out, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+    }
+
+    /*
+     * readVarint reads a varint at position and moves position past it
+     * Returns false instead of reading past end
+     */
+    inline bool readVarint(const unsigned char *&position, const unsigned char *end, uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position == end) return false;
+            unsigned char byte = *position++;
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    inline bool readSignedVarint(const unsigned char *&position, const unsigned char *end, int64_t &value) {
+        uint64_t zigzag;
+        if (!readVarint(position, end, zigzag)) return false;
+        value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+        return true;
+    }
+}
+
+#endif //VARINT_H
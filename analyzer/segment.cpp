@@ -30,69 +30,50 @@ compliation example: g++ -std=gnu++17 segment.cpp -l boost_program_options
 
 //#include <napi.h>
 #include <iostream>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include "Segmenter.h"
+#include "SegmenterOptions.h"
+#include "SegmentServer.h"
+#include "BatchSegmenter.h"
+#include "objects/ThreadPool.h"
+#include "objects/MemoryBudget.h"
+#include "objects/ArtifactWriter.h"
+#include "objects/Logger.h"
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
-#include <boost/foreach.hpp>
 
 using namespace std;
 using namespace boost::program_options;
 
 int main (int argc, const char * argv[])
 {
-  //TODO: Cleanup segmenter cosntructors
-    // Default parameters
-    // Quickshift params
-    int kernelsize = 2;
-    int maxdist = 4;
-    // Canny params
-    int threshold1 = 20;
-    int threshold2 = 40;
-    // GMM params
-    int maxGmmIterations = 10;
-    // GMM post processing params
-    double minAreaThreshold = 1000.0;
-    // MSER params
-    double nucleiSize = 35; // Average nuclei size in um
-    double nucleiSizeError = 10; // Nuclei size +/- error
-    int delta = 3, minArea = -1, maxArea = -1;
-    double maxVariation = 0.2, minDiversity = 0.3;
-    double minCircularity = 0.5;
-    // Cell segmentation params
-    double dt = 5; //Time step
-    double epsilon = 1.5; //Pixel spacing
-    double mu = 0.04; //Contour length weighting parameter
-    double kappa = 13;
-    double chi = 3;
-
     try
     {
         options_description desc{"Options"};
         desc.add_options()
           ("help,h", "Help screen")
-          ("dt", value<float>()->default_value(dt), "Timestep")
-          ("epsilon", value<float>()->default_value(epsilon), "Pixel spacing")
-          ("mu", value<float>()->default_value(mu), "Contour length weight")
-          ("kappa", value<float>()->default_value(kappa), "Unary term weight")
-          ("chi", value<float>()->default_value(chi), "Binary term weight")
-          ("maxVariation", value<float>()->default_value(maxVariation), "Max variation")
-          ("minDiversity", value<float>()->default_value(minDiversity), "Min diversity")
-          ("minCircularity", value<float>()->default_value(minCircularity), "Min circularity")
-          ("minAreaThreshold", value<float>()->default_value(minAreaThreshold), "Min area threshold")
-          ("kernelsize", value<int>()->default_value(kernelsize), "Kernel size")
-          ("maxdist", value<int>()->default_value(maxdist), "Max distance")
-          ("threshold1", value<int>()->default_value(threshold1), "Threshold1")
-          ("threshold2", value<int>()->default_value(threshold2), "Threshold2")
-          ("maxGmmIterations", value<int>()->default_value(maxGmmIterations), "Max GMM iterations")
-          ("nucleiSize", value<float>()->default_value(nucleiSize), "Nuclei size")
-          ("nucleiSizeError", value<float>()->default_value(nucleiSizeError), "Nuclei size error")
-          ("delta", value<int>()->default_value(delta), "Delta")
-          ("minArea", value<int>()->default_value(minArea), "Min area")
-          ("maxArea", value<int>()->default_value(maxArea), "Max area")
-          ("image,i", value<std::string>()->default_value(""), "Input image")
-          ("imageResolution", value<float>()->required(), "Image resolution pixels/μm")
-          ("directory,d", value<std::string>()->default_value(""), "Input directory");
+          ("threads", value<int>()->default_value(0), "Number of worker threads, 0 to use every core")
+          ("concurrentImages", value<int>()->default_value(2), "Max number of images of a directory segmented at the same time")
+          ("prefetch", value<int>()->default_value(2), "Number of images of a directory read ahead of the ones being segmented")
+          ("memoryLimit", value<int>()->default_value(0), "Memory in MB the running images, jobs, clumps and preprocessing tiles may use, 0 for no limit")
+          ("writerThreads", value<int>()->default_value(2), "Number of threads encoding result images in the background, 0 to encode them on the segmentation threads")
+          ("writerQueue", value<int>()->default_value(256), "Memory in MB of result images that may wait to be encoded")
+          ("imageFormat", value<std::string>()->default_value("png"), "Format of the result images and thumbnails: png, jpg or webp")
+          ("imageCompression", value<int>()->default_value(-1), "PNG compression level 0-9, or JPEG and WebP quality 0-100, -1 for the format's default")
+          ("logLevel", value<std::string>()->default_value("debug"), "Lowest level of the messages logged: debug, info, warning or error")
+          ("quiet", bool_switch()->default_value(false), "Only print warnings and errors, log files still get every message of --logLevel");
+        desc.add(segment::getSegmenterOptions());
+
+        options_description serverDesc{"Server options"};
+        serverDesc.add_options()
+          ("serve", bool_switch()->default_value(false), "Run as a server that accepts segmentation jobs. Like segment, results are written to ../images/<image name> relative to the working directory, so start it from the analyzer directory")
+          ("socket", value<std::string>()->default_value("/tmp/cytology-segment.sock"), "Unix socket the server listens on")
+          ("port", value<int>()->default_value(0), "Localhost TCP port the server listens on instead of the socket")
+          ("queueSize", value<int>()->default_value(64), "Max number of jobs waiting to start")
+          ("maxCpus", value<int>()->default_value((int) thread::hardware_concurrency()), "Cores all running jobs may use. Each job is counted as using all --threads workers of the shared thread pool, so by default jobs run one at a time. Set it to a multiple of --threads to run that many jobs at once");
+        desc.add(serverDesc);
+
         variables_map vm;
         store(parse_command_line(argc, argv, desc), vm);
         notify(vm);
@@ -101,85 +82,43 @@ int main (int argc, const char * argv[])
       	  cout << desc << "\n";
       	  return 1;
       	}
-	if (vm.count("help")) {
-	  cout << desc << "\n";
-	  return 1;
-	}
 
-        int minArea, maxArea;
-
-        if (vm["minArea"].as<int>() == -1) {
-            minArea = (vm["nucleiSize"].as<float>() - vm["nucleiSizeError"].as<float>())
-                    * vm["imageResolution"].as<float>();
-        } else {
-            minArea = vm["minArea"].as<int>();
+        segment::Logger::setLevel(segment::parseLogLevel(vm["logLevel"].as<std::string>()));
+        segment::Logger::setQuiet(vm["quiet"].as<bool>());
+        segment::ThreadPool::setNumThreads(vm["threads"].as<int>());
+        segment::MemoryBudget::getInstance().setLimit((size_t) vm["memoryLimit"].as<int>() << 20);
+        segment::ArtifactWriter::setNumThreads(vm["writerThreads"].as<int>());
+        segment::ArtifactWriter::setQueueLimit((size_t) vm["writerQueue"].as<int>() << 20);
+        segment::ArtifactWriter::getInstance().setFormat(vm["imageFormat"].as<std::string>(), vm["imageCompression"].as<int>());
+
+        if (vm["serve"].as<bool>()) {
+            int port = vm["port"].as<int>();
+            segment::SegmentServer server(
+                port > 0 ? "" : vm["socket"].as<std::string>(),
+                port,
+                vm["queueSize"].as<int>(),
+                vm["maxCpus"].as<int>(),
+                segment::ThreadPool::getInstance().getNumThreads()
+            );
+            server.start();
+            return 0;
         }
 
-        if (vm["maxArea"].as<int>() == -1) {
-            maxArea = (vm["nucleiSize"].as<float>() + vm["nucleiSizeError"].as<float>())
-                      * vm["imageResolution"].as<float>();
+        segment::Segmenter seg = segment::createSegmenter(vm);
+        vector<boost::filesystem::path> images = segment::getImagePaths(vm);
+
+        if (images.size() > 1) {
+            // Segment the images of a directory several at a time
+            segment::BatchSegmenter batch(
+                seg,
+                vm["concurrentImages"].as<int>(),
+                vm["prefetch"].as<int>()
+            );
+            batch.run(images);
         } else {
-            maxArea = vm["maxArea"].as<int>();
-        }
-
-        segment::Segmenter seg = segment::Segmenter(
-            vm["kernelsize"].as<int>(),
-            vm["maxdist"].as<int>(),
-            vm["threshold1"].as<int>(),
-            vm["threshold2"].as<int>(),
-            vm["maxGmmIterations"].as<int>(),
-            vm["minAreaThreshold"].as<float>(),
-            vm["delta"].as<int>(),
-            minArea,
-            maxArea,
-            vm["maxVariation"].as<float>(),
-            vm["minDiversity"].as<float>(),
-            vm["minCircularity"].as<float>(),
-            vm["dt"].as<float>(),
-            vm["epsilon"].as<float>(),
-            vm["mu"].as<float>(),
-            vm["kappa"].as<float>(),
-            vm["chi"].as<float>()
-        );
-
-        vector<boost::filesystem::path> images;
-
-	    string directory = vm["directory"].as<std::string>();
-        string image = vm["image"].as<std::string>();
-
-        if (directory.empty() && image.empty()) {
-            image = "./images/EDF/EDF000.png";
-        }
-
-        if (!directory.empty()) {
-
-            boost::filesystem::path path(directory);
-            if (boost::filesystem::is_directory(directory)) {
-                boost::filesystem::directory_iterator iter(path), eod;
-                BOOST_FOREACH(boost::filesystem::path const& file, make_pair(iter, eod)){
-                    if (is_regular_file(file)) {
-                        if (file.has_extension()) {
-                            if (file.extension().string() == ".png" ||
-                                file.extension().string() == ".tiff") {
-                                images.push_back(file);
-                            }
-                        }
-                    }
-                }
-            } else {
-                printf("Not a directory: %s\n", directory.c_str());
+            for (boost::filesystem::path const& image : images) {
+                seg.runSegmentation(image.string());
             }
-
-        }
-
-        if (!image.empty()) {
-            images.push_back(image);
-        }
-
-        sort(images.begin(), images.end());
-
-        for (boost::filesystem::path const& image : images) {
-            seg.runSegmentation(image.string());
         }
 
     }
@@ -187,4 +126,5 @@ int main (int argc, const char * argv[])
     {
       std::cerr << ex.what() << '\n';
     }
+    segment::Logger::getInstance().flush();
 }
@@ -0,0 +1,197 @@
+// segment_bench.cpp
+// Runs the full segmentation pipeline over a manifest of images and reports the time of each stage,
+// throughput and peak memory as JSON so builds and machines can be compared.
+// The JSON is written to the --output file, the pipeline's own messages still go to the console.
+//
+// The manifest is a text file with one image per line, optionally followed by the number of times to run it:
+//     ../images/EDF/EDF000.png 5
+// Blank lines and lines starting with # are ignored.
+//
+// Example: ./segment_bench --manifest bench.txt --imageResolution 1 --output bench.json
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <sys/resource.h>
+#include "Segmenter.h"
+#include "SegmenterOptions.h"
+#include "objects/ThreadPool.h"
+#include "objects/Logger.h"
+#include <boost/program_options.hpp>
+
+using namespace std;
+using namespace boost::program_options;
+using json = nlohmann::json;
+
+/*
+ * getProcessPeakRss returns the peak resident memory over the lifetime of the process in megabytes
+ */
+double getProcessPeakRss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in kilobytes on Linux
+    return usage.ru_maxrss / 1024.0;
+}
+
+/*
+ * resetPeakRss resets the peak resident memory reported by getPeakRss to the current resident memory
+ * Returns false if the kernel doesn't allow it, then getPeakRss can't measure a single run
+ */
+bool resetPeakRss() {
+    ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5" << flush;
+    return clearRefs.good();
+}
+
+/*
+ * getPeakRss returns the peak resident memory since resetPeakRss in megabytes, -1 if it can't be read
+ */
+double getPeakRss() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        // VmHWM:     123456 kB
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return stod(line.substr(6)) / 1024.0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * readManifest reads the images and repeat counts of a manifest file
+ */
+vector<pair<string, int>> readManifest(string path, int defaultRepeats) {
+    vector<pair<string, int>> images;
+    ifstream manifest(path);
+    if (!manifest) {
+        throw runtime_error("Could not read manifest: " + path);
+    }
+    string line;
+    while (getline(manifest, line)) {
+        istringstream fields(line);
+        string image;
+        int repeats = defaultRepeats;
+        if (!(fields >> image) || image[0] == '#') continue;
+        fields >> repeats;
+        images.push_back(make_pair(image, max(1, repeats)));
+    }
+    return images;
+}
+
+int main(int argc, const char * argv[])
+{
+    try
+    {
+        options_description desc{"Options"};
+        desc.add_options()
+          ("help,h", "Help screen")
+          ("manifest,m", value<std::string>(), "File listing the images to run, one per line with an optional repeat count")
+          ("repeats,r", value<int>()->default_value(3), "Number of runs of images without a repeat count")
+          ("output,o", value<std::string>(), "JSON file to write the results to")
+          ("threads", value<int>()->default_value(0), "Number of worker threads, 0 to use every core");
+        desc.add(segment::getSegmenterOptions());
+
+        variables_map vm;
+        store(parse_command_line(argc, argv, desc), vm);
+        notify(vm);
+
+        if (vm.count("help")) {
+            cout << desc << "\n";
+            return 1;
+        }
+        // The pipeline also prints to stdout, so the results are only written to a file
+        if (!vm.count("output")) {
+            cerr << "--output is required" << endl;
+            return 1;
+        }
+        string output = vm["output"].as<std::string>();
+        ofstream ofs(output);
+        if (!ofs) {
+            cerr << "Could not write output: " << output << endl;
+            return 1;
+        }
+        segment::Logger::setQuiet(true);
+
+        segment::ThreadPool::setNumThreads(vm["threads"].as<int>());
+        segment::Segmenter seg = segment::createSegmenter(vm);
+        // Every stage is measured from scratch
+        seg.useCache = false;
+        // Stages overlap in the pipeline, so unless asked for time each stage on its own
+        if (vm["pipeline"].defaulted()) {
+            seg.pipeline = false;
+        }
+
+        vector<pair<string, int>> images;
+        if (vm.count("manifest")) {
+            images = readManifest(vm["manifest"].as<std::string>(), vm["repeats"].as<int>());
+        } else {
+            for (boost::filesystem::path const& image : segment::getImagePaths(vm)) {
+                images.push_back(make_pair(image.string(), vm["repeats"].as<int>()));
+            }
+        }
+
+        json results;
+        results["threads"] = segment::ThreadPool::getInstance().getNumThreads();
+        results["pipeline"] = seg.pipeline;
+        results["images"] = json::array();
+        // Without resetting the peak, only the peak of the whole process is reported
+        bool peakPerRun = resetPeakRss();
+
+        double totalSeconds = 0, totalMegapixels = 0, totalCells = 0;
+        for (pair<string, int> &image : images) {
+            json imageResult;
+            imageResult["image"] = image.first;
+            imageResult["runs"] = json::array();
+
+            double seconds = 0, megapixels = 0, cells = 0;
+            double peakRss = 0;
+            vector<double> runTimes;
+            for (int run = 0; run < image.second; run++) {
+                if (peakPerRun) resetPeakRss();
+                seg.runSegmentation(image.first);
+                json stats = seg.stats;
+                if (peakPerRun) {
+                    stats["peakRssMB"] = getPeakRss();
+                    peakRss = max(peakRss, (double) stats["peakRssMB"]);
+                }
+                imageResult["runs"].push_back(stats);
+
+                double runTime = stats["total"];
+                runTimes.push_back(runTime);
+                seconds += runTime;
+                megapixels += (double) stats["megapixels"];
+                cells += (double) stats["cells"];
+            }
+
+            sort(runTimes.begin(), runTimes.end());
+            imageResult["medianSeconds"] = runTimes[runTimes.size() / 2];
+            imageResult["minSeconds"] = runTimes.front();
+            imageResult["megapixelsPerSecond"] = megapixels / seconds;
+            imageResult["cellsPerSecond"] = cells / seconds;
+            if (peakPerRun) {
+                imageResult["peakRssMB"] = peakRss;
+            }
+            results["images"].push_back(imageResult);
+
+            totalSeconds += seconds;
+            totalMegapixels += megapixels;
+            totalCells += cells;
+        }
+
+        results["total"]["seconds"] = totalSeconds;
+        results["total"]["megapixels"] = totalMegapixels;
+        results["total"]["cells"] = totalCells;
+        results["total"]["megapixelsPerSecond"] = totalSeconds > 0 ? totalMegapixels / totalSeconds : 0;
+        results["total"]["cellsPerSecond"] = totalSeconds > 0 ? totalCells / totalSeconds : 0;
+        results["total"]["peakRssMB"] = getProcessPeakRss();
+
+        ofs << results.dump(4) << endl;
+    }
+    catch (const exception &ex)
+    {
+        std::cerr << ex.what() << '\n';
+        return 1;
+    }
+}
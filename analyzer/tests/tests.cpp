@@ -0,0 +1,331 @@
+#include "../objects/Varint.h"
+#include "../objects/MaskFile.h"
+#include "../objects/CheckpointStore.h"
+#include "../objects/ThumbnailPack.h"
+#include "../functions/Gmm.h"
+#include "../functions/ClumpSegmentation.h"
+#include "opencv2/opencv.hpp"
+#include "boost/filesystem.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <cstdint>
+#include <climits>
+#include <string>
+#include <vector>
+#include <functional>
+
+using namespace std;
+using namespace segment;
+
+/*
+ * Round trip tests of the binary storage formats, the thumbnail pack and the histogram gmm, run with make test
+ * Each test returns normally if it passes, CHECK reports a failed condition and fails the test
+ */
+
+static int failedChecks = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failedChecks++; \
+        } \
+    } while (0)
+
+/*
+ * TempDirectory is a directory that is removed with everything in it when it goes out of scope
+ */
+class TempDirectory {
+public:
+    boost::filesystem::path path;
+
+    TempDirectory() {
+        this->path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("cytoseg-test-%%%%%%%%");
+        boost::filesystem::create_directories(this->path);
+    }
+
+    ~TempDirectory() {
+        boost::filesystem::remove_all(this->path);
+    }
+};
+
+/*
+ * testVarint round trips unsigned and zigzag encoded signed varints, and checks that truncated input is rejected
+ */
+static void testVarint() {
+    vector<uint64_t> values = {0, 1, 127, 128, 300, 16383, 16384, 0xFFFFFFFFULL, UINT64_MAX};
+    string out;
+    for (uint64_t value : values) writeVarint(out, value);
+    const unsigned char *position = (const unsigned char *) out.data();
+    const unsigned char *end = position + out.size();
+    for (uint64_t value : values) {
+        uint64_t read;
+        CHECK(readVarint(position, end, read));
+        CHECK(read == value);
+    }
+    CHECK(position == end);
+
+    // Small values of either sign take a single byte, zigzag maps 0, -1, 1, -2 to 0, 1, 2, 3
+    vector<int64_t> signedValues = {0, -1, 1, -2, 63, -64, 64, -65, INT32_MIN, INT32_MAX, INT64_MIN, INT64_MAX};
+    for (int64_t value : signedValues) {
+        string encoded;
+        writeSignedVarint(encoded, value);
+        if (value >= -64 && value <= 63) CHECK(encoded.size() == 1);
+        const unsigned char *start = (const unsigned char *) encoded.data();
+        int64_t read;
+        CHECK(readSignedVarint(start, start + encoded.size(), read));
+        CHECK(read == value);
+    }
+    string zigzag;
+    for (int64_t value : {0, -1, 1, -2}) writeSignedVarint(zigzag, value);
+    CHECK(zigzag == string("\x00\x01\x02\x03", 4));
+
+    // A varint whose last byte is missing can't be read
+    string truncated;
+    writeVarint(truncated, 300);
+    truncated.pop_back();
+    position = (const unsigned char *) truncated.data();
+    uint64_t read;
+    CHECK(!readVarint(position, position + truncated.size(), read));
+}
+
+/*
+ * testMaskFile round trips a mask of long runs, which is run-length encoded, a noisy mask, which is stored raw,
+ * and a mask that is a view of a larger matrix
+ */
+static void testMaskFile() {
+    TempDirectory directory;
+
+    cv::Mat clumps = cv::Mat::zeros(300, 400, CV_8UC1);
+    cv::circle(clumps, cv::Point(100, 120), 60, 255, -1);
+    cv::rectangle(clumps, cv::Rect(250, 40, 100, 200), 1, -1);
+    string clumpsPath = (directory.path / "clumps.mask").string();
+    CHECK(writeMaskFile(clumpsPath, clumps));
+    // Runs of a mostly empty mask are far smaller than its pixels
+    CHECK(boost::filesystem::file_size(clumpsPath) < clumps.total() / 10);
+    cv::Mat read = readMaskFile(clumpsPath);
+    CHECK(read.size() == clumps.size() && read.type() == CV_8UC1);
+    CHECK(cv::countNonZero(read != clumps) == 0);
+
+    cv::Mat noise(64, 80, CV_8UC1);
+    cv::RNG rng(1234);
+    rng.fill(noise, cv::RNG::UNIFORM, 0, 256);
+    string noisePath = (directory.path / "noise.mask").string();
+    CHECK(writeMaskFile(noisePath, noise));
+    read = readMaskFile(noisePath);
+    CHECK(read.size() == noise.size());
+    CHECK(cv::countNonZero(read != noise) == 0);
+
+    cv::Mat view = clumps(cv::Rect(50, 60, 200, 150));
+    string viewPath = (directory.path / "view.mask").string();
+    CHECK(writeMaskFile(viewPath, view));
+    read = readMaskFile(viewPath);
+    CHECK(read.size() == view.size());
+    CHECK(cv::countNonZero(read != view) == 0);
+
+    // Only single channel 8 bit masks are written, files that aren't masks aren't read
+    CHECK(!writeMaskFile((directory.path / "color.mask").string(), cv::Mat::zeros(4, 4, CV_8UC3)));
+    CHECK(readMaskFile((directory.path / "missing.mask").string()).empty());
+}
+
+/*
+ * makeRecord returns a checkpoint record with a contour, neighbors and a value per cell derived from seed
+ */
+static CheckpointRecord makeRecord(int seed, int cells) {
+    CheckpointRecord record;
+    for (int cell = 0; cell < cells; cell++) {
+        vector<cv::Point> contour;
+        for (int i = 0; i < 20 + seed; i++) {
+            contour.push_back(cv::Point(seed * 100 + i, (i * 7 + cell) % 50 - 10));
+        }
+        record.contours.push_back(contour);
+        record.neighbors.push_back({seed, cell, -1});
+        record.values.push_back(seed + cell / 3.0);
+    }
+    return record;
+}
+
+static bool sameRecord(const CheckpointRecord &a, const CheckpointRecord &b) {
+    return a.contours == b.contours && a.neighbors == b.neighbors && a.values == b.values;
+}
+
+/*
+ * testCheckpointStore reopens a store and loads its records, then tears the last record and checks that only it
+ * is cut off and that records appended afterwards are loaded
+ */
+static void testCheckpointStore() {
+    TempDirectory directory;
+    boost::filesystem::path path = directory.path / "stage.ckpt";
+    {
+        CheckpointStore store(path);
+        CHECK(store.isOpen());
+        CHECK(store.size() == 0);
+        for (int clumpIdx = 0; clumpIdx < 3; clumpIdx++) {
+            store.append(clumpIdx, makeRecord(clumpIdx, clumpIdx + 1));
+        }
+        store.flush();
+    }
+    uintmax_t completeSize = boost::filesystem::file_size(path);
+    {
+        CheckpointStore store(path);
+        CHECK(store.size() == 3);
+        for (int clumpIdx = 0; clumpIdx < 3; clumpIdx++) {
+            CheckpointRecord record;
+            CHECK(store.load(clumpIdx, record));
+            CHECK(sameRecord(record, makeRecord(clumpIdx, clumpIdx + 1)));
+        }
+        CHECK(!store.has(3));
+    }
+
+    // A crash in the middle of the last append leaves part of its record
+    boost::filesystem::resize_file(path, completeSize - 5);
+    {
+        CheckpointStore store(path);
+        CHECK(store.size() == 2);
+        CHECK(store.has(0) && store.has(1) && !store.has(2));
+        CheckpointRecord record;
+        CHECK(store.load(1, record));
+        CHECK(sameRecord(record, makeRecord(1, 2)));
+        store.append(2, makeRecord(7, 2));
+        store.flush();
+    }
+    {
+        CheckpointStore store(path);
+        CHECK(store.size() == 3);
+        CheckpointRecord record;
+        CHECK(store.load(2, record));
+        CHECK(sameRecord(record, makeRecord(7, 2)));
+    }
+
+    // A record whose bytes changed fails its CRC and is cut off with everything after it
+    {
+        FILE *file = fopen(path.string().c_str(), "r+b");
+        fseek(file, -3, SEEK_END);
+        fputc(0x55 ^ fgetc(file), file);
+        fclose(file);
+    }
+    {
+        CheckpointStore store(path);
+        CHECK(store.size() == 2);
+        CHECK(!store.has(2));
+    }
+
+    // Records of a previous run are discarded if they aren't loaded
+    {
+        CheckpointStore store(path, false);
+        CHECK(store.size() == 0);
+    }
+    {
+        CheckpointStore store(path);
+        CHECK(store.size() == 0);
+    }
+}
+
+/*
+ * testThumbnailPack packs thumbnails of different sizes and checks that the range of each entry decodes to it
+ */
+static void testThumbnailPack() {
+    TempDirectory directory;
+    boost::filesystem::path path = directory.path / "thumbnails.pack";
+    vector<cv::Mat> thumbnails;
+    vector<pair<uint64_t, uint64_t>> entries;
+    {
+        ThumbnailPack pack(path);
+        cv::RNG rng(42);
+        for (int i = 0; i < 8; i++) {
+            cv::Mat thumbnail(10 + i * 3, 20 - i, CV_8UC3);
+            rng.fill(thumbnail, cv::RNG::UNIFORM, 0, 256);
+            thumbnails.push_back(thumbnail.clone());
+            CHECK(pack.add(move(thumbnail)) == (size_t) i);
+        }
+        // Nothing replaces the pack before every thumbnail is in it
+        CHECK(!boost::filesystem::exists(path));
+        CHECK(pack.finish());
+        entries = pack.getEntries();
+    }
+    CHECK(entries.size() == thumbnails.size());
+
+    ifstream file(path.string(), ios::binary);
+    vector<uchar> bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    // Thumbnails are appended in the order they are encoded, together they cover the whole file once
+    uint64_t packed = 0;
+    for (size_t i = 0; i < entries.size() && i < thumbnails.size(); i++) {
+        uint64_t offset = entries[i].first, length = entries[i].second;
+        CHECK(length > 0 && offset + length <= bytes.size());
+        if (length == 0 || offset + length > bytes.size()) continue;
+        packed += length;
+        vector<uchar> encoded(bytes.begin() + offset, bytes.begin() + offset + length);
+        cv::Mat decoded = cv::imdecode(encoded, cv::IMREAD_COLOR);
+        CHECK(decoded.size() == thumbnails[i].size());
+        if (decoded.size() == thumbnails[i].size()) CHECK(cv::countNonZero(decoded.reshape(1) != thumbnails[i].reshape(1)) == 0);
+    }
+    CHECK(packed == bytes.size());
+
+    // A pack that isn't finished is discarded and leaves the previous pack as it was
+    {
+        ThumbnailPack pack(path);
+        pack.add(cv::Mat::zeros(4, 4, CV_8UC3));
+    }
+    CHECK(boost::filesystem::file_size(path) == bytes.size());
+}
+
+/*
+ * testHistogramGmm checks that the gmm trained on the histogram labels every pixel like cv::ml::EM trained on
+ * every pixel from the same start as runGmm, on an image of dark cells on a bright background
+ */
+static void testHistogramGmm() {
+    for (int seed = 0; seed < 4; seed++) {
+        cv::RNG rng(seed);
+        cv::Mat gray(96, 128, CV_8UC1);
+        rng.fill(gray, cv::RNG::NORMAL, 200, 12);
+        cv::Mat cellMask = cv::Mat::zeros(gray.size(), CV_8UC1);
+        vector<vector<cv::Point>> hulls;
+        vector<cv::Vec3i> cells = {cv::Vec3i(30, 30, 14), cv::Vec3i(80, 50, 20), cv::Vec3i(40, 75, 10)};
+        for (cv::Vec3i &cell : cells) {
+            cv::circle(cellMask, cv::Point(cell[0], cell[1]), cell[2], 255, -1);
+            // Hulls are a little off the cells like the hulls of the detected edges
+            vector<cv::Point> hull;
+            cv::ellipse2Poly(cv::Point(cell[0] + 2, cell[1]), cv::Size(cell[2] + 3, cell[2] + 3), 0, 0, 360, 10, hull);
+            hulls.push_back(hull);
+        }
+        cv::Mat cellPixels(gray.size(), CV_8UC1);
+        rng.fill(cellPixels, cv::RNG::NORMAL, 100, 20);
+        cellPixels.copyTo(gray, cellMask);
+        cv::Mat image;
+        cv::cvtColor(gray, image, cv::COLOR_GRAY2BGR);
+
+        for (int iterations : {1, 10}) {
+            cv::Mat em = runGmm(&image, hulls, iterations);
+            cv::Mat histogram = runHistogramGmm(&image, hulls, iterations);
+            CHECK(em.size() == histogram.size());
+            CHECK(cv::countNonZero(em != histogram) == 0);
+        }
+    }
+
+    // Two well separated groups of samples, the start decides which component is which
+    vector<double> samples = {10, 11, 12, 13, 200, 201, 202, 203};
+    vector<double> weights(samples.size(), 1);
+    vector<double> responsibilities = {0.9, 0.9, 0.9, 0.9, 0.1, 0.1, 0.1, 0.1};
+    vector<unsigned char> components = fitGmm(samples, weights, responsibilities, 10);
+    CHECK((components == vector<unsigned char>{1, 1, 1, 1, 0, 0, 0, 0}));
+}
+
+int main() {
+    vector<pair<string, function<void()>>> tests = {
+        {"varint", testVarint},
+        {"maskFile", testMaskFile},
+        {"checkpointStore", testCheckpointStore},
+        {"thumbnailPack", testThumbnailPack},
+        {"histogramGmm", testHistogramGmm},
+    };
+    int failedTests = 0;
+    for (auto &test : tests) {
+        int failedBefore = failedChecks;
+        test.second();
+        bool passed = failedChecks == failedBefore;
+        if (!passed) failedTests++;
+        printf("%s %s\n", passed ? "PASS" : "FAIL", test.first.c_str());
+    }
+    printf("%zu tests, %d failed\n", tests.size(), failedTests);
+    return failedTests == 0 ? 0 : 1;
+}
@@ -86,15 +86,22 @@ function initArchive() {
     return archive;
 }
 
-function inlineFile(fileStream, fileName, req, res, next) {
+function inlineFile(fileStream, fileName, req, res, next, range, size) {
     let header = {
+        "Accept-Ranges": "bytes",
         "Content-Disposition": "inline",
-        "Content-Type": mime.getType(fileName)
+        "Content-Type": mime.getType(fileName) || "application/octet-stream"
     };
     if (fileName) {
         header["Content-Disposition"] += `; filename="${encodeURIComponent(path.basename(fileName))}"`;
     }
-    res.writeHead(200, header);
+    if (range) {
+        header["Content-Range"] = `bytes ${range.start}-${range.end}/${size}`;
+        header["Content-Length"] = range.end - range.start + 1;
+        res.writeHead(206, header);
+    } else {
+        res.writeHead(200, header);
+    }
     fileStream.pipe(res);
 }
 
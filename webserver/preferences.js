@@ -5,6 +5,7 @@ const configurationFile = "preferences.json";
 
 let defaultConfiguration = {
     files: "../images",
+    analyzerSocket: "/tmp/cytology-segment.sock",
     port: 443,
     httpRedirectServer: false,
     keys: {
@@ -1,6 +1,8 @@
 
 let nucleiCytoRatios;
 let thumbnails;
+let thumbnailPack;
+let thumbnailFormat;
 let sorted;
 let page = 0;
 let shownThumbnails;
@@ -52,19 +54,52 @@ function initThumbnails() {
 
     let thumbnailMin = thumbnails[sorted[shownThumbnailsIdx[0]]];
     let thumbnailMax = thumbnails[sorted[shownThumbnailsIdx[shownThumbnailsIdx.length - 1]]];
+    releaseThumbnails("#lower-bound-thumbnail, #upper-bound-thumbnail");
     $("#lower-bound-thumbnail").html(`
-                <img class="thumbnail" height=50px src="${location.pathname + "/thumbnails/" + thumbnailMin}" loading="lazy">               
+                ${thumbnailImage(thumbnailMin, "height=50px")}
             `)
 
     $("#upper-bound-thumbnail").html(` 
-                <img class="thumbnail" height=50px src="${location.pathname + "/thumbnails/" + thumbnailMax}" loading="lazy">              
+                ${thumbnailImage(thumbnailMax, "height=50px")}
             `)
+    loadPackedThumbnails("#lower-bound-thumbnail, #upper-bound-thumbnail");
 
 
     displayThumbnails(page)
 }
 
+// Returns the img tag of a thumbnail, thumbnails of a pack are loaded by loadPackedThumbnails once they are on the page
+function thumbnailImage(thumbnail, attributes = "") {
+    if (!thumbnailPack) {
+        return `<img class="thumbnail" ${attributes} src="${location.pathname + "/thumbnails/" + thumbnail}" loading="lazy">`;
+    }
+    return `<img class="thumbnail packed-thumbnail" ${attributes} data-offset="${thumbnail[0]}" data-length="${thumbnail[1]}">`;
+}
+
+// Reads each packed thumbnail in the element with a range request of its bytes in the thumbnail pack
+function loadPackedThumbnails(element) {
+    $(element).find(".packed-thumbnail").each(async function () {
+        const offset = parseInt(this.dataset.offset);
+        const length = parseInt(this.dataset.length);
+        if (!length) return;
+        const response = await fetch(location.pathname + "/" + thumbnailPack, {
+            headers: {Range: `bytes=${offset}-${offset + length - 1}`}
+        });
+        let blob = await response.blob();
+        // The whole pack is sent if the server ignores the range
+        if (response.status !== 206) blob = blob.slice(offset, offset + length);
+        this.src = URL.createObjectURL(new Blob([blob], {type: "image/" + thumbnailFormat}));
+    });
+}
+
+function releaseThumbnails(element) {
+    $(element).find(".packed-thumbnail").each(function () {
+        if (this.src) URL.revokeObjectURL(this.src);
+    });
+}
+
 function displayThumbnails(page) {
+    releaseThumbnails("#thumbnails");
     $("#thumbnails").empty();
     let shownThumbnailsData = [];
     for (let i = 0; i < Math.min(thumbnailsPerPage, shownThumbnails.length); i++) {
@@ -79,7 +114,7 @@ function displayThumbnails(page) {
                         <tr>
                             <td>
                                 <div style="text-align: center">
-                                    <img class="thumbnail" src="${location.pathname + "/thumbnails/" + thumbnail}" loading="lazy">
+                                    ${thumbnailImage(thumbnail)}
                                 </div>
                             </td>
                             
@@ -95,6 +130,7 @@ function displayThumbnails(page) {
                     
                 `);
     }
+    loadPackedThumbnails("#thumbnails");
     $(".good_segmentation").click(function() {
         $(this).prop("disabled", true)
         showSnackbar(basicSnackbar, locale["thanks_feedback"])
@@ -129,6 +165,8 @@ function filterData() {
 function parseData(exportData) {
     nucleiCytoRatios = exportData["nucleiCytoRatios"];
     thumbnails = exportData["thumbnails"];
+    thumbnailPack = exportData["thumbnailPack"];
+    thumbnailFormat = exportData["thumbnailFormat"] === "jpg" ? "jpeg" : exportData["thumbnailFormat"];
     sorted = exportData["sorted"];
 
     filterData();
@@ -5,13 +5,63 @@ const preferences = require('../preferences');
 const multer = require("multer");
 const multerStorage = require('../modules/multer/StorageEngine');
 const terminal = require('../terminal');
+const log = require('../log');
 const router = express.Router();
 const url = require('url');
+const http = require('http');
 
 router.get('/', function(req, res, next) {
     res.render('analyze', {});
 });
 
+/*
+ * submitJob queues a segmentation job on the analyzer server (segment --serve)
+ * Falls back to starting a segment process if the server isn't running or doesn't accept the job,
+ * like when its queue is full
+ */
+function submitJob(filePath, body) {
+    const job = {image: filePath};
+    for (let arg in body) {
+        job[arg] = body[arg].trim();
+    }
+    const content = JSON.stringify(job);
+    const request = http.request({
+        socketPath: preferences.get("analyzerSocket"),
+        path: "/jobs",
+        method: "POST",
+        headers: {
+            "Content-Type": "application/json",
+            "Content-Length": Buffer.byteLength(content)
+        }
+    }, function (response) {
+        let reply = "";
+        response.on('data', function (data) {
+            reply += data;
+        });
+        response.on('end', function () {
+            if (response.statusCode >= 200 && response.statusCode < 300) {
+                log.write(`Analyzer job for ${filePath}: ${response.statusCode} ${reply}`);
+                return;
+            }
+            log.write(`Analyzer server did not accept job for ${filePath}: ${response.statusCode} ${reply}, running segment instead`);
+            runSegment(filePath, body);
+        });
+    });
+    request.on('error', function (err) {
+        log.write(`Analyzer server unavailable for ${filePath}: ${err.message}, running segment instead`);
+        runSegment(filePath, body);
+    });
+    request.end(content);
+}
+
+function runSegment(filePath, body) {
+    let args = ""
+    for (let arg in body) {
+        args += `--${arg}=${body[arg].trim()} `
+    }
+    terminal(`../analyzer/segment --image="${filePath}" ${args}`);
+}
+
 router.post('/*', async function(req, res, next) {
     const files = preferences.get("files");
     const body = url.parse(req.url,true).query
@@ -20,11 +70,7 @@ router.post('/*', async function(req, res, next) {
         const uploadFile = async function (file) {
             let filePath = path.join(files, file.originalname, file.originalname);
             await fileManager.writeFile(filePath, file.stream, null, overwrite);
-            let args = ""
-            for (let arg in body) {
-                args += `--${arg}=${body[arg].trim()} `
-            }
-            terminal(`../analyzer/segment --image="${filePath}" ${args}`);
+            submitJob(filePath, body);
         }
         return multer({storage: multerStorage(uploadFile)}).any()(req, res, function(err) {
             if (err) res.status(500).send(res.locals.locale["upload_failed"]);
@@ -59,16 +59,23 @@ const files = function(getRelativeDirectory, getFilePath) {
                     break;
             }
         } else {
-            const fileStream = await fileManager.readFile(filePath);
             switch (parameter) {
                 case "download":
-                    fileManager.downloadFile(fileStream, fileName, req, res, next);
+                    fileManager.downloadFile(await fileManager.readFile(filePath), fileName, req, res, next);
                     break;
                 case "view":
                     await fileManager.renderFile(fileName, req, res, next);
                     break;
                 default:
-                    fileManager.inlineFile(fileStream, fileName, req, res, next);
+                    // A single byte range is served on its own so clients can read parts of a file, like a thumbnail of a thumbnails.pack
+                    const ranges = req.headers.range ? req.range(stats.size) : undefined;
+                    if (ranges === -1) {
+                        res.set("Content-Range", `bytes */${stats.size}`);
+                        return res.sendStatus(416);
+                    }
+                    const range = (Array.isArray(ranges) && ranges.type === "bytes" && ranges.length === 1) ? ranges[0] : undefined;
+                    const fileStream = await fileManager.readFile(filePath, range);
+                    fileManager.inlineFile(fileStream, fileName, req, res, next, range, stats.size);
                     break;
             }
         }
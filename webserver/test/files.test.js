@@ -0,0 +1,94 @@
+const assert = require("assert");
+const express = require("express");
+const fs = require("fs");
+const http = require("http");
+const os = require("os");
+const path = require("path");
+const {after, before, test} = require("node:test");
+
+const files = require("../routes/files");
+
+// Bytes of a file standing in for a thumbnails.pack, each byte is its own offset
+const content = Buffer.from(Array.from({length: 64}, (value, i) => i));
+
+let directory;
+let server;
+
+function get(filePath, range) {
+    return new Promise((resolve, reject) => {
+        const headers = range ? {Range: range} : {};
+        http.get({port: server.address().port, path: filePath, headers: headers}, res => {
+            const chunks = [];
+            res.on("data", chunk => chunks.push(chunk));
+            res.on("end", () => resolve({status: res.statusCode, headers: res.headers, body: Buffer.concat(chunks)}));
+        }).on("error", reject);
+    });
+}
+
+before(async () => {
+    directory = await fs.promises.mkdtemp(path.join(os.tmpdir(), "files-test-"));
+    await fs.promises.writeFile(path.join(directory, "thumbnails.pack"), content);
+    const app = express();
+    // Keeps the 404 of the missing file test out of the output
+    app.set("env", "test");
+    app.use("/files", files(async req => directory));
+    await new Promise(resolve => server = app.listen(0, resolve));
+});
+
+after(async () => {
+    await new Promise(resolve => server.close(resolve));
+    await fs.promises.rm(directory, {recursive: true, force: true});
+});
+
+test("serves the whole file without a range", async () => {
+    const res = await get("/files/thumbnails.pack");
+    assert.strictEqual(res.status, 200);
+    assert.strictEqual(res.headers["accept-ranges"], "bytes");
+    assert.deepStrictEqual(res.body, content);
+});
+
+test("serves a single byte range with 206", async () => {
+    const res = await get("/files/thumbnails.pack", "bytes=10-19");
+    assert.strictEqual(res.status, 206);
+    assert.strictEqual(res.headers["content-range"], `bytes 10-19/${content.length}`);
+    assert.strictEqual(res.headers["content-length"], "10");
+    assert.deepStrictEqual(res.body, content.subarray(10, 20));
+});
+
+test("serves open and suffix ranges up to the end of the file", async () => {
+    let res = await get("/files/thumbnails.pack", "bytes=60-");
+    assert.strictEqual(res.status, 206);
+    assert.strictEqual(res.headers["content-range"], `bytes 60-63/${content.length}`);
+    assert.deepStrictEqual(res.body, content.subarray(60));
+
+    res = await get("/files/thumbnails.pack", "bytes=-4");
+    assert.strictEqual(res.status, 206);
+    assert.deepStrictEqual(res.body, content.subarray(60));
+
+    // A range past the end is cut off at the end of the file
+    res = await get("/files/thumbnails.pack", "bytes=50-1000");
+    assert.strictEqual(res.status, 206);
+    assert.strictEqual(res.headers["content-range"], `bytes 50-63/${content.length}`);
+    assert.deepStrictEqual(res.body, content.subarray(50));
+});
+
+test("rejects a range that starts past the end with 416", async () => {
+    const res = await get("/files/thumbnails.pack", `bytes=${content.length}-`);
+    assert.strictEqual(res.status, 416);
+    assert.strictEqual(res.headers["content-range"], `bytes */${content.length}`);
+});
+
+test("serves the whole file for several ranges or a range that isn't bytes", async () => {
+    let res = await get("/files/thumbnails.pack", "bytes=0-3,8-11");
+    assert.strictEqual(res.status, 200);
+    assert.deepStrictEqual(res.body, content);
+
+    res = await get("/files/thumbnails.pack", "items=0-3");
+    assert.strictEqual(res.status, 200);
+    assert.deepStrictEqual(res.body, content);
+});
+
+test("returns 404 for a missing file", async () => {
+    const res = await get("/files/missing.pack", "bytes=0-3");
+    assert.strictEqual(res.status, 404);
+});